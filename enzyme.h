@@ -15,7 +15,9 @@
 
 #include "enzyme_type.h"
 
+#include <atomic>
 #include <list>
+#include <mutex>
 #include <sstream>
 
 
@@ -47,6 +49,30 @@ namespace enzyme
     }
 
 
+    ///
+    /// @brief AutoLex of a fixed string
+    ///
+
+    class StringLex : public AutoLex
+    {
+    private:
+        std::string mString;
+
+    public:
+        StringLex(const std::string& str = std::string())
+            : mString(str)
+        {
+        }
+
+        const std::string& string() const { return mString; }
+
+        std::ostream& lex(std::ostream& os) const
+        {
+            return os << mString;
+        }
+    };
+
+
     ///
     /// @brief Node in device tree: device or enumerator
     ///
@@ -57,7 +83,9 @@ namespace enzyme
         std::list<Device*> mChild;
 
     public:
-        std::list<Device*>& child() { return mChild; }
+        virtual ~Node() { }
+
+        virtual std::list<Device*>& child() { return mChild; }
         std::list<Device*> child(const std::string& id);
     };
 
@@ -111,9 +139,28 @@ namespace enzyme
     };
 
 
+    ///
+    /// @brief Wall time spent in each enumeration phase, in nanoseconds; 0 if not run
+    ///
+
+    typedef struct
+    {
+        uint64_t cpu;           // cpu::Enumerator construction
+        uint64_t pci;           // pci::Enumerator construction
+        uint64_t collect;       // child() collection, after any enumeration it started
+        uint64_t constructor;   // Concurrent constructor, both subsystems; 0 if Lazy
+    }
+    Timing;
+
+
     ///
     /// @brief System enumerator
     ///
+    /// Each subsystem is enumerated on first access to it, once, from any
+    /// thread; child() enumerates all of them and collects their devices.
+    /// With the Concurrent option the constructor instead enumerates the CPU
+    /// and PCI subsystems on two threads and returns once both are done.
+    ///
 
     class Enumerator : public Device
     {
@@ -121,12 +168,41 @@ namespace enzyme
         cpu::Enumerator* mCPU;
         pci::Enumerator* mPCI;
 
+        std::once_flag mCPUOnce;
+        std::once_flag mPCIOnce;
+        std::once_flag mChildOnce;
+
+        // Written by whichever thread runs a phase, read by any
+        std::atomic<uint64_t> mCPUTime;
+        std::atomic<uint64_t> mPCITime;
+        std::atomic<uint64_t> mCollectTime;
+        std::atomic<uint64_t> mConstructorTime;
+
+    private:
+        Enumerator(const Enumerator&);
+        Enumerator& operator=(const Enumerator&);
+
+        void concurrent();
+
     public:
-        Enumerator();
+        typedef enum
+        {
+            Lazy = 0,
+            Concurrent = 1
+        }
+        Option;
+
+        explicit Enumerator(Option option = Lazy);
         ~Enumerator();
 
-        cpu::Enumerator& cpu() { return *mCPU; }
-        pci::Enumerator& pci() { return *mPCI; }
+        Timing timing() const;
+        std::ostream& report(std::ostream& os) const;
+
+        cpu::Enumerator& cpu();
+        pci::Enumerator& pci();
+
+        using Node::child;
+        std::list<Device*>& child();
     };
 };
 
@@ -0,0 +1,62 @@
+///
+/// @file    enzyme_arena.cpp
+/// @brief   Enzyme Hardware Abstraction Layer: Enumeration Arena
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#include "enzyme_arena.h"
+
+
+// ---------------------------------------------------------------------------
+
+
+void* enzyme::Arena::Upstream::do_allocate(size_t bytes, size_t align)
+{
+    void* p = mNext->allocate(bytes, align);
+    mBlocks++;
+    mBytes += bytes;
+    return p;
+}
+
+
+void enzyme::Arena::Upstream::do_deallocate(void* p, size_t bytes, size_t align)
+{
+    mNext->deallocate(p, bytes, align);
+    mBlocks--;
+    mBytes -= bytes;
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+///
+/// @brief Create an empty arena; the first block is allocated on first use
+///
+
+enzyme::Arena::Arena(size_t initial, std::pmr::memory_resource* upstream)
+    : mUpstream(upstream)
+    , mBuffer(initial, &mUpstream)
+    , mAllocations(0)
+    , mUsed(0)
+{
+}
+
+
+void* enzyme::Arena::do_allocate(size_t bytes, size_t align)
+{
+    mAllocations++;
+    mUsed += bytes;
+    return mBuffer.allocate(bytes, align);
+}
+
+
+std::ostream& enzyme::Arena::lex(std::ostream& os) const
+{
+    return os << std::dec << "allocations=" << mAllocations << " used=" << mUsed
+              << " blocks=" << blocks() << " reserved=" << reserved();
+}
@@ -0,0 +1,131 @@
+///
+/// @file    enzyme_arena.h
+/// @brief   Enzyme Hardware Abstraction Layer: Enumeration Arena
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef _enzyme_arena_h_
+#define _enzyme_arena_h_
+
+
+#include "enzyme.h"
+
+#include <deque>
+#include <memory_resource>
+
+
+namespace enzyme
+{
+
+    ///
+    /// @brief Monotonic memory resource for an enumerated tree
+    ///
+    /// Everything is carved from a few large blocks obtained from the upstream
+    /// resource and released together when the arena is destroyed; individual
+    /// deallocations are ignored. Not thread-safe: an arena serves one
+    /// enumerator, which fills it while it is constructed.
+    ///
+
+    class Arena : public std::pmr::memory_resource, public AutoLex
+    {
+    private:
+
+        ///
+        /// @brief Upstream wrapper counting the blocks the arena holds
+        ///
+
+        class Upstream : public std::pmr::memory_resource
+        {
+        private:
+            std::pmr::memory_resource* mNext;
+
+        public:
+            size_t mBlocks;
+            size_t mBytes;
+
+            explicit Upstream(std::pmr::memory_resource* next)
+                : mNext(next)
+                , mBlocks(0)
+                , mBytes(0)
+            {
+            }
+
+        protected:
+            void* do_allocate(size_t bytes, size_t align);
+            void do_deallocate(void* p, size_t bytes, size_t align);
+            bool do_is_equal(const std::pmr::memory_resource& other) const noexcept { return this == &other; }
+        };
+
+        Upstream mUpstream;
+        std::pmr::monotonic_buffer_resource mBuffer;
+        size_t mAllocations;
+        size_t mUsed;
+
+        Arena(const Arena&);
+        Arena& operator=(const Arena&);
+
+    protected:
+        void* do_allocate(size_t bytes, size_t align);
+        void do_deallocate(void* p, size_t bytes, size_t align) { }
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept { return this == &other; }
+
+    public:
+        explicit Arena(size_t initial = 64 * 1024, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource());
+
+        size_t allocations()    const { return mAllocations; }      ///< Requests served
+        size_t used()           const { return mUsed; }             ///< Bytes requested
+        size_t blocks()         const { return mUpstream.mBlocks; } ///< Blocks held from upstream
+        size_t reserved()       const { return mUpstream.mBytes; }  ///< Bytes held; also the peak, as nothing is freed early
+
+        std::ostream& lex(std::ostream& os) const;
+    };
+
+
+    ///
+    /// @brief Pool of shared strings
+    ///
+    /// Names that repeat across a tree (the CPU brand of every core, the
+    /// driver of every function) are stored once; devices hold references to
+    /// the pooled lexers, or their indices, which stay valid as long as the
+    /// pool. Lookup is linear, for the handful of distinct names in a tree.
+    ///
+
+    class Intern
+    {
+    private:
+        std::pmr::deque<StringLex> mString;
+
+        Intern(const Intern&);
+        Intern& operator=(const Intern&);
+
+    public:
+        explicit Intern(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            : mString(resource)
+        {
+        }
+
+        size_t index(const std::string& str)
+        {
+            for(size_t i = 0; i < mString.size(); i++)
+            {
+                if(mString[i].string() == str)
+                    return i;
+            }
+            mString.push_back(StringLex(str));
+            return mString.size() - 1;
+        }
+
+        const StringLex& operator()(const std::string& str) { return mString[index(str)]; }
+        const StringLex& operator[](size_t index) const { return mString[index]; }
+
+        size_t size() const { return mString.size(); }
+    };
+};
+
+
+#endif  // _enzyme_arena_h_
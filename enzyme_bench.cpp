@@ -0,0 +1,312 @@
+///
+/// @file    enzyme_bench.cpp
+/// @brief   Enzyme Hardware Abstraction Layer: Benchmarks
+///
+/// Builds a synthetic Sysfs tree of PCI functions in a temporary directory,
+/// enumerates it and reports the allocations made, the memory retained by
+/// the tree, the peak and the time taken; then the same once the Device
+/// objects are built from the records. Every operator new is counted. Each
+/// run is made twice, with the enumerator's arena and with every allocation
+/// going to std::pmr::new_delete_resource(), for comparison; the processors
+/// of this machine are then enumerated in the same two ways.
+///
+/// Then pushes descriptors through a ring to an emulated device and reports
+/// the throughput and the distribution of enqueue to dequeue latency.
+///
+/// Built with ENZYME_PERF, the counts of every instrumented library
+/// operation are printed last.
+///
+///     bin/enzyme_bench [functions] [descriptors]     (default 10000 1000000)
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#include "enzyme_platform.h"
+#include "enzyme_perf.h"
+#include "enzyme_ring.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <malloc.h>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// ---------------------------------------------------------------------------
+
+
+namespace
+{
+    bool gCount = false;
+    size_t gAllocations = 0;
+    size_t gBlocks = 0;
+    size_t gLive = 0;
+    size_t gPeak = 0;
+
+    void* counted(void* p)
+    {
+        if(!p)
+            throw std::bad_alloc();
+        if(gCount)
+        {
+            gAllocations++;
+            gBlocks++;
+            gLive += malloc_usable_size(p);
+            if(gLive > gPeak)
+                gPeak = gLive;
+        }
+        return p;
+    }
+
+    void release(void* p)
+    {
+        if(p && gCount)
+        {
+            gBlocks--;
+            gLive -= malloc_usable_size(p);
+        }
+        free(p);
+    }
+};
+
+
+void* operator new(size_t size)                                     { return counted(malloc(size ? size : 1)); }
+void* operator new(size_t size, std::align_val_t align)             { return counted(aligned_alloc(static_cast<size_t>(align), (size + static_cast<size_t>(align) - 1) & ~(static_cast<size_t>(align) - 1))); }
+void operator delete(void* p) noexcept                              { release(p); }
+void operator delete(void* p, size_t) noexcept                      { release(p); }
+void operator delete(void* p, std::align_val_t) noexcept            { release(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept    { release(p); }
+
+
+// ---------------------------------------------------------------------------
+
+
+namespace
+{
+    void put(const std::string& path, const std::string& text)
+    {
+        FILE* f = fopen(path.c_str(), "w");
+        if(!f)
+            throw std::runtime_error("Bench: Failed to create " + path);
+        fputs(text.c_str(), f);
+        fclose(f);
+    }
+
+    ///
+    /// @brief Write count functions, each with a driver, NUMA node and two BARs
+    ///
+
+    void build(const std::string& root, unsigned int count)
+    {
+        std::string pci = root + "/bus/pci";
+        const char* dir[] = { "/bus", "/bus/pci", "/bus/pci/devices", "/bus/pci/drivers", "/bus/pci/drivers/nvme", "/bus/pci/drivers/xhci_hcd" };
+        for(size_t i = 0; i < sizeof(dir) / sizeof(dir[0]); i++)
+            mkdir((root + dir[i]).c_str(), 0755);
+
+        for(unsigned int i = 0; i < count; i++)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "0000:%02x:%02x.%x", i / 256, (i / 8) % 32, i % 8);
+            std::string path = pci + "/devices/" + name;
+            mkdir(path.c_str(), 0755);
+
+            bool nvme = (i % 2) == 0;
+            char res[256];
+            snprintf(res, sizeof(res),
+                     "0x%016llx 0x%016llx 0x0000000000040200\n"
+                     "0x0000000000000000 0x0000000000000000 0x0000000000000000\n"
+                     "0x%016llx 0x%016llx 0x0000000000040101\n",
+                     0xF0000000ULL + i * 0x4000ULL, 0xF0000000ULL + i * 0x4000ULL + 0x3FFF,
+                     0x2000ULL + i * 0x20ULL, 0x2000ULL + i * 0x20ULL + 0x1F);
+
+            put(path + "/vendor", "0x8086\n");
+            put(path + "/device", nvme ? "0x0953\n" : "0x1234\n");
+            put(path + "/class", nvme ? "0x010802\n" : "0x0c0330\n");
+            put(path + "/subsystem_vendor", "0x8086\n");
+            put(path + "/subsystem_device", "0x0001\n");
+            put(path + "/numa_node", (i < count / 2) ? "0\n" : "1\n");
+            put(path + "/local_cpulist", (i < count / 2) ? "0-7\n" : "8-15\n");
+            put(path + "/resource", res);
+            if(symlink(nvme ? "../../../bus/pci/drivers/nvme" : "../../../bus/pci/drivers/xhci_hcd", (path + "/driver").c_str()) < 0)
+                throw std::runtime_error("Bench: Failed to link driver of " + path);
+        }
+    }
+
+    int remove(const char* path, const struct stat*, int, struct FTW*)
+    {
+        return ::remove(path);
+    }
+
+    double elapsed(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+
+    void begin()
+    {
+        gAllocations = 0;
+        gBlocks = 0;
+        gLive = 0;
+        gPeak = 0;
+        gCount = true;
+    }
+
+    const char* name(std::pmr::memory_resource* resource)
+    {
+        return resource ? "new_delete" : "arena";
+    }
+
+    ///
+    /// @brief Enumerate the synthetic tree, then build its devices
+    ///
+
+    void pci(std::pmr::memory_resource* resource)
+    {
+        begin();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        enzyme::pci::os::Enumerator* pci = new enzyme::pci::os::Enumerator(resource);
+        double scan = elapsed(start);
+
+        printf("%s records %zu: %.1f ms, allocations %zu, retained %zu blocks / %zu KiB, peak %zu KiB\n",
+               name(resource), pci->record().size(), scan, gAllocations, gBlocks, gLive / 1024, gPeak / 1024);
+
+        start = std::chrono::steady_clock::now();
+        size_t devices = pci->device().size();
+        double materialize = elapsed(start);
+
+        printf("%s devices %zu: %.1f ms, allocations %zu, retained %zu blocks / %zu KiB, peak %zu KiB\n",
+               name(resource), devices, materialize, gAllocations, gBlocks, gLive / 1024, gPeak / 1024);
+        if(!resource)
+            printf("arena: %s\n", pci->arena().str().c_str());
+
+        delete pci;
+        gCount = false;
+    }
+
+    ///
+    /// @brief Enumerate the processors; the brand string of every core is interned once
+    ///
+
+    void cpu(std::pmr::memory_resource* resource)
+    {
+        begin();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        enzyme::cpu::Enumerator* cpu = new enzyme::cpu::Enumerator(resource);
+        double scan = elapsed(start);
+
+        printf("%s cores %zu: %.1f ms, allocations %zu, retained %zu blocks / %zu KiB, peak %zu KiB\n",
+               name(resource), cpu->core().size(), scan, gAllocations, gBlocks, gLive / 1024, gPeak / 1024);
+        if(!resource)
+            printf("arena: %s\n", cpu->arena().str().c_str());
+
+        delete cpu;
+        gCount = false;
+    }
+
+
+    typedef struct
+    {
+        uint64_t addr;
+        uint32_t len;
+        uint32_t flag;
+    }
+    Descriptor;
+
+    ///
+    /// @brief Push count descriptors through a ring in batches of 32
+    ///
+
+    void ring(unsigned int count)
+    {
+        enzyme::mem::emu::Resource regs(64);
+        enzyme::mem::Client<uint32_t> doorbell(regs, enzyme::mem::UC);
+
+        enzyme::ring::Ring<Descriptor> ring(1024);
+        ring.doorbell(&doorbell, 0);
+        enzyme::ring::Emulator<Descriptor> device(ring, doorbell, 0, 64);
+        device.start();
+
+        Descriptor batch[32];
+        for(unsigned int i = 0; i < 32; i++)
+        {
+            batch[i].addr = 0x100000 + i * 0x800;
+            batch[i].len = 0x800;
+            batch[i].flag = 1;
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        unsigned int sent = 0;
+        while(sent < count)
+        {
+            uint32_t n = ring.enqueue(batch, std::min(32u, count - sent));
+            if(!n)
+                std::this_thread::yield();
+            sent += n;
+        }
+        while(device.consumed() < count)
+            std::this_thread::yield();
+        double ms = elapsed(start);
+        device.stop();
+
+        printf("ring %u descriptors: %.1f ms, %.2f M/s, %llu device batches\n",
+               count, ms, ms ? count / ms / 1000.0 : 0.0, (unsigned long long)device.batches());
+        printf("ring latency ns: mean %llu, p50 <= %llu, p99 <= %llu, p99.9 <= %llu, max %llu\n",
+               (unsigned long long)(count ? device.latency_total() / count : 0),
+               (unsigned long long)device.percentile(50), (unsigned long long)device.percentile(99),
+               (unsigned long long)device.percentile(99.9), (unsigned long long)device.latency_max());
+    }
+};
+
+
+// ---------------------------------------------------------------------------
+
+
+int main(int argc, char* argv[])
+{
+    unsigned int count = (argc > 1) ? static_cast<unsigned int>(strtoul(argv[1], NULL, 0)) : 10000;
+    unsigned int descriptors = (argc > 2) ? static_cast<unsigned int>(strtoul(argv[2], NULL, 0)) : 1000000;
+
+    char root[] = "/tmp/enzyme_bench.XXXXXX";
+    if(!mkdtemp(root))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    int result = 0;
+    try {
+        build(root, count);
+        enzyme::kernel::sysfs(root);
+
+        pci(NULL);
+        pci(std::pmr::new_delete_resource());
+
+        enzyme::kernel::sysfs("/sys");
+        cpu(NULL);
+        cpu(std::pmr::new_delete_resource());
+
+        ring(descriptors);
+
+#ifdef ENZYME_PERF
+        enzyme::perf::Site::report(std::cout);
+#endif
+    }
+    catch(std::exception& e) {
+        gCount = false;
+        fprintf(stderr, "%s\n", e.what());
+        result = 1;
+    }
+
+    nftw(root, remove, 16, FTW_DEPTH | FTW_PHYS);
+    return result;
+}
@@ -0,0 +1,260 @@
+///
+/// @file    enzyme_corelocal.h
+/// @brief   Enzyme Hardware Abstraction Layer: Per-Core Storage
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef _enzyme_corelocal_h_
+#define _enzyme_corelocal_h_
+
+
+#include "enzyme_cpu.h"
+#include "enzyme_mem.h"
+
+#include <algorithm>
+#include <map>
+#include <new>
+#include <vector>
+
+
+namespace enzyme
+{
+    namespace cpu
+    {
+
+        ///
+        /// @brief One cache line padded T per core
+        ///
+        /// Slots of the cores on each NUMA node are carved from one block
+        /// allocated on that node. local() returns the slot of the core the
+        /// calling thread is running on; since the thread may migrate between
+        /// the lookup and the access, T is normally an atomic updated with
+        /// relaxed operations, e.g. CoreLocal<std::atomic<uint64_t> >. Threads on
+        /// processors that were not enumerated share one spare slot.
+        ///
+
+        template<typename T> class CoreLocal
+        {
+        private:
+            struct Default
+            {
+            };
+
+            struct alignas(ENZYME_CACHELINE) Slot
+            {
+                T value;
+
+                Slot(const Default&) : value() { }
+                template<typename I> explicit Slot(const I& init) : value(init) { }
+            };
+
+            typedef struct
+            {
+                void* base;
+                size_t size;
+                size_t count;
+            }
+            Block;
+
+            std::vector<Slot*> mByID;
+            std::vector<Slot*> mSlot;
+            std::vector<Block> mBlock;
+            Slot* mSpare;
+
+            CoreLocal(const CoreLocal&);
+            CoreLocal& operator=(const CoreLocal&);
+
+            // Processor numbers by NUMA node
+            typedef std::map<int, std::vector<unsigned int> > Layout;
+
+            static Layout layout(const std::pmr::list<Core>& cores)
+            {
+                Layout result;
+                std::pmr::list<Core>::const_iterator c;
+                for(c = cores.begin(); c != cores.end(); c++)
+                    result[c->node()].push_back(c->id());
+                return result;
+            }
+
+            static Layout layout(const Set& set)
+            {
+                Layout result;
+                for(unsigned int id = 0; id < set.limit(); id++)
+                {
+                    if(set.test(id))
+                        result[node(id)].push_back(id);
+                }
+                return result;
+            }
+
+            template<typename I> void build(const Layout& layout, const I& init)
+            {
+                // Size the indices first, so nothing but allocation and T can throw below
+                size_t total = 0;
+                unsigned int limit = 0;
+                typename Layout::const_iterator n;
+                for(n = layout.begin(); n != layout.end(); n++)
+                {
+                    total += n->second.size();
+                    for(size_t i = 0; i < n->second.size(); i++)
+                        limit = std::max(limit, n->second[i] + 1);
+                }
+                mSlot.reserve(total);
+                mByID.assign(limit, NULL);
+                mBlock.reserve(layout.size() + 1);
+                mSpare = NULL;
+
+                try {
+                    // One extra slot in the first block serves unenumerated processors
+                    for(n = layout.begin(); n != layout.end(); n++)
+                    {
+                        Block b;
+                        b.count = n->second.size() + (mBlock.empty() ? 1 : 0);
+                        b.size = b.count * sizeof(Slot);
+                        b.base = mem::allocate(b.size, n->first);
+                        mBlock.push_back(b);
+
+                        Slot* s = static_cast<Slot*>(b.base);
+                        for(size_t i = 0; i < n->second.size(); i++, s++)
+                        {
+                            new(s) Slot(init);
+                            mByID[n->second[i]] = s;
+                            mSlot.push_back(s);
+                        }
+                        if(!mSpare)
+                            mSpare = new(s) Slot(init);
+                    }
+
+                    if(!mSpare)
+                    {
+                        Block b;
+                        b.count = 1;
+                        b.size = sizeof(Slot);
+                        b.base = mem::allocate(b.size);
+                        mBlock.push_back(b);
+                        mSpare = new(b.base) Slot(init);
+                    }
+                }
+                catch(...) {
+                    destroy();
+                    throw;
+                }
+            }
+
+            void destroy()
+            {
+                typename std::vector<Slot*>::iterator s;
+                for(s = mSlot.begin(); s != mSlot.end(); s++)
+                    (*s)->~Slot();
+                if(mSpare)
+                    mSpare->~Slot();
+
+                typename std::vector<Block>::iterator b;
+                for(b = mBlock.begin(); b != mBlock.end(); b++)
+                    mem::release(b->base, b->size);
+
+                mSlot.clear();
+                mByID.clear();
+                mBlock.clear();
+                mSpare = NULL;
+            }
+
+        public:
+            explicit CoreLocal(const Enumerator& enumerator)
+            {
+                build(layout(enumerator.core()), Default());
+            }
+
+            /// @brief Construct every slot from init
+            template<typename I> CoreLocal(const Enumerator& enumerator, const I& init)
+            {
+                build(layout(enumerator.core()), init);
+            }
+
+            ///
+            /// @brief One slot per configured processor, without enumerating
+            ///
+            /// For process-wide statistics created before, or without, a
+            /// cpu::Enumerator; only the NUMA node of each processor is read.
+            ///
+
+            CoreLocal()
+            {
+                build(layout(Set::configured()), Default());
+            }
+
+            ~CoreLocal()
+            {
+                destroy();
+            }
+
+            /// @brief Slot of the core the calling thread is running on
+            T& local()
+            {
+                unsigned int id = current();
+                Slot* s = (id < mByID.size()) ? mByID[id] : NULL;
+                return s ? s->value : mSpare->value;
+            }
+
+            /// @brief Slot of a core
+            T& operator[](const Core& core)
+            {
+                Slot* s = (core.id() < mByID.size()) ? mByID[core.id()] : NULL;
+                return s ? s->value : mSpare->value;
+            }
+
+            /// @brief Number of slots, including the spare
+            size_t size() const { return mSlot.size() + 1; }
+
+            /// @brief Call f(T&) for every slot
+            template<typename F> void each(F f)
+            {
+                typename std::vector<Slot*>::iterator s;
+                for(s = mSlot.begin(); s != mSlot.end(); s++)
+                    f((*s)->value);
+                f(mSpare->value);
+            }
+
+            /// @brief Fold every slot into acc with f(R&, const T&)
+            template<typename R, typename F> R merge(R acc, F f) const
+            {
+                typename std::vector<Slot*>::const_iterator s;
+                for(s = mSlot.begin(); s != mSlot.end(); s++)
+                    f(acc, (*s)->value);
+                f(acc, mSpare->value);
+                return acc;
+            }
+
+            template<typename R = T> R sum() const
+            {
+                R acc = R();
+                typename std::vector<Slot*>::const_iterator s;
+                for(s = mSlot.begin(); s != mSlot.end(); s++)
+                    acc += (*s)->value;
+                acc += mSpare->value;
+                return acc;
+            }
+
+            template<typename R = T> R max() const
+            {
+                R acc = mSpare->value;
+                typename std::vector<Slot*>::const_iterator s;
+                for(s = mSlot.begin(); s != mSlot.end(); s++)
+                {
+                    R v = (*s)->value;
+                    if(acc < v)
+                        acc = v;
+                }
+                return acc;
+            }
+        };
+    };
+};
+
+
+#endif  // _enzyme_corelocal_h_
@@ -8,139 +8,1580 @@
 // ---------------------------------------------------------------------------
 
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 #include "enzyme_cpu.h"
+#include "enzyme_perf.h"
 
 #ifdef _WIN32
 #include <windows.h>
 #endif
 #ifdef _MSC_VER
 #include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
 #endif
 #ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
 #include <sched.h>
+#include <unistd.h>
+#include "linux/enzyme_linuxkernel.h"
 #endif
 
 
 // ---------------------------------------------------------------------------
 
 
-enzyme::cpu::Enumerator::Enumerator()
+///
+/// @brief Parse a cpulist, e.g. "0-3,8,10-11"
+///
+
+enzyme::cpu::Set::Set(const std::string& list)
+{
+    const char* cur = list.c_str();
+    while(*cur)
+    {
+        char* end;
+        unsigned long first = strtoul(cur, &end, 10);
+        if(end == cur)
+            break;
+
+        unsigned long last = first;
+        cur = end;
+        if(*cur == '-')
+        {
+            last = strtoul(cur + 1, &end, 10);
+            cur = end;
+        }
+
+        for(unsigned long cpu = first; cpu <= last; cpu++)
+            set(static_cast<unsigned int>(cpu));
+
+        while(*cur && (*cur != ','))
+            cur++;
+        if(*cur == ',')
+            cur++;
+    }
+}
+
+
+size_t enzyme::cpu::Set::count() const
+{
+    size_t cnt = 0;
+    for(size_t i = 0; i < mBit.size(); i++)
+    {
+        uint64_t b = mBit[i];
+        while(b)
+        {
+            b &= b - 1;
+            cnt++;
+        }
+    }
+    return cnt;
+}
+
+
+enzyme::cpu::Set enzyme::cpu::Set::operator&(const Set& other) const
+{
+    Set result;
+    result.mBit.resize(std::min(mBit.size(), other.mBit.size()));
+    for(size_t i = 0; i < result.mBit.size(); i++)
+        result.mBit[i] = mBit[i] & other.mBit[i];
+    return result;
+}
+
+
+bool enzyme::cpu::Set::operator==(const Set& other) const
+{
+    size_t n = std::max(mBit.size(), other.mBit.size());
+    for(size_t i = 0; i < n; i++)
+    {
+        uint64_t a = (i < mBit.size()) ? mBit[i] : 0;
+        uint64_t b = (i < other.mBit.size()) ? other.mBit[i] : 0;
+        if(a != b)
+            return false;
+    }
+    return true;
+}
+
+
+std::ostream& enzyme::cpu::Set::lex(std::ostream& os) const
+{
+    os << std::dec;
+    bool first = true;
+    unsigned int cpu = 0;
+    while(cpu < limit())
+    {
+        if(!test(cpu))
+        {
+            cpu++;
+            continue;
+        }
+
+        unsigned int last = cpu;
+        while(test(last + 1))
+            last++;
+
+        if(!first)
+            os << ',';
+        os << cpu;
+        if(last != cpu)
+            os << '-' << last;
+
+        first = false;
+        cpu = last + 1;
+    }
+    return os;
+}
+
+
+///
+/// @brief Processors the calling thread may run on (honours cgroup/cpuset limits)
+///
+
+enzyme::cpu::Set enzyme::cpu::Set::affinity()
+{
+    Set result;
+
+#if defined(__linux__)
+    int cnt = 1024;
+    while(true)
+    {
+        cpu_set_t* mask = CPU_ALLOC(cnt);
+        size_t size = CPU_ALLOC_SIZE(cnt);
+        CPU_ZERO_S(size, mask);
+        if(!sched_getaffinity(0, size, mask))
+        {
+            for(int cpu = 0; cpu < cnt; cpu++)
+            {
+                if(CPU_ISSET_S(cpu, size, mask))
+                    result.set(cpu);
+            }
+            CPU_FREE(mask);
+            break;
+        }
+        CPU_FREE(mask);
+        if((errno != EINVAL) || (cnt >= (1 << 20)))
+            throw std::runtime_error("CPU affinity: Cannot read thread affinity");
+        cnt *= 2;
+    }
+#elif defined(_WIN32)
+    DWORD_PTR process, system;
+    if(GetProcessAffinityMask(GetCurrentProcess(), &process, &system))
+    {
+        for(unsigned int cpu = 0; cpu < sizeof(process) * 8; cpu++)
+        {
+            if((process >> cpu) & 1)
+                result.set(cpu);
+        }
+    }
+#else
+    result.set(0);
+#endif
+
+    return result;
+}
+
+
+///
+/// @brief Processors the OS has configured, plus any allowed ones beyond them (sparse numbering)
+///
+
+enzyme::cpu::Set enzyme::cpu::Set::configured()
+{
+#if defined(__linux__) || defined(__APPLE__)
+    long cnt = sysconf(_SC_NPROCESSORS_CONF);
+#elif defined(_WIN32)
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    long cnt = static_cast<long>(si.dwNumberOfProcessors);
+#else
+    long cnt = 1;
+#endif
+
+    Set result = affinity();
+    for(long cpu = 0; cpu < cnt; cpu++)
+        result.set(static_cast<unsigned int>(cpu));
+    return result;
+}
+
+
+///
+/// @brief Restrict the calling thread to the processors in this set
+///
+
+void enzyme::cpu::Set::pin() const
+{
+    if(empty())
+        throw std::logic_error("CPU affinity: Empty set");
+
+#if defined(__linux__)
+    cpu_set_t* mask = CPU_ALLOC(limit());
+    size_t size = CPU_ALLOC_SIZE(limit());
+    CPU_ZERO_S(size, mask);
+    for(unsigned int cpu = 0; cpu < limit(); cpu++)
+    {
+        if(test(cpu))
+            CPU_SET_S(cpu, size, mask);
+    }
+    int r = sched_setaffinity(0, size, mask);
+    CPU_FREE(mask);
+    if(r)
+        throw std::runtime_error("CPU affinity: Cannot set thread affinity");
+#elif defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for(unsigned int cpu = 0; (cpu < limit()) && (cpu < sizeof(mask) * 8); cpu++)
+    {
+        if(test(cpu))
+            mask |= (DWORD_PTR)1 << cpu;
+    }
+    if(!SetThreadAffinityMask(GetCurrentThread(), mask))
+        throw std::runtime_error("CPU affinity: Cannot set thread affinity");
+#endif
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+///
+/// @brief CPU core constructor
+///
+
+enzyme::cpu::Core::Core(unsigned int id, const StringLex& classid, const StringLex& manufacturer, const StringLex& name)
+    : enzyme::Device(mLocationLex, classid, manufacturer, name)
+    , mID(id)
+    , mMSR(-1)
+    , mAllowed(true)
+    , mNode(-1)
+    , mType(UnknownType)
+    , mMaxFreq(0)
+    , mClass(0)
+    , mOwnedLex(NULL)
+{
+    mTopology.apic = mTopology.package = mTopology.die = mTopology.core = mTopology.smt = Topology::Unknown;
+
+    std::ostringstream loc;
+    loc << "CPU:" << id;
+    mLocationLex = StringLex(loc.str());
+    mEnumerator = "CPU";
+}
+
+
+enzyme::cpu::Core::Core(const Core& other)
+    : Core(other, new StringLex[3] {
+          static_cast<const StringLex&>(other.classid()),
+          static_cast<const StringLex&>(other.vendor()),
+          static_cast<const StringLex&>(other.description()) })
+{
+}
+
+
+enzyme::cpu::Core::Core(const Core& other, StringLex* owned)
+    : enzyme::Device(mLocationLex, owned[0], owned[1], owned[2])
+    , mID(other.mID)
+    , mCPUID(other.mCPUID)
+    , mTopology(other.mTopology)
+    , mCache(other.mCache)
+    , mMSR(-1)
+    , mAllowed(other.mAllowed)
+    , mNode(other.mNode)
+    , mType(other.mType)
+    , mMaxFreq(other.mMaxFreq)
+    , mClass(other.mClass)
+    , mLocationLex(other.mLocationLex)
+    , mOwnedLex(owned)
+{
+    mEnumerator = other.mEnumerator;
+    mService = other.mService;
+}
+
+
+enzyme::cpu::Core::~Core()
+{
+    delete [] mOwnedLex;
+
+#ifdef __linux__
+    int fd = mMSR.load();
+    if(fd >= 0)
+        close(fd);
+#endif
+}
+
+
+void enzyme::cpu::Core::pin_current_thread() const
+{
+    if(!mAllowed)
+    {
+        std::ostringstream err;
+        err << "CPU affinity: CPU " << mID << " is outside the process affinity mask";
+        throw std::runtime_error(err.str());
+    }
+
+    Set self;
+    self.set(mID);
+    self.pin();
+}
+
+
+///
+/// @brief Open the MSR device once; concurrent first users race and keep one descriptor
+///
+
+int enzyme::cpu::Core::msrfd() const
+{
+    int fd = mMSR.load(std::memory_order_acquire);
+    if(fd >= 0)
+        return fd;
+
+#ifdef __linux__
+    std::ostringstream path;
+    path << kernel::devcpu() << "/" << mID << "/msr";
+    fd = open(path.str().c_str(), O_RDWR);
+    if(fd < 0)
+        fd = open(path.str().c_str(), O_RDONLY);
+    if(fd < 0)
+        throw std::runtime_error("MSR: " + path.str() + ": " + strerror(errno));
+
+    int expected = -1;
+    if(!mMSR.compare_exchange_strong(expected, fd, std::memory_order_acq_rel))
+    {
+        close(fd);
+        fd = expected;
+    }
+    return fd;
+#else
+    throw std::runtime_error("MSR: Not supported on this platform");
+#endif
+}
+
+
+bool enzyme::cpu::Core::rdmsr(uint32_t msr, uint64_t& value) const
+{
+#ifdef __linux__
+    int fd;
+    try {
+        fd = msrfd();
+    }
+    catch(std::exception&) {
+        return false;
+    }
+    return pread(fd, &value, sizeof(value), msr) == sizeof(value);
+#else
+    return false;
+#endif
+}
+
+
+uint64_t enzyme::cpu::Core::rdmsr(uint32_t msr) const
+{
+    uint64_t value = 0;
+#ifdef __linux__
+    if(pread(msrfd(), &value, sizeof(value), msr) != sizeof(value))
+    {
+        std::ostringstream err;
+        err << "MSR: Cannot read 0x" << std::hex << msr << " on CPU " << std::dec << mID;
+        throw std::runtime_error(err.str());
+    }
+#else
+    msrfd();
+#endif
+    return value;
+}
+
+
+void enzyme::cpu::Core::wrmsr(uint32_t msr, uint64_t value) const
+{
+#ifdef __linux__
+    if(pwrite(msrfd(), &value, sizeof(value), msr) != sizeof(value))
+    {
+        std::ostringstream err;
+        err << "MSR: Cannot write 0x" << std::hex << msr << " on CPU " << std::dec << mID;
+        throw std::runtime_error(err.str());
+    }
+#else
+    msrfd();
+#endif
+}
+
+
+const enzyme::cpu::Cache* enzyme::cpu::Core::cache(unsigned int level) const
+{
+    std::vector<Cache>::const_iterator i;
+    for(i = mCache.begin(); i != mCache.end(); i++)
+    {
+        if((i->level == level) && (i->type != Instruction))
+            return &*i;
+    }
+    return NULL;
+}
+
+
+const enzyme::cpu::Cache* enzyme::cpu::Core::llc() const
+{
+    const Cache* result = NULL;
+    std::vector<Cache>::const_iterator i;
+    for(i = mCache.begin(); i != mCache.end(); i++)
+    {
+        if((i->type != Instruction) && (!result || (i->level > result->level)))
+            result = &*i;
+    }
+    return result;
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+namespace enzyme
+{
+    namespace cpu
+    {
+        typedef enum
+        {
+            ByRDPID, ByRDTSCP, ByOS
+        }
+        Method;
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+        __attribute__((target("rdpid"))) static unsigned int rdpid()
+        {
+            return _rdpid_u32();
+        }
+
+        static unsigned int rdtscp()
+        {
+            unsigned int aux;
+            __rdtscp(&aux);
+            return aux;
+        }
+#define ENZYME_TSCAUX
+#endif
+
+        static unsigned int getcpu()
+        {
+#if defined(__linux__)
+            int cpu = sched_getcpu();
+            return (cpu < 0) ? 0 : static_cast<unsigned int>(cpu);
+#elif defined(_WIN32)
+            return GetCurrentProcessorNumber();
+#else
+            return 0;
+#endif
+        }
+
+
+        ///
+        /// @brief Use TSC_AUX only if it agrees with the OS on this processor
+        ///
+        /// Linux stores (node << 12) | cpu in TSC_AUX; other systems, and some
+        /// hypervisors, leave it unset.
+        ///
+
+        static Method select()
+        {
+#if defined(ENZYME_TSCAUX) && defined(__linux__)
+            if(has(RDPID))
+            {
+                unsigned int before = getcpu();
+                unsigned int aux = rdpid() & 0xFFF;
+                if((aux == before) && (aux == getcpu()))
+                    return ByRDPID;
+            }
+            if(has(RDTSCP))
+            {
+                unsigned int before = getcpu();
+                unsigned int aux = rdtscp() & 0xFFF;
+                if((aux == before) && (aux == getcpu()))
+                    return ByRDTSCP;
+            }
+#endif
+            return ByOS;
+        }
+    };
+};
+
+
+unsigned int enzyme::cpu::current()
+{
+    static const Method method = select();
+
+#ifdef ENZYME_TSCAUX
+    if(method == ByRDPID)
+        return rdpid() & 0xFFF;
+    if(method == ByRDTSCP)
+        return rdtscp() & 0xFFF;
+#endif
+    return getcpu();
+}
+
+
+///
+/// @brief NUMA node of a processor; -1 if unknown
+///
+
+int enzyme::cpu::node(unsigned int id)
+{
+#if defined(__linux__)
+    std::ostringstream path;
+    path << kernel::sysfs() << "/devices/system/cpu/cpu" << id;
+
+    int node = -1;
+    DIR* dir = opendir(path.str().c_str());
+    if(dir)
+    {
+        struct dirent* ent;
+        while((ent = readdir(dir)))
+        {
+            char* end;
+            if(!strncmp(ent->d_name, "node", 4) && ent->d_name[4])
+            {
+                long n = strtol(ent->d_name + 4, &end, 10);
+                if(!*end)
+                {
+                    node = static_cast<int>(n);
+                    break;
+                }
+            }
+        }
+        closedir(dir);
+    }
+    return node;
+#elif defined(_WIN32)
+    UCHAR node;
+    if((id < 256) && GetNumaProcessorNode(static_cast<UCHAR>(id), &node) && (node != 0xFF))
+        return node;
+    return -1;
+#else
+    return -1;
+#endif
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+enzyme::cpu::Affinity::Affinity(const Set& set)
+    : mSaved(Set::affinity())
+{
+    set.pin();
+}
+
+
+enzyme::cpu::Affinity::Affinity(const Core& core)
+    : mSaved(Set::affinity())
+{
+    core.pin_current_thread();
+}
+
+
+enzyme::cpu::Affinity::~Affinity()
+{
+    try {
+        mSaved.pin();
+    }
+    catch(std::exception&) {
+    }
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+enzyme::cpu::Worker::Worker(const Core& core)
+    : mID(core.id())
+    , mStop(false)
+    , mPinned(-1)
+{
+    if(!core.allowed())
+        throw std::runtime_error("CPU worker: " + core.location().str() + " is outside the process affinity mask");
+    mThread = std::thread(&Worker::run, this);
+}
+
+
+enzyme::cpu::Worker::~Worker()
+{
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mStop = true;
+    }
+    mReady.notify_one();
+    mThread.join();
+}
+
+
+bool enzyme::cpu::Worker::pinned() const
+{
+    std::unique_lock<std::mutex> lock(mLock);
+    while(mPinned < 0)
+        mStarted.wait(lock);
+    return mPinned != 0;
+}
+
+
+void enzyme::cpu::Worker::enqueue(std::packaged_task<void()>&& task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        if(mStop)
+            throw std::logic_error("CPU worker: Stopped");
+        mQueue.push_back(std::move(task));
+    }
+    mReady.notify_one();
+}
+
+
+void enzyme::cpu::Worker::run()
+{
+    bool pinned = true;
+    try {
+        Set self;
+        self.set(mID);
+        self.pin();
+    }
+    catch(std::exception&) {
+        // Affinity changed since enumeration; run unpinned rather than drop work
+        pinned = false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mPinned = pinned ? 1 : 0;
+    }
+    mStarted.notify_all();
+
+    while(true)
+    {
+        std::packaged_task<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mLock);
+            while(!mStop && mQueue.empty())
+                mReady.wait(lock);
+            if(mQueue.empty())
+                return;
+            task = std::move(mQueue.front());
+            mQueue.pop_front();
+        }
+        task();
+    }
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+bool enzyme::cpu::cpuid(uint32_t leaf, uint32_t subleaf, Leaf& result)
+{
+    result.leaf = leaf;
+    result.subleaf = subleaf;
+    result.eax = result.ebx = result.ecx = result.edx = 0;
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+    int reg[4];
+    __cpuidex(reg, leaf, subleaf);
+    result.eax = reg[0]; result.ebx = reg[1]; result.ecx = reg[2]; result.edx = reg[3];
+    return true;
+#elif defined(__i386__) || defined(__x86_64__)
+    __cpuid_count(leaf, subleaf, result.eax, result.ebx, result.ecx, result.edx);
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+enzyme::cpu::Leaf enzyme::cpu::Table::add(uint32_t leaf, uint32_t subleaf)
+{
+    Leaf l;
+    cpuid(leaf, subleaf, l);
+    mLeaf.push_back(l);
+    return l;
+}
+
+
+///
+/// @brief Capture the levels of an extended topology leaf (0xB/0x1F), up to the invalid level
+///
+
+void enzyme::cpu::Table::addlevels(uint32_t leaf)
+{
+    for(uint32_t sub = 0; sub < 32; sub++)
+    {
+        if(!((add(leaf, sub).ecx >> 8) & 0xFF))
+            break;
+    }
+}
+
+
+///
+/// @brief Capture one leaf with however many subleaves it defines
+///
+
+void enzyme::cpu::Table::addleaf(uint32_t leaf)
+{
+    uint32_t sub;
+    Leaf l;
+
+    switch(leaf)
+    {
+    case 0x00000004:
+    case 0x8000001D:
+        // Cache parameters, up to the null cache type
+        for(sub = 0; sub < 64; sub++)
+        {
+            if(!(add(leaf, sub).eax & 0x1F))
+                break;
+        }
+        break;
+
+    case 0x0000000B:
+    case 0x0000001F:
+        addlevels(leaf);
+        break;
+
+    case 0x00000007:
+    case 0x00000014:
+    case 0x00000017:
+    case 0x00000018:
+    case 0x0000001D:
+    case 0x00000020:
+    case 0x00000023:
+        // Subleaf 0 EAX reports the highest valid subleaf
+        l = add(leaf, 0);
+        for(sub = 1; (sub <= l.eax) && (sub < 64); sub++)
+            add(leaf, sub);
+        break;
+
+    case 0x0000000D:
+    case 0x0000000F:
+    case 0x00000010:
+    case 0x00000012:
+        // Sparse subleaves; keep those that report anything
+        add(leaf, 0);
+        for(sub = 1; sub < 64; sub++)
+        {
+            cpuid(leaf, sub, l);
+            if(l.eax || l.ebx || l.ecx || l.edx)
+                mLeaf.push_back(l);
+        }
+        break;
+
+    default:
+        add(leaf, 0);
+        break;
+    }
+}
+
+
+void enzyme::cpu::Table::capture()
+{
+    mLeaf.clear();
+
+    Leaf l;
+    if(!cpuid(0, 0, l))
+        return;
+
+    uint32_t leaf;
+    for(leaf = 0; leaf <= l.eax; leaf++)
+        addleaf(leaf);
+
+    cpuid(0x80000000, 0, l);
+    if((l.eax & 0xFFFF0000) != 0x80000000)
+        return;
+    for(leaf = 0x80000000; leaf <= l.eax; leaf++)
+        addleaf(leaf);
+}
+
+
+void enzyme::cpu::Table::capturelocal()
+{
+    mLeaf.clear();
+
+    Leaf l, e;
+    if(!cpuid(0, 0, l))
+        return;
+    cpuid(0x80000000, 0, e);
+
+    if(l.eax >= 0x01)
+        add(0x01, 0);
+    if(l.eax >= 0x04)
+        addleaf(0x04);
+    if(l.eax >= 0x0B)
+        addlevels(0x0B);
+    if(l.eax >= 0x1A)
+        add(0x1A, 0);
+    if(l.eax >= 0x1F)
+        addlevels(0x1F);
+    if(((e.eax & 0xFFFF0000) == 0x80000000) && (e.eax >= 0x8000001D))
+        addleaf(0x8000001D);
+    if(((e.eax & 0xFFFF0000) == 0x80000000) && (e.eax >= 0x8000001E))
+        add(0x8000001E, 0);
+}
+
+
+namespace enzyme
+{
+    namespace cpu
+    {
+        static bool before(const Leaf& a, const Leaf& b)
+        {
+            return (a.leaf < b.leaf) || ((a.leaf == b.leaf) && (a.subleaf < b.subleaf));
+        }
+    };
+};
+
+
+const enzyme::cpu::Leaf* enzyme::cpu::Table::find(uint32_t leaf, uint32_t subleaf) const
+{
+    Leaf key;
+    key.leaf = leaf;
+    key.subleaf = subleaf;
+
+    std::vector<Leaf>::const_iterator i = std::lower_bound(mLeaf.begin(), mLeaf.end(), key, before);
+    if((i != mLeaf.end()) && (i->leaf == leaf) && (i->subleaf == subleaf))
+        return &*i;
+    return NULL;
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+namespace enzyme
+{
+    namespace cpu
+    {
+        static const char* gFeatureName[Features] =
+        {
+            "sse2", "sse4_2", "popcnt", "bmi1", "avx", "avx2", "avx512f", "avx512bw",
+            "erms", "fsrm", "clflushopt", "clwb", "movdiri", "movdir64b", "enqcmd",
+            "waitpkg", "rdtscp", "rdpid", "invariant_tsc", "hybrid"
+        };
+
+
+        ///
+        /// @brief Read XCR0, the state components the OS saves on context switch
+        ///
+
+        static uint64_t xcr0()
+        {
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+            return _xgetbv(0);
+#elif defined(__i386__) || defined(__x86_64__)
+            uint32_t eax, edx;
+            __asm __volatile("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+            return ((uint64_t)edx << 32) | eax;
+#else
+            return 0;
+#endif
+        }
+    };
+};
+
+
+enzyme::cpu::FeatureSet::FeatureSet(const Table& table)
+    : mBit(0)
 {
-    std::string name;
+    uint32_t ecx1 = 0, edx1 = 0;
+    uint32_t ebx7 = 0, ecx7 = 0, edx7 = 0;
+    uint32_t edxe1 = 0, edxe7 = 0;
+
+    const Leaf* l;
+    if((l = table.find(0x01)))
+    {
+        ecx1 = l->ecx; edx1 = l->edx;
+    }
+    if((l = table.find(0x07)))
+    {
+        ebx7 = l->ebx; ecx7 = l->ecx; edx7 = l->edx;
+    }
+    if((l = table.find(0x80000001)))
+        edxe1 = l->edx;
+    if((l = table.find(0x80000007)))
+        edxe7 = l->edx;
+
+    // AVX needs XMM and YMM state; AVX-512 also needs opmask and ZMM state
+    uint64_t xcr = ((ecx1 >> 27) & 1) ? xcr0() : 0;
+    bool ymm = (xcr & 0x06) == 0x06;
+    bool zmm = ymm && ((xcr & 0xE0) == 0xE0);
+
+    struct
+    {
+        Feature feature;
+        bool present;
+    }
+    bit[] =
+    {
+        { SSE2,         ((edx1 >> 26) & 1) != 0 },
+        { SSE42,        ((ecx1 >> 20) & 1) != 0 },
+        { POPCNT,       ((ecx1 >> 23) & 1) != 0 },
+        { BMI1,         ((ebx7 >> 3) & 1) != 0 },
+        { AVX,          ymm && ((ecx1 >> 28) & 1) },
+        { AVX2,         ymm && ((ebx7 >> 5) & 1) },
+        { AVX512F,      zmm && ((ebx7 >> 16) & 1) },
+        { AVX512BW,     zmm && ((ebx7 >> 30) & 1) },
+        { ERMS,         ((ebx7 >> 9) & 1) != 0 },
+        { FSRM,         ((edx7 >> 4) & 1) != 0 },
+        { CLFLUSHOPT,   ((ebx7 >> 23) & 1) != 0 },
+        { CLWB,         ((ebx7 >> 24) & 1) != 0 },
+        { MOVDIRI,      ((ecx7 >> 27) & 1) != 0 },
+        { MOVDIR64B,    ((ecx7 >> 28) & 1) != 0 },
+        { ENQCMD,       ((ecx7 >> 29) & 1) != 0 },
+        { WAITPKG,      ((ecx7 >> 5) & 1) != 0 },
+        { RDTSCP,       ((edxe1 >> 27) & 1) != 0 },
+        { RDPID,        ((ecx7 >> 22) & 1) != 0 },
+        { InvariantTSC, ((edxe7 >> 8) & 1) != 0 },
+        { Hybrid,       ((edx7 >> 15) & 1) != 0 },
+    };
+
+    for(size_t i = 0; i < sizeof(bit) / sizeof(bit[0]); i++)
+    {
+        if(bit[i].present)
+            mBit |= (uint64_t)1 << bit[i].feature;
+    }
+}
+
+
+const char* enzyme::cpu::FeatureSet::name(Feature f)
+{
+    return (f < Features) ? gFeatureName[f] : "unknown";
+}
+
+
+std::ostream& enzyme::cpu::FeatureSet::lex(std::ostream& os) const
+{
+    bool first = true;
+    for(int f = 0; f < Features; f++)
+    {
+        if(!has(static_cast<Feature>(f)))
+            continue;
+        if(!first)
+            os << ' ';
+        os << gFeatureName[f];
+        first = false;
+    }
+    return os;
+}
+
+
+const enzyme::cpu::FeatureSet& enzyme::cpu::features()
+{
+    static const FeatureSet result = []() {
+        Table table;
+        table.capture();
+        return FeatureSet(table);
+    }();
+    return result;
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+namespace enzyme
+{
+    namespace cpu
+    {
+        static uint32_t log2ceil(uint32_t n)
+        {
+            uint32_t shift = 0;
+            while(((uint32_t)1 << shift) < n)
+                shift++;
+            return shift;
+        }
+
+        static uint32_t field(uint32_t apic, uint32_t lo, uint32_t hi)
+        {
+            return static_cast<uint32_t>((apic & (((uint64_t)1 << hi) - 1)) >> lo);
+        }
+
+
+        ///
+        /// @brief Decode a processor's position from its per-processor CPUID leaves
+        ///
+        /// Uses the extended topology leaf (0x1F, else 0xB) where present, and
+        /// otherwise the legacy logical/core counts of leaves 1 and 4 (or AMD
+        /// 0x80000008) from the package-wide table.
+        ///
+
+        static Topology decode(const Table& table, const Table& package)
+        {
+            Topology t;
+            t.apic = t.package = t.die = t.core = t.smt = Topology::Unknown;
+
+            const Leaf* l1 = table.find(0x01);
+            if(!l1)
+                return t;
+
+            uint32_t smtshift = 0;
+            uint32_t pkgshift = 0;
+            uint32_t dielo = 0;
+            uint32_t diehi = 0;
+
+            uint32_t leaf = table.find(0x1F) ? 0x1F : (table.find(0x0B) ? 0x0B : 0);
+            const Leaf* l = leaf ? table.find(leaf, 0) : NULL;
+            if(l && ((l->ecx >> 8) & 0xFF))
+            {
+                t.apic = l->edx;
+                uint32_t prev = 0;
+                for(uint32_t sub = 0; (l = table.find(leaf, sub)) && ((l->ecx >> 8) & 0xFF); sub++)
+                {
+                    uint32_t type = (l->ecx >> 8) & 0xFF;
+                    uint32_t shift = l->eax & 0x1F;
+                    if(type == 1)
+                        smtshift = shift;
+                    else if(type == 5)
+                    {
+                        dielo = prev;
+                        diehi = shift;
+                    }
+                    prev = pkgshift = shift;
+                }
+            }
+            else {
+                t.apic = l1->ebx >> 24;
+                uint32_t logical = ((l1->edx >> 28) & 1) ? ((l1->ebx >> 16) & 0xFF) : 1;
+                uint32_t cores = 1;
+                if((l = package.find(0x04)))
+                    cores = (l->eax >> 26) + 1;
+                else if((l = package.find(0x80000008)))
+                    cores = (l->ecx & 0xFF) + 1;
+                if(!logical)
+                    logical = 1;
+                smtshift = log2ceil((logical + cores - 1) / cores);
+                pkgshift = log2ceil(logical);
+            }
+
+            t.smt = field(t.apic, 0, smtshift);
+            t.core = field(t.apic, smtshift, pkgshift);
+            t.die = field(t.apic, dielo, diehi);
+            t.package = (pkgshift < 32) ? (t.apic >> pkgshift) : 0;
+            return t;
+        }
+
+
+        ///
+        /// @brief Decode deterministic cache parameters, preferring the processor's own leaves
+        ///
+        /// The shared set is left empty; the enumerator fills it from the
+        /// APIC IDs of the other processors once all cores have been visited.
+        ///
+
+        static std::vector<Cache> decodecache(const Table& table, const Table& package, std::vector<unsigned int>& shift)
+        {
+            std::vector<Cache> result;
+            shift.clear();
+
+            const Table* t = &table;
+            uint32_t leaf = 0x8000001D;
+            const Leaf* l = t->find(leaf);
+            if(!l || !(l->eax & 0x1F))
+            {
+                leaf = 0x04;
+                l = t->find(leaf);
+            }
+            if(!l || !(l->eax & 0x1F))
+            {
+                t = &package;
+                leaf = 0x8000001D;
+                l = t->find(leaf);
+                if(!l || !(l->eax & 0x1F))
+                {
+                    leaf = 0x04;
+                    l = t->find(leaf);
+                }
+            }
+
+            for(uint32_t sub = 0; (l = t->find(leaf, sub)) && (l->eax & 0x1F); sub++)
+            {
+                Cache c;
+                c.level = (l->eax >> 5) & 0x07;
+                c.type = static_cast<CacheType>(l->eax & 0x1F);
+                c.ways = ((l->ebx >> 22) & 0x3FF) + 1;
+                c.line = (l->ebx & 0xFFF) + 1;
+                c.sets = l->ecx + 1;
+                c.size = static_cast<size_t>(c.ways) * (((l->ebx >> 12) & 0x3FF) + 1) * c.line * c.sets;
+                c.inclusive = ((l->edx >> 1) & 1) != 0;
+                c.source = Cache::FromCPUID;
+                result.push_back(c);
+                shift.push_back(log2ceil(((l->eax >> 14) & 0xFFF) + 1));
+            }
+            return result;
+        }
+
 
+        ///
+        /// @brief Maximum frequency of a processor in kHz; 0 if unknown
+        ///
+
+        static uint64_t readmaxfreq(unsigned int id)
+        {
+            uint64_t khz = 0;
 #ifdef __linux__
-//    cpu_set_t affinold = {{0}};
-//    cpu_set_t affinnew = {{1 << id}};
-//    sched_getaffinity( 0, sizeof(affinold), &affinold );
-//    sched_setaffinity( 0, sizeof(affinnew), &affinnew );
-#endif
-
-    int tmp[4];
-    union {
-        uint32_t u[3];
-        char c[12];
-    } vendor;
-#if defined(_MSC_VER)
-    __cpuid(tmp, 0); vendor.u[0] = tmp[1]; vendor.u[1] = tmp[3]; vendor.u[2] = tmp[2];
-#elif defined(__x86_64__)
-    __asm __volatile("mov %%rbx, %%rsi; cpuid; xchg %%rbx, %%rsi" : "=S" (vendor.u[0]), "=d" (vendor.u[1]), "=c" (vendor.u[2]) : "a" (0));
-#else
-    __asm __volatile("mov %%ebx, %%esi; cpuid; xchg %%ebx, %%esi" : "=S" (vendor.u[0]), "=d" (vendor.u[1]), "=c" (vendor.u[2]) : "a" (0));
+            std::ostringstream path;
+            path << kernel::sysfs() << "/devices/system/cpu/cpu" << id << "/cpufreq/cpuinfo_max_freq";
+            std::ifstream is(path.str().c_str());
+            if(!(is >> khz))
+                khz = 0;
 #endif
+            return khz;
+        }
 
-#if !defined(__x86_64__)
-    uint32_t version;
-#if defined(_MSC_VER)
-    __cpuid(tmp, 1); version = tmp[2];
-#else
-    __asm __volatile("mov %%ebx, %%esi; cpuid; xchg %%ebx, %%esi" : "=c" (version) : "a" (1));
+
+        ///
+        /// @brief Rank order: Performance cores, then unknown, then Efficiency; faster first
+        ///
+
+        static unsigned int typerank(CoreType type)
+        {
+            return (type == Performance) ? 0 : (type == Efficiency) ? 2 : 1;
+        }
+
+        static bool faster(const Core* a, const Core* b)
+        {
+            if(typerank(a->type()) != typerank(b->type()))
+                return typerank(a->type()) < typerank(b->type());
+            if(a->maxfreq() != b->maxfreq())
+                return a->maxfreq() > b->maxfreq();
+            return a->id() < b->id();
+        }
+
+
+        ///
+        /// @brief Read Linux cacheinfo for one processor; empty if unavailable
+        ///
+
+        static std::vector<Cache> readcache(unsigned int id)
+        {
+            std::vector<Cache> result;
+
+#ifdef __linux__
+            for(unsigned int index = 0; ; index++)
+            {
+                std::ostringstream path;
+                path << kernel::sysfs() << "/devices/system/cpu/cpu" << id << "/cache/index" << index << "/";
+
+                std::ifstream level((path.str() + "level").c_str());
+                Cache c;
+                if(!(level >> c.level))
+                    break;
+
+                std::string value;
+                std::ifstream type((path.str() + "type").c_str());
+                type >> value;
+                if(value == "Data")
+                    c.type = Data;
+                else if(value == "Instruction")
+                    c.type = Instruction;
+                else
+                    c.type = Unified;
+
+                std::ifstream size((path.str() + "size").c_str());
+                c.size = 0;
+                char unit = 0;
+                if(size >> c.size >> unit)
+                {
+                    if(unit == 'K')
+                        c.size <<= 10;
+                    else if(unit == 'M')
+                        c.size <<= 20;
+                    else if(unit == 'G')
+                        c.size <<= 30;
+                }
+
+                std::ifstream ways((path.str() + "ways_of_associativity").c_str());
+                if(!(ways >> c.ways))
+                    c.ways = 0;
+                std::ifstream line((path.str() + "coherency_line_size").c_str());
+                if(!(line >> c.line))
+                    c.line = 0;
+                std::ifstream sets((path.str() + "number_of_sets").c_str());
+                if(!(sets >> c.sets))
+                    c.sets = 0;
+
+                std::ifstream shared((path.str() + "shared_cpu_list").c_str());
+                if(std::getline(shared, value))
+                    c.shared = Set(value);
+                else
+                    c.shared.set(id);
+
+                c.inclusive = false;
+                c.source = Cache::FromSysfs;
+                result.push_back(c);
+            }
 #endif
-    if(!memcmp(vendor.c, "GenuineIntel", 12) && ((version & 0x000000FF) < 4))
+
+            return result;
+        }
+    };
+};
+
+
+///
+/// @brief Capture per-processor CPUID leaves by pinning a short-lived thread to each core
+///
+/// All cores are visited concurrently. Cores outside the process affinity
+/// mask cannot be visited and keep an Unknown topology.
+///
+
+void enzyme::cpu::Enumerator::visit()
+{
+    std::vector<std::thread> worker;
+    std::pmr::list<Core>::iterator i;
+    for(i = mCore.begin(); i != mCore.end(); i++)
     {
-        switch(version & 0x000000FF)
-        {
-        case 1:
-            name = "Celeron"; break;
-        case 2:
-            name = "Pentium III"; break;
-        case 3:
-            name = "Pentium III Xeon"; break;
-        default:
-            name = "Unknown"; break;
+        if(!i->allowed())
+            continue;
+
+        Core* core = &*i;
+        try {
+            worker.push_back(std::thread([core]() {
+                try {
+                    core->pin_current_thread();
+                    core->mCPUID.capturelocal();
+                }
+                catch(std::exception&) {
+                }
+            }));
+        }
+        catch(std::exception&) {
         }
     }
-    else {
-        uint32_t e;
-#if defined(_MSC_VER)
-        __cpuid(tmp, 0x80000000); e = tmp[0];
-#else
-        __asm __volatile("mov %%ebx, %%esi; cpuid; xchg %%ebx, %%esi" : "=a" (e) : "a" (0x80000000));
-#endif
-        if(e < 0x80000004)
+
+    std::vector<std::thread>::iterator w;
+    for(w = worker.begin(); w != worker.end(); w++)
+        w->join();
+
+    for(i = mCore.begin(); i != mCore.end(); i++)
+        i->mTopology = decode(i->mCPUID, mCPUID);
+}
+
+
+///
+/// @brief Take each core's type from its own leaf 0x1A and assign performance classes
+///
+
+void enzyme::cpu::Enumerator::rank()
+{
+    std::vector<Core*> sorted;
+    std::pmr::list<Core>::iterator i;
+    for(i = mCore.begin(); i != mCore.end(); i++)
+    {
+        const Leaf* l = i->mCPUID.find(0x1A);
+        i->mType = l ? static_cast<CoreType>(l->eax >> 24) : UnknownType;
+        if((i->mType != Performance) && (i->mType != Efficiency))
+            i->mType = UnknownType;
+        sorted.push_back(&*i);
+    }
+
+    std::sort(sorted.begin(), sorted.end(), faster);
+
+    unsigned int cls = 0;
+    for(size_t c = 0; c < sorted.size(); c++)
+    {
+        if(c && ((typerank(sorted[c]->type()) != typerank(sorted[c - 1]->type())) || (sorted[c]->maxfreq() != sorted[c - 1]->maxfreq())))
+            cls++;
+        sorted[c]->mClass = cls;
+    }
+}
+
+
+///
+/// @brief Decode each core's caches and merge them with sysfs cacheinfo
+///
+
+void enzyme::cpu::Enumerator::caches()
+{
+    std::pmr::list<Core>::iterator i, j;
+    for(i = mCore.begin(); i != mCore.end(); i++)
+    {
+        std::vector<unsigned int> shift;
+        std::vector<Cache> cpuid = decodecache(i->mCPUID, mCPUID, shift);
+        std::vector<Cache> sysfs = readcache(i->id());
+
+        // Sharing by APIC ID, for processors whose position is known
+        for(size_t c = 0; c < cpuid.size(); c++)
         {
-            if(!memcmp(vendor.c, "GenuineIntel", 12))
-                name = "Pentium 4";
-            else
-                name = "Unknown";
+            cpuid[c].shared.set(i->id());
+            if(i->apic() == Topology::Unknown)
+                continue;
+            for(j = mCore.begin(); j != mCore.end(); j++)
+            {
+                if((j->apic() != Topology::Unknown) && ((uint64_t)j->apic() >> shift[c]) == ((uint64_t)i->apic() >> shift[c]))
+                    cpuid[c].shared.set(j->id());
+            }
         }
+
+        if(sysfs.empty())
+            i->mCache = cpuid;
         else {
-#endif  // !__x86_64__
-
-            union {
-                uint32_t reg[3][4];
-                char desc[49];
-            } ext;
-            memset(&ext, 0, sizeof(ext));
-            int i;
-            for(i = 0; i < 3; i++)
+            std::vector<Cache>::iterator s, c;
+            for(s = sysfs.begin(); s != sysfs.end(); s++)
             {
-#if defined(_MSC_VER)
-                __cpuid(tmp, 0x80000002 + i); ext.reg[i][0] = tmp[0]; ext.reg[i][1] = tmp[1]; ext.reg[i][2] = tmp[2]; ext.reg[i][3] = tmp[3];
-#elif defined(__x86_64__)
-                __asm __volatile("mov %%rbx, %%rsi; cpuid; xchg %%rbx, %%rsi" : "=a" (ext.reg[i][0]), "=S" (ext.reg[i][1]), "=c" (ext.reg[i][2]), "=d" (ext.reg[i][3]) : "a" (0x80000002 + i));
-#else
-                __asm __volatile("mov %%ebx, %%esi; cpuid; xchg %%ebx, %%esi" : "=a" (ext.reg[i][0]), "=S" (ext.reg[i][1]), "=c" (ext.reg[i][2]), "=d" (ext.reg[i][3]) : "a" (0x80000002 + i));
-#endif
+                for(c = cpuid.begin(); c != cpuid.end(); c++)
+                {
+                    if((c->level != s->level) || (c->type != s->type))
+                        continue;
+                    s->inclusive = c->inclusive;
+                    if((c->size == s->size) && (c->line == s->line) && (c->shared == s->shared))
+                        s->source |= Cache::FromCPUID;
+                    break;
+                }
             }
-            name = ext.desc;
+            i->mCache = sysfs;
+        }
+    }
 
-#if !defined(__x86_64__)
+    mGeometry.line = 0;
+    mGeometry.l1d = mGeometry.l2 = mGeometry.llc = 0;
+    mGeometry.llcshare = 0;
+    for(i = mCore.begin(); i != mCore.end(); i++)
+    {
+        const Cache* c;
+        if((c = i->cache(1)))
+        {
+            mGeometry.l1d = mGeometry.l1d ? std::min(mGeometry.l1d, c->size) : c->size;
+            mGeometry.line = std::max(mGeometry.line, c->line);
+        }
+        if((c = i->cache(2)))
+            mGeometry.l2 = mGeometry.l2 ? std::min(mGeometry.l2, c->size) : c->size;
+        if((c = i->llc()))
+        {
+            mGeometry.llc = mGeometry.llc ? std::min(mGeometry.llc, c->size) : c->size;
+            mGeometry.llcshare = std::max(mGeometry.llcshare, static_cast<unsigned int>(c->shared.count()));
         }
     }
-#endif
+    if(!mGeometry.line)
+        mGeometry.line = ENZYME_CACHELINE;
+}
 
-#ifdef __linux__
-//    sched_setaffinity( 0, sizeof(affinold), &affinold );
-#endif
+
+enzyme::cpu::Enumerator::Enumerator(std::pmr::memory_resource* resource)
+    : mResource(resource ? resource : &mArena)
+    , mIntern(mResource)
+    , mCore(mResource)
+{
+    ENZYME_PERF_OPERATION("cpu.enumerate");
+
+    mCPUID.capture();
+
+    std::string name;
+    std::string cls;
+    const Leaf* l = mCPUID.find(0);
+    if(l)
+    {
+        union {
+            uint32_t u[3];
+            char c[12];
+        } vendor;
+        vendor.u[0] = l->ebx; vendor.u[1] = l->edx; vendor.u[2] = l->ecx;
+        cls.assign(vendor.c, 12);
+    }
+
+    if(mCPUID.find(0x80000004))
+    {
+        union {
+            uint32_t reg[3][4];
+            char desc[49];
+        } ext;
+        memset(&ext, 0, sizeof(ext));
+        for(int i = 0; i < 3; i++)
+        {
+            l = mCPUID.find(0x80000002 + i);
+            ext.reg[i][0] = l->eax; ext.reg[i][1] = l->ebx; ext.reg[i][2] = l->ecx; ext.reg[i][3] = l->edx;
+        }
+        name = ext.desc;
+    }
+    else if((cls == "GenuineIntel") && (l = mCPUID.find(1)))
+    {
+        switch(l->ebx & 0x000000FF)
+        {
+        case 1:
+            name = "Celeron"; break;
+        case 2:
+            name = "Pentium III"; break;
+        case 3:
+            name = "Pentium III Xeon"; break;
+        default:
+            name = "Pentium 4"; break;
+        }
+    }
+    else
+        name = "Unknown";
 
     std::string mfr;
-    std::string cls(vendor.c, 12);
-    if(!memcmp(vendor.c, "AuthenticAMD", 12))
+    if(cls == "AuthenticAMD")
         mfr = "AMD";
-    else if(!memcmp(vendor.c, "GenuineIntel", 12))
+    else if(cls == "GenuineIntel")
         mfr = "Intel Corporation";
     else
         mfr = cls;
 
-#if defined(__linux__) || defined(__APPLE__)
-    unsigned short cnt = sysconf(_SC_NPROCESSORS_CONF);
-#elif defined(_WIN32)
-    SYSTEM_INFO si;
-    GetSystemInfo(&si);
-    unsigned short cnt = static_cast<unsigned short>(si.dwNumberOfProcessors);
-#else
-    unsigned short cnt = 1;
-#endif
-    unsigned short ind = 0;
-    while(ind < cnt)
+    Set allowed = Set::affinity();
+    Set present = Set::configured();
+    for(unsigned int ind = 0; ind < present.limit(); ind++)
+    {
+        if(present.test(ind))
+        {
+            mCore.emplace_back(ind, mIntern(cls), mIntern(mfr), mIntern(name));
+            mCore.back().mAllowed = allowed.test(ind);
+            mCore.back().mNode = node(ind);
+            mCore.back().mMaxFreq = readmaxfreq(ind);
+            child().push_back(&mCore.back());
+        }
+    }
+
+    std::pmr::list<Core>::iterator i;
+    for(i = mCore.begin(); i != mCore.end(); i++)
     {
-        child().push_back(new Core(cls, mfr, name));
-        ind++;
+        if(i->id() >= mByID.size())
+            mByID.resize(i->id() + 1, NULL);
+        mByID[i->id()] = &*i;
     }
+
+    visit();
+    caches();
+    rank();
 }
 
 
 enzyme::cpu::Enumerator::~Enumerator()
 {
 }
+
+
+///
+/// @brief Find core by OS processor number
+///
+
+const enzyme::cpu::Core* enzyme::cpu::Enumerator::core(unsigned int id) const
+{
+    std::pmr::list<Core>::const_iterator i;
+    for(i = mCore.begin(); i != mCore.end(); i++)
+    {
+        if(i->id() == id)
+            return &*i;
+    }
+    return NULL;
+}
+
+
+///
+/// @brief Find cores in a processor set
+///
+
+std::list<const enzyme::cpu::Core*> enzyme::cpu::Enumerator::core(const Set& set) const
+{
+    std::list<const Core*> result;
+    std::pmr::list<Core>::const_iterator i;
+    for(i = mCore.begin(); i != mCore.end(); i++)
+    {
+        if(set.test(i->id()))
+            result.push_back(&*i);
+    }
+    return result;
+}
+
+
+std::list<const enzyme::cpu::Core*> enzyme::cpu::Enumerator::allowed() const
+{
+    std::list<const Core*> result;
+    std::pmr::list<Core>::const_iterator i;
+    for(i = mCore.begin(); i != mCore.end(); i++)
+    {
+        if(i->allowed())
+            result.push_back(&*i);
+    }
+    return result;
+}
+
+
+std::vector<std::list<const enzyme::cpu::Core*> > enzyme::cpu::Enumerator::classes() const
+{
+    std::vector<std::list<const Core*> > result;
+    std::list<const Core*> cores = ordered();
+    std::list<const Core*>::iterator i;
+    for(i = cores.begin(); i != cores.end(); i++)
+    {
+        if((*i)->performance() >= result.size())
+            result.resize((*i)->performance() + 1);
+        result[(*i)->performance()].push_back(*i);
+    }
+
+    // Drop classes with no allowed cores
+    std::vector<std::list<const Core*> > compact;
+    std::vector<std::list<const Core*> >::iterator c;
+    for(c = result.begin(); c != result.end(); c++)
+    {
+        if(!c->empty())
+            compact.push_back(*c);
+    }
+    return compact;
+}
+
+
+std::list<const enzyme::cpu::Core*> enzyme::cpu::Enumerator::ordered() const
+{
+    std::vector<const Core*> sorted;
+    std::pmr::list<Core>::const_iterator i;
+    for(i = mCore.begin(); i != mCore.end(); i++)
+    {
+        if(i->allowed())
+            sorted.push_back(&*i);
+    }
+    std::sort(sorted.begin(), sorted.end(), faster);
+    return std::list<const Core*>(sorted.begin(), sorted.end());
+}
+
+
+///
+/// @brief Read a list of MSRs on every core, over the descriptors each core holds
+///
+
+size_t enzyme::cpu::Enumerator::rdmsr(const std::vector<uint32_t>& msr, std::vector<uint64_t>& result) const
+{
+    result.assign(mCore.size() * msr.size(), 0);
+
+    size_t failed = 0;
+    std::vector<uint64_t>::iterator r = result.begin();
+    std::pmr::list<Core>::const_iterator i;
+    for(i = mCore.begin(); i != mCore.end(); i++)
+    {
+        std::vector<uint32_t>::const_iterator m;
+        for(m = msr.begin(); m != msr.end(); m++, r++)
+        {
+            if(!i->rdmsr(*m, *r))
+            {
+                *r = 0;
+                failed++;
+            }
+        }
+    }
+    return failed;
+}
+
+
+///
+/// @brief Find cores sharing a last level cache with a core
+///
+
+std::list<const enzyme::cpu::Core*> enzyme::cpu::Enumerator::llcshare(unsigned int id) const
+{
+    const Core* c = core(id);
+    const Cache* llc = c ? c->llc() : NULL;
+    if(!llc)
+    {
+        std::list<const Core*> result;
+        if(c)
+            result.push_back(c);
+        return result;
+    }
+    return core(llc->shared);
+}
@@ -14,6 +14,18 @@
 
 
 #include "enzyme.h"
+#include "enzyme_arena.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 
 namespace enzyme
@@ -21,35 +33,522 @@ namespace enzyme
     namespace cpu
     {
 
+        ///
+        /// @brief Set of logical processors, by OS processor number
+        ///
+        /// Lexes and parses the Linux cpulist format, e.g. "0-7,16-23".
+        ///
+
+        class Set : public AutoLex
+        {
+        private:
+            std::vector<uint64_t> mBit;
+
+        public:
+            Set()
+            {
+            }
+
+            explicit Set(const std::string& list);
+
+            void set(unsigned int cpu)
+            {
+                if(cpu / 64 >= mBit.size())
+                    mBit.resize(cpu / 64 + 1);
+                mBit[cpu / 64] |= (uint64_t)1 << (cpu % 64);
+            }
+
+            void reset(unsigned int cpu)
+            {
+                if(cpu / 64 < mBit.size())
+                    mBit[cpu / 64] &= ~((uint64_t)1 << (cpu % 64));
+            }
+
+            bool test(unsigned int cpu) const
+            {
+                return (cpu / 64 < mBit.size()) && ((mBit[cpu / 64] >> (cpu % 64)) & 1);
+            }
+
+            /// @brief One past the highest processor number that may be set
+            unsigned int limit() const { return static_cast<unsigned int>(mBit.size() * 64); }
+
+            size_t count() const;
+            bool empty() const { return !count(); }
+
+            Set operator&(const Set& other) const;
+            bool operator==(const Set& other) const;
+
+            std::ostream& lex(std::ostream& os) const;
+
+            /// @brief Processors the calling thread may run on
+            static Set affinity();
+
+            /// @brief Processors the OS has configured, plus any the calling thread may run on
+            static Set configured();
+
+            /// @brief Restrict the calling thread to this set
+            void pin() const;
+        };
+
+
+        ///
+        /// @brief One CPUID leaf/subleaf result
+        ///
+
+        typedef struct
+        {
+            uint32_t leaf;
+            uint32_t subleaf;
+            uint32_t eax;
+            uint32_t ebx;
+            uint32_t ecx;
+            uint32_t edx;
+        }
+        Leaf;
+
+
+        ///
+        /// @brief Execute CPUID on the calling processor; false if not supported
+        ///
+
+        bool cpuid(uint32_t leaf, uint32_t subleaf, Leaf& result);
+
+
+        ///
+        /// @brief Captured CPUID results, sorted by leaf and subleaf
+        ///
+
+        class Table
+        {
+        private:
+            std::vector<Leaf> mLeaf;
+
+        public:
+            /// @brief Capture every basic and extended leaf and their subleaves
+            void capture();
+
+            /// @brief Capture only the leaves that differ between logical processors
+            void capturelocal();
+
+            const Leaf* find(uint32_t leaf, uint32_t subleaf = 0) const;
+
+            const std::vector<Leaf>& leaf() const { return mLeaf; }
+            size_t size() const { return mLeaf.size(); }
+
+        protected:
+            Leaf add(uint32_t leaf, uint32_t subleaf);
+            void addleaf(uint32_t leaf);
+            void addlevels(uint32_t leaf);
+        };
+
+
+        ///
+        /// @brief Instruction set and timer features
+        ///
+        /// Vector features are reported only if the OS also saves their state
+        /// (XCR0), so a set bit means the instructions are safe to execute.
+        ///
+
+        typedef enum
+        {
+            SSE2, SSE42, POPCNT, BMI1, AVX, AVX2, AVX512F, AVX512BW,
+            ERMS, FSRM, CLFLUSHOPT, CLWB, MOVDIRI, MOVDIR64B, ENQCMD,
+            WAITPKG, RDTSCP, RDPID, InvariantTSC, Hybrid,
+            Features
+        }
+        Feature;
+
+
+        ///
+        /// @brief Immutable feature bitset
+        ///
+
+        class FeatureSet : public AutoLex
+        {
+        private:
+            uint64_t mBit;
+
+        public:
+            explicit FeatureSet(const Table& table);
+
+            bool has(Feature f) const { return (mBit >> f) & 1; }
+            uint64_t bits() const { return mBit; }
+
+            static const char* name(Feature f);
+
+            std::ostream& lex(std::ostream& os) const;
+        };
+
+
+        ///
+        /// @brief Features of this process's processors, detected on first use
+        ///
+
+        const FeatureSet& features();
+
+        inline bool has(Feature f)
+        {
+            return features().has(f);
+        }
+
+
+        ///
+        /// @brief OS number of the processor the calling thread is running on
+        ///
+        /// Reads TSC_AUX with rdpid (or rdtscp) where the OS keeps the processor
+        /// number there, as Linux does; otherwise uses getcpu (a vDSO call on
+        /// Linux) or GetCurrentProcessorNumber. The thread may migrate at any
+        /// time, so the result is a hint unless the thread is pinned.
+        ///
+
+        unsigned int current();
+
+
+        ///
+        /// @brief NUMA node of a processor; -1 if unknown
+        ///
+
+        int node(unsigned int id);
+
+
+        ///
+        /// @brief Position of a logical processor, decoded from its x2APIC ID
+        ///
+        /// IDs are relative to the enclosing level: die within package, core
+        /// within package and SMT thread within core. Fields are Unknown if the
+        /// processor could not be visited.
+        ///
+
+        typedef struct
+        {
+            enum { Unknown = 0xFFFFFFFF };
+
+            uint32_t apic;
+            uint32_t package;
+            uint32_t die;
+            uint32_t core;
+            uint32_t smt;
+        }
+        Topology;
+
+
+        ///
+        /// @brief One cache seen by a logical processor
+        ///
+        /// Decoded from CPUID leaf 4 (or AMD 0x8000001D) and checked against
+        /// Linux sysfs cacheinfo. Where the two disagree, sysfs wins, since the
+        /// kernel applies model quirks; source records which of them agreed.
+        ///
+
+        typedef enum
+        {
+            Data = 1, Instruction = 2, Unified = 3
+        }
+        CacheType;
+
+        typedef struct
+        {
+            enum { FromCPUID = 1, FromSysfs = 2 };
+
+            unsigned int level;
+            CacheType type;
+            size_t size;
+            unsigned int ways;
+            unsigned int line;
+            unsigned int sets;
+            bool inclusive;
+            unsigned int source;
+            Set shared;                 // Processors sharing this cache, including this one
+        }
+        Cache;
+
+
+        ///
+        /// @brief Cache sizes common to all cores, for sizing rings and buffers
+        ///
+        /// Each value is the smallest seen on any core, so that buffers sized
+        /// from it fit everywhere; llcshare is the largest number of processors
+        /// sharing one last level cache.
+        ///
+
+        typedef struct
+        {
+            unsigned int line;
+            size_t l1d;
+            size_t l2;
+            size_t llc;
+            unsigned int llcshare;
+        }
+        Geometry;
+
+
+        ///
+        /// @brief Core type of a hybrid processor, from CPUID leaf 0x1A
+        ///
+
+        typedef enum
+        {
+            UnknownType = 0,
+            Efficiency = 0x20,          // Intel Atom
+            Performance = 0x40          // Intel Core
+        }
+        CoreType;
+
+
         ///
         /// @brief CPU core
         ///
 
         class Core : public enzyme::Device
         {
+            friend class Enumerator;
+
+        protected:
+            unsigned int mID;
+            Table mCPUID;
+            Topology mTopology;
+            std::vector<Cache> mCache;
+            mutable std::atomic<int> mMSR;
+            bool mAllowed;
+            int mNode;
+            CoreType mType;
+            uint64_t mMaxFreq;
+            unsigned int mClass;
+
+            int msrfd() const;
+
+            // Class, vendor and name are interned by the enumerator; a copy owns its own
+            StringLex mLocationLex;
+            StringLex* mOwnedLex;
+
+            Core(const Core& other, StringLex* owned);
+
         public:
-            Core(const std::string& classid, const std::string& manufacturer, const std::string& name);
+            Core(unsigned int id, const StringLex& classid, const StringLex& manufacturer, const StringLex& name);
+
+            ///
+            /// @brief Copy a core; the copy owns its names and may outlive the enumerator
+            ///
+
+            Core(const Core& other);
             ~Core();
+
+            /// @brief OS logical processor number
+            unsigned int id() const { return mID; }
+
+            /// @brief NUMA node of the core; -1 if unknown
+            int node() const { return mNode; }
+
+            /// @brief Hybrid core type; UnknownType on processors without leaf 0x1A
+            CoreType type() const { return mType; }
+
+            /// @brief Maximum frequency in kHz from cpufreq; 0 if unknown
+            uint64_t maxfreq() const { return mMaxFreq; }
+
+            ///
+            /// @brief Performance class; 0 is the fastest
+            ///
+            /// Cores are ranked by type (Performance ahead of Efficiency) and
+            /// then by maximum frequency; cores alike in both share a class.
+            ///
+
+            unsigned int performance() const { return mClass; }
+
+            /// @brief True if this process may run on the core (sched_getaffinity at enumeration)
+            bool allowed() const { return mAllowed; }
+
+            /// @brief Restrict the calling thread to this core
+            void pin_current_thread() const;
+
+            /// @brief Per-processor CPUID leaves (APIC ID, topology and hybrid leaves)
+            const Table& cpuid() const { return mCPUID; }
+
+            const Topology& topology() const { return mTopology; }
+            uint32_t apic()     const { return mTopology.apic; }
+            uint32_t package()  const { return mTopology.package; }
+            uint32_t die()      const { return mTopology.die; }
+            uint32_t core()     const { return mTopology.core; }
+            uint32_t smt()      const { return mTopology.smt; }
+
+            /// @brief Caches by ascending level
+            const std::vector<Cache>& cache() const { return mCache; }
+
+            /// @brief Cache at a level holding data (Data or Unified); NULL if none
+            const Cache* cache(unsigned int level) const;
+
+            /// @brief Last level cache; NULL if unknown
+            const Cache* llc() const;
+
+            ///
+            /// @brief Read or write a model specific register of this processor
+            ///
+            /// Uses the Linux msr driver (kernel::devcpu()/N/msr), opened on
+            /// first use and held until the core is destroyed. Throws if the
+            /// device cannot be opened or the register cannot be accessed.
+            ///
+
+            uint64_t rdmsr(uint32_t msr) const;
+            void wrmsr(uint32_t msr, uint64_t value) const;
+
+            /// @brief Read without throwing; false on failure
+            bool rdmsr(uint32_t msr, uint64_t& value) const;
+        };
+
+
+        ///
+        /// @brief Restrict the calling thread to a set of processors for the life of the guard
+        ///
+
+        class Affinity
+        {
+        private:
+            Set mSaved;
+
+            Affinity(const Affinity&);
+            Affinity& operator=(const Affinity&);
+
+        public:
+            explicit Affinity(const Set& set);
+            explicit Affinity(const Core& core);
+            ~Affinity();
+        };
+
+
+        ///
+        /// @brief Thread pinned to one core, running submitted callables in order
+        ///
+        /// If the core has left the process affinity mask since enumeration,
+        /// the thread runs unpinned rather than drop work; pinned() reports
+        /// which. The destructor runs any work already submitted and then joins.
+        ///
+        /// Only the core's id is kept, so a worker may outlive the enumerator
+        /// (or Snapshot) the core came from.
+        ///
+
+        class Worker
+        {
+        private:
+            unsigned int mID;
+            mutable std::mutex mLock;
+            std::condition_variable mReady;
+            mutable std::condition_variable mStarted;
+            std::deque<std::packaged_task<void()> > mQueue;
+            bool mStop;
+            int mPinned;                // -1 until the thread has tried to pin itself
+            std::thread mThread;
+
+            Worker(const Worker&);
+            Worker& operator=(const Worker&);
+
+            void run();
+            void enqueue(std::packaged_task<void()>&& task);
+
+        public:
+            explicit Worker(const Core& core);
+            ~Worker();
+
+            /// @brief OS processor number of the core
+            unsigned int id() const { return mID; }
+
+            /// @brief True if the thread is pinned to the core; waits for the thread to start
+            bool pinned() const;
+
+            ///
+            /// @brief Queue f to run on the core
+            ///
+            /// The future carries the result of f, or the exception it threw.
+            ///
+
+            template<typename F> std::future<typename std::invoke_result<F>::type> submit(F f)
+            {
+                typedef typename std::invoke_result<F>::type R;
+
+                std::shared_ptr<std::packaged_task<R()> > task = std::make_shared<std::packaged_task<R()> >(std::move(f));
+                std::future<R> result = task->get_future();
+                enqueue(std::packaged_task<void()>([task]() { (*task)(); }));
+                return result;
+            }
         };
 
 
         ///
         /// @brief CPU core enumerator
         ///
+        /// The core list is allocated from the given memory resource, or by
+        /// default from an arena owned by the enumerator. Vendor and brand
+        /// strings are stored once and shared by every core.
+        ///
 
         class Enumerator : public enzyme::Node
         {
         protected:
-            std::list<Core> mCore;
+            Arena mArena;
+            std::pmr::memory_resource* mResource;
+            Intern mIntern;
+            std::pmr::list<Core> mCore;
+            std::vector<Core*> mByID;
+            Table mCPUID;
+            Geometry mGeometry;
+
+            void visit();
+            void caches();
+            void rank();
 
         public:
-            Enumerator();
+            explicit Enumerator(std::pmr::memory_resource* resource = NULL);
             ~Enumerator();
 
-            Core* activecore();
+            std::pmr::memory_resource* resource() const { return mResource; }
+
+            /// @brief Default arena; empty if the enumerator was given a resource
+            const Arena& arena() const { return mArena; }
+
+            /// @brief Core the calling thread is running on; NULL if not enumerated
+            const Core* activecore() const
+            {
+                unsigned int id = current();
+                return (id < mByID.size()) ? mByID[id] : NULL;
+            }
+
 //            Core* core(const Location& location);
 
-            std::list<Core>& core() { return mCore; }
+            std::pmr::list<Core>& core() { return mCore; }
+            const std::pmr::list<Core>& core() const { return mCore; }
+
+            /// @brief CPUID leaves, as captured on the enumerating thread
+            const Table& cpuid() const { return mCPUID; }
+
+            /// @brief Core by OS processor number; NULL if not enumerated
+            const Core* core(unsigned int id) const;
+
+            /// @brief Cores in a set, e.g. the local CPUs of a PCI device
+            std::list<const Core*> core(const Set& set) const;
+
+            /// @brief Cores this process may run on; size this, not core(), for thread pools
+            std::list<const Core*> allowed() const;
+
+            /// @brief Allowed cores grouped by performance class, fastest first
+            std::vector<std::list<const Core*> > classes() const;
+
+            /// @brief Allowed cores ordered fastest class first, then by id
+            std::list<const Core*> ordered() const;
+
+            ///
+            /// @brief Read a list of MSRs on every core
+            ///
+            /// One pread per register per core, on the thread that calls it: the
+            /// msr driver runs each read on its processor, so no pinning or
+            /// worker threads are needed. result[c * msr.size() + m] holds
+            /// register m of the c-th core in core() order; failed reads are
+            /// left 0. Returns the number of failed reads.
+            ///
+
+            size_t rdmsr(const std::vector<uint32_t>& msr, std::vector<uint64_t>& result) const;
+
+            /// @brief Cores sharing a last level cache with core id, including itself
+            std::list<const Core*> llcshare(unsigned int id) const;
+
+            const Geometry& geometry() const { return mGeometry; }
         };
     };
 };
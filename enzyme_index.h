@@ -0,0 +1,229 @@
+///
+/// @file    enzyme_index.h
+/// @brief   Enzyme Hardware Abstraction Layer: Resource Address Index
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef _enzyme_index_h_
+#define _enzyme_index_h_
+
+
+#include "enzyme.h"
+#include "enzyme_mem.h"
+#include "enzyme_port.h"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+
+
+namespace enzyme
+{
+
+    ///
+    /// @brief Address to resource/device index
+    ///
+    /// A sorted array of resource intervals with a segment tree of the
+    /// largest interval end over each range of the array. Every entry at or
+    /// before the last one whose base is <= addr starts at or below addr, so
+    /// the innermost interval containing addr is the rightmost such entry
+    /// whose end reaches addr; the tree finds it in O(log n) however the
+    /// intervals nest or overlap. overlap() and conflict() cost O(log n) per
+    /// interval reported. Resources may nest or overlap; lookups return the
+    /// containing interval with the highest base, which for nested windows is
+    /// the innermost.
+    ///
+    /// Ends are inclusive, so ranges that reach the top of the address space
+    /// are represented exactly.
+    ///
+    /// Built once after enumeration; lookups are const and safe from any thread.
+    ///
+
+    template<typename R, typename A> class Index
+    {
+    public:
+        typedef struct
+        {
+            A base;
+            A last;                 // Inclusive
+            const R* resource;
+            const Device* device;
+        }
+        Entry;
+
+    private:
+        std::vector<Entry> mEntry;
+        std::vector<A> mMaxLast;    // Segment tree; leaves from mLeaves
+        size_t mLeaves;
+
+        static bool before(const Entry& a, const Entry& b)
+        {
+            return (a.base < b.base) || ((a.base == b.base) && (a.last > b.last));
+        }
+
+        static bool below(A addr, const Entry& e)
+        {
+            return addr < e.base;
+        }
+
+        // Index of the last entry with base <= addr, or -1
+        ptrdiff_t upto(A addr) const
+        {
+            return (std::upper_bound(mEntry.begin(), mEntry.end(), addr, below) - mEntry.begin()) - 1;
+        }
+
+        // Rightmost entry in [lo, hi] of node, at or before limit, whose last is >= addr; -1 if none
+        ptrdiff_t rightmost(size_t node, size_t lo, size_t hi, ptrdiff_t limit, A addr) const
+        {
+            if((static_cast<ptrdiff_t>(lo) > limit) || (lo >= mEntry.size()) || (mMaxLast[node] < addr))
+                return -1;
+            if(lo == hi)
+                return static_cast<ptrdiff_t>(lo);
+
+            size_t mid = lo + (hi - lo) / 2;
+            ptrdiff_t i = rightmost(2 * node + 1, mid + 1, hi, limit, addr);
+            return (i >= 0) ? i : rightmost(2 * node, lo, mid, limit, addr);
+        }
+
+        // Every entry at or before limit whose last is >= addr, in descending order
+        size_t collect(size_t node, size_t lo, size_t hi, ptrdiff_t limit, A addr, std::vector<size_t>& result) const
+        {
+            if((static_cast<ptrdiff_t>(lo) > limit) || (lo >= mEntry.size()) || (mMaxLast[node] < addr))
+                return 0;
+            if(lo == hi)
+            {
+                result.push_back(lo);
+                return 1;
+            }
+
+            size_t mid = lo + (hi - lo) / 2;
+            size_t cnt = collect(2 * node + 1, mid + 1, hi, limit, addr, result);
+            return cnt + collect(2 * node, lo, mid, limit, addr, result);
+        }
+
+    public:
+        Index()
+            : mLeaves(0)
+        {
+        }
+
+        void clear()
+        {
+            mEntry.clear();
+            mMaxLast.clear();
+            mLeaves = 0;
+        }
+
+        void insert(const R* resource, const Device* device)
+        {
+            if(!resource->size())
+                return;
+
+            // Saturate, so that a size running past the top of the space cannot wrap
+            A base = static_cast<A>(resource->base());
+            A span = static_cast<A>(resource->size() - 1);
+
+            Entry e;
+            e.base = base;
+            e.last = (span > std::numeric_limits<A>::max() - base) ? std::numeric_limits<A>::max() : base + span;
+            e.resource = resource;
+            e.device = device;
+            mEntry.push_back(e);
+        }
+
+        void build()
+        {
+            std::sort(mEntry.begin(), mEntry.end(), before);
+
+            mLeaves = 1;
+            while(mLeaves < mEntry.size())
+                mLeaves *= 2;
+
+            // Node 1 is the root; node n has children 2n and 2n + 1
+            mMaxLast.assign(2 * mLeaves, 0);
+            for(size_t i = 0; i < mEntry.size(); i++)
+                mMaxLast[mLeaves + i] = mEntry[i].last;
+            for(size_t n = mLeaves - 1; n >= 1; n--)
+                mMaxLast[n] = std::max(mMaxLast[2 * n], mMaxLast[2 * n + 1]);
+        }
+
+        size_t size() const { return mEntry.size(); }
+        const std::vector<Entry>& entry() const { return mEntry; }
+
+        ///
+        /// @brief Innermost interval containing addr, or NULL
+        ///
+
+        const Entry* find(A addr) const
+        {
+            if(mEntry.empty())
+                return NULL;
+
+            ptrdiff_t i = rightmost(1, 0, mLeaves - 1, upto(addr), addr);
+            return (i >= 0) ? &mEntry[i] : NULL;
+        }
+
+        const Device* device(A addr) const
+        {
+            const Entry* e = find(addr);
+            return e ? e->device : NULL;
+        }
+
+        ///
+        /// @brief All intervals overlapping [base, base + size); returns the count found
+        ///
+
+        size_t overlap(A base, A size, std::vector<const Entry*>& result) const
+        {
+            if(!size || mEntry.empty())
+                return 0;
+
+            A span = size - 1;
+            A last = (span > std::numeric_limits<A>::max() - base) ? std::numeric_limits<A>::max() : base + span;
+
+            std::vector<size_t> found;
+            size_t cnt = collect(1, 0, mLeaves - 1, upto(last), base, found);
+            for(size_t i = 0; i < found.size(); i++)
+                result.push_back(&mEntry[found[i]]);
+            return cnt;
+        }
+
+        ///
+        /// @brief All pairs of overlapping intervals; returns the count found
+        ///
+
+        size_t conflict(std::vector<std::pair<const Entry*, const Entry*> >& result) const
+        {
+            size_t cnt = 0;
+            std::vector<size_t> found;
+            for(size_t i = 1; i < mEntry.size(); i++)
+            {
+                found.clear();
+                cnt += collect(1, 0, mLeaves - 1, static_cast<ptrdiff_t>(i) - 1, mEntry[i].base, found);
+                for(size_t j = 0; j < found.size(); j++)
+                    result.push_back(std::make_pair(&mEntry[found[j]], &mEntry[i]));
+            }
+            return cnt;
+        }
+    };
+
+
+    namespace mem
+    {
+        typedef enzyme::Index<Resource, uintmax_t> Index;
+    };
+
+    namespace port
+    {
+        typedef enzyme::Index<Resource, uint32_t> Index;
+    };
+};
+
+
+#endif  // _enzyme_index_h_
@@ -10,6 +10,15 @@
 
 #include "enzyme_mem.h"
 
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 
 // ---------------------------------------------------------------------------
 
@@ -24,3 +33,99 @@ namespace enzyme
         };
     };
 };
+
+
+// ---------------------------------------------------------------------------
+
+
+#if defined(__linux__)
+namespace enzyme
+{
+    namespace mem
+    {
+        enum
+        {
+            MPOL_DEFAULT    = 0,
+            MPOL_PREFERRED  = 1,
+            MPOL_BIND       = 2
+        };
+
+        static const unsigned long gMaxNode = 1024;
+    };
+};
+#endif
+
+
+///
+/// @brief Allocate page granular host memory on a NUMA node
+///
+
+void* enzyme::mem::allocate(size_t size, int node, bool strict)
+{
+#if defined(__linux__)
+    void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED)
+        throw std::runtime_error("Host memory: Allocation failed");
+
+    if((node >= 0) && (static_cast<unsigned long>(node) < gMaxNode))
+    {
+        unsigned long mask[gMaxNode / (8 * sizeof(unsigned long))] = { 0 };
+        mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+        if(syscall(SYS_mbind, addr, size, strict ? MPOL_BIND : MPOL_PREFERRED, mask, gMaxNode, 0) && strict)
+        {
+            munmap(addr, size);
+            throw std::runtime_error("Host memory: Cannot bind to NUMA node");
+        }
+    }
+    return addr;
+
+#elif defined(_WIN32)
+    void* addr;
+    if(node >= 0)
+        addr = VirtualAllocExNuma(GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+    else
+        addr = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if(!addr)
+        throw std::runtime_error("Host memory: Allocation failed");
+    return addr;
+
+#else
+    return new uint8_t[size];
+#endif
+}
+
+
+void enzyme::mem::release(void* addr, size_t size)
+{
+    if(!addr)
+        return;
+
+#if defined(__linux__)
+    munmap(addr, size);
+#elif defined(_WIN32)
+    VirtualFree(addr, 0, MEM_RELEASE);
+#else
+    delete [] static_cast<uint8_t*>(addr);
+#endif
+}
+
+
+///
+/// @brief Set the calling thread's preferred NUMA node
+///
+
+void enzyme::mem::bind(int node)
+{
+#if defined(__linux__)
+    if((node < 0) || (static_cast<unsigned long>(node) >= gMaxNode))
+    {
+        syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+        return;
+    }
+
+    unsigned long mask[gMaxNode / (8 * sizeof(unsigned long))] = { 0 };
+    mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+    if(syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, gMaxNode))
+        throw std::runtime_error("Host memory: Cannot set NUMA policy");
+#endif
+}
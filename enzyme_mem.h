@@ -13,8 +13,18 @@
 #define _enzyme_mem_h_
 
 
+#include <algorithm>
 #include <stdexcept>
+#include <vector>
 #include "enzyme.h"
+#include "enzyme_trace.h"
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)) || defined(__SSE2__)
+#define ENZYME_SSE2
+#include <emmintrin.h>
+#else
+#include <atomic>
+#endif
 
 
 namespace enzyme
@@ -33,6 +43,74 @@ namespace enzyme
         Cache;
 
 
+        ///
+        /// @brief Store fence
+        ///
+        /// Orders all prior stores, including write-combined stores to WC mappings,
+        /// before any later store. Issue once before ringing a device doorbell.
+        ///
+
+        inline void sfence()
+        {
+#ifdef ENZYME_SSE2
+            _mm_sfence();
+#else
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+        }
+
+
+        ///
+        /// @brief Host memory placed on a NUMA node
+        ///
+        /// Page granular. With node -1 the memory is placed by the default policy;
+        /// otherwise the node is preferred, or required if strict. Pages are
+        /// placed when first touched.
+        ///
+
+        void* allocate(size_t size, int node = -1, bool strict = false);
+        void release(void* addr, size_t size);
+
+
+        ///
+        /// @brief Prefer a NUMA node for all later allocations by the calling thread
+        ///
+        /// Node -1 restores the default (local) policy.
+        ///
+
+        void bind(int node);
+
+
+        ///
+        /// @brief Host buffer on a NUMA node, e.g. pci::Device::node()
+        ///
+
+        class Buffer
+        {
+        private:
+            void* mData;
+            size_t mSize;
+
+            Buffer(const Buffer&);
+            Buffer& operator=(const Buffer&);
+
+        public:
+            Buffer(size_t size, int node = -1, bool strict = false)
+                : mData(allocate(size, node, strict))
+                , mSize(size)
+            {
+            }
+
+            ~Buffer()
+            {
+                release(mData, mSize);
+            }
+
+            void* data()    const { return mData; }
+            size_t size()   const { return mSize; }
+        };
+
+
         ///
         /// @brief Abstract memory resource accessor
         ///
@@ -97,20 +175,89 @@ namespace enzyme
         };
 
 
+        ///
+        /// @brief Register program: a reusable list of register offsets
+        ///
+        /// The largest offset is tracked as offsets are added, so a gather or
+        /// scatter through a program costs a single range check however many
+        /// registers it touches. The check is made in elements, not bytes, so
+        /// no offset can overflow it. Offsets are accessed in the order given.
+        ///
+
+        class Program
+        {
+        private:
+            std::vector<size_t> mOffset;
+            size_t mMaxOffset;
+
+        public:
+            Program()
+                : mMaxOffset(0)
+            {
+            }
+
+            template<typename I> Program(I first, I last)
+                : mMaxOffset(0)
+            {
+                while(first != last)
+                    push_back(*first++);
+            }
+
+            void push_back(size_t offset)
+            {
+                mOffset.push_back(offset);
+                if(offset > mMaxOffset)
+                    mMaxOffset = offset;
+            }
+
+            void clear()
+            {
+                mOffset.clear();
+                mMaxOffset = 0;
+            }
+
+            /// @brief True if an element of type T at every offset lies within size bytes
+            template<typename T> bool fits(uintmax_t size) const
+            {
+                return mOffset.empty() || (mMaxOffset < size / sizeof(T));
+            }
+
+            bool empty()                        const { return mOffset.empty(); }
+            size_t size()                       const { return mOffset.size(); }
+            size_t maxoffset()                  const { return mMaxOffset; }
+            const size_t* offset()              const { return mOffset.empty() ? NULL : &mOffset[0]; }
+            size_t operator[](size_t i)         const { return mOffset[i]; }
+        };
+
+
+        template<typename T, size_t N> class Batch;
+        template<typename T> class Client;
+
+        namespace poll
+        {
+            template<typename T> volatile const void* address(const Client<T>& client, size_t offset);
+        };
+
+
         ///
         /// @brief Physically contiguous memory resource accessor
         ///
         /// The virtual memory pointer is not public because it's possible for future
         /// platforms (e.g. Windows 8 or hardware emulators) to not support mapping
         /// physical memory to user virtual addresses. Instead, read() and write() are
-        /// provided.
+        /// provided. Every element is accessed individually at its own width, so a
+        /// device sees exactly the register accesses requested.
         ///
 
         template<typename T> class Client : public Resource
         {
         private:
+            template<typename U, size_t N> friend class Batch;
+            template<typename U> friend volatile const void* poll::address(const Client<U>& client, size_t offset);
+
             impl::Client* mImpl;
             volatile T* mVirt;
+            Cache mCache;
 
             static std::runtime_error mReadError;
             static std::runtime_error mWriteError;
@@ -118,8 +265,9 @@ namespace enzyme
         public:
             Client(const Resource& resource, Cache cache = UC, uintmax_t offset = 0, uintmax_t size = ~(uintmax_t)0)
                 : Resource(resource)
+                , mCache(cache)
             {
-                mImpl = client(cache, offset, size);
+                mImpl = resource.client(cache, offset, size);
                 mVirt = reinterpret_cast<volatile T*>(mImpl->vaddr());
             }
 
@@ -130,16 +278,20 @@ namespace enzyme
 
             void read(size_t offset, size_t cnt, T* dst) const
             {
-                if((offset + cnt) * sizeof(T) >= size())
+                if((offset + cnt) * sizeof(T) > size())
                     throw mReadError;
                 std::copy(mVirt + offset, mVirt + offset + cnt, dst);
+                if(trace::gEnabled)
+                    trace::block(trace::Memory, base(), offset, 1, dst, cnt, sizeof(T), false);
             }
 
             void write(size_t offset, size_t cnt, const T* src) const
             {
-                if((offset + cnt) * sizeof(T) >= size())
+                if((offset + cnt) * sizeof(T) > size())
                     throw mWriteError;
                 std::copy(src, src + cnt, mVirt + offset);
+                if(trace::gEnabled)
+                    trace::block(trace::Memory, base(), offset, 1, src, cnt, sizeof(T), true);
             }
 
             T read(size_t offset) const
@@ -154,12 +306,196 @@ namespace enzyme
                 write(offset, 1, &value);
             }
 
+            ///
+            /// @brief Read the registers of a program, in order, into dst
+            ///
+
+            void read_gather(const Program& program, T* dst) const
+            {
+                if(!program.fits<T>(size()))
+                    throw mReadError;
+
+                const size_t* offset = program.offset();
+                size_t cnt = program.size();
+                for(size_t i = 0; i < cnt; i++)
+                    dst[i] = mVirt[offset[i]];
+                if(trace::gEnabled)
+                    trace::gather(trace::Memory, base(), offset, dst, cnt, sizeof(T), false);
+            }
+
+            ///
+            /// @brief Write src to the registers of a program, in order, then fence once
+            ///
+
+            void write_scatter(const Program& program, const T* src) const
+            {
+                if(!program.fits<T>(size()))
+                    throw mWriteError;
+
+                const size_t* offset = program.offset();
+                size_t cnt = program.size();
+                for(size_t i = 0; i < cnt; i++)
+                    mVirt[offset[i]] = src[i];
+                sfence();
+                if(trace::gEnabled)
+                    trace::gather(trace::Memory, base(), offset, src, cnt, sizeof(T), true);
+            }
+
+            /// @brief Gather from an ad hoc offset list
+            void read_gather(const size_t* offset, size_t cnt, T* dst) const
+            {
+                read_gather(Program(offset, offset + cnt), dst);
+            }
+
+            /// @brief Scatter to an ad hoc offset list
+            void write_scatter(const size_t* offset, size_t cnt, const T* src) const
+            {
+                write_scatter(Program(offset, offset + cnt), src);
+            }
+
+            Cache cache() const { return mCache; }
+
             impl::Client* client(Cache cache, uintmax_t offset, uintmax_t size) const
             {
                 return mImpl->client(cache, offset, size);
             }
         };
 
+        template<typename T> std::runtime_error Client<T>::mReadError("Memory resource: Read out of range");
+        template<typename T> std::runtime_error Client<T>::mWriteError("Memory resource: Write out of range");
+
+
+        ///
+        /// @brief Queued register writes to a memory resource
+        ///
+        /// Writes are gathered in program order and issued on flush(), on scope exit,
+        /// or when N writes are pending. On WC and WB mappings, runs of writes to
+        /// adjacent offsets are merged and issued as the widest aligned stores
+        /// available; on UC mappings each write is issued as queued. A single store
+        /// fence follows on flush(), so a doorbell written afterwards is ordered
+        /// behind the whole sequence.
+        ///
+        /// Offsets are range checked as they are queued, so flushing cannot fail.
+        ///
+
+        template<typename T, size_t N = 4 * ENZYME_CACHELINE / sizeof(T)> class Batch
+        {
+        private:
+            const Client<T>& mClient;
+            size_t mCount;
+            bool mPending;
+
+            size_t mOffset[N];
+            T mValue[N];
+
+            Batch(const Batch&);
+            Batch& operator=(const Batch&);
+
+            static void store(volatile T* dst, const T* src, size_t cnt)
+            {
+                volatile uint8_t* d = reinterpret_cast<volatile uint8_t*>(dst);
+                const uint8_t* s = reinterpret_cast<const uint8_t*>(src);
+                size_t len = cnt * sizeof(T);
+
+                // Lead in to 8 byte alignment one element at a time
+                while(len && (reinterpret_cast<uintptr_t>(d) & 7))
+                {
+                    *reinterpret_cast<volatile T*>(d) = *reinterpret_cast<const T*>(s);
+                    d += sizeof(T); s += sizeof(T); len -= sizeof(T);
+                }
+#ifdef ENZYME_SSE2
+                if((len >= 16) && (reinterpret_cast<uintptr_t>(d) & 15))
+                {
+                    *reinterpret_cast<volatile uint64_t*>(d) = *reinterpret_cast<const uint64_t*>(s);
+                    d += 8; s += 8; len -= 8;
+                }
+                while(len >= 16)
+                {
+                    _mm_store_si128(reinterpret_cast<__m128i*>(const_cast<uint8_t*>(d)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(s)));
+                    d += 16; s += 16; len -= 16;
+                }
+#endif
+                while(len >= 8)
+                {
+                    *reinterpret_cast<volatile uint64_t*>(d) = *reinterpret_cast<const uint64_t*>(s);
+                    d += 8; s += 8; len -= 8;
+                }
+                while(len)
+                {
+                    *reinterpret_cast<volatile T*>(d) = *reinterpret_cast<const T*>(s);
+                    d += sizeof(T); s += sizeof(T); len -= sizeof(T);
+                }
+            }
+
+            void issue()
+            {
+                bool merge = (mClient.mCache == WC) || (mClient.mCache == WB);
+                size_t i = 0;
+                while(i < mCount)
+                {
+                    size_t j = i + 1;
+                    if(merge)
+                    {
+                        while((j < mCount) && (mOffset[j] == mOffset[j - 1] + 1))
+                            j++;
+                    }
+
+                    if(j - i == 1)
+                        mClient.mVirt[mOffset[i]] = mValue[i];
+                    else
+                        store(mClient.mVirt + mOffset[i], mValue + i, j - i);
+                    i = j;
+                }
+
+                if(trace::gEnabled)
+                    trace::gather(trace::Memory, mClient.base(), mOffset, mValue, mCount, sizeof(T), true);
+
+                mCount = 0;
+                mPending = true;
+            }
+
+        public:
+            Batch(const Client<T>& client)
+                : mClient(client)
+                , mCount(0)
+                , mPending(false)
+            {
+            }
+
+            ~Batch()
+            {
+                flush();
+            }
+
+            const Client<T>& client() const { return mClient; }
+            size_t pending() const { return mCount; }
+
+            void write(size_t offset, T value)
+            {
+                if((offset + 1) * sizeof(T) > mClient.size())
+                    throw Client<T>::mWriteError;
+
+                if(mCount == N)
+                    issue();
+
+                mOffset[mCount] = offset;
+                mValue[mCount] = value;
+                mCount++;
+            }
+
+            void flush()
+            {
+                if(mCount)
+                    issue();
+
+                if(mPending)
+                {
+                    sfence();
+                    mPending = false;
+                }
+            }
+        };
+
 
         ///
         /// @brief Dummy memory resource
@@ -179,7 +515,7 @@ namespace enzyme
 
                 impl::Client* client(Cache cache, uintmax_t offset, uintmax_t size) const
                 {
-                    return const_cast<Client*>(this); // FIXME!!
+                    return new Client;
                 }
             };
 
@@ -199,6 +535,70 @@ namespace enzyme
 
             extern Resource gResource;
         };
+
+
+        ///
+        /// @brief Emulated memory resource
+        ///
+        /// Backed by zeroed, cache line aligned host memory so that drivers and
+        /// benchmarks can run against an emulated device. The host virtual address
+        /// stands in as the physical base.
+        ///
+
+        namespace emu
+        {
+            class Client : public impl::Client
+            {
+            private:
+                volatile uint8_t* mVirt;
+
+            public:
+                Client(volatile uint8_t* virt)
+                    : mVirt(virt)
+                {
+                }
+
+                volatile void* vaddr() const
+                {
+                    return mVirt;
+                }
+
+                impl::Client* client(Cache cache, uintmax_t offset, uintmax_t size) const
+                {
+                    return new Client(mVirt + offset);
+                }
+            };
+
+            class Resource : public mem::Resource
+            {
+            private:
+                uint8_t* mAlloc;
+                uint8_t* mData;
+
+                Resource(const Resource&);
+                Resource& operator=(const Resource&);
+
+            public:
+                Resource(uintmax_t size, uintmax_t flag = 0)
+                    : mem::Resource(0, size, flag)
+                    , mAlloc(new uint8_t[static_cast<size_t>(size) + ENZYME_CACHELINE]())
+                {
+                    uintptr_t addr = reinterpret_cast<uintptr_t>(mAlloc);
+                    mData = mAlloc + ((ENZYME_CACHELINE - (addr % ENZYME_CACHELINE)) % ENZYME_CACHELINE);
+                    mBase = reinterpret_cast<uintptr_t>(mData);
+                }
+
+                ~Resource()
+                {
+                    delete [] mAlloc;
+                }
+
+                impl::Client* client(Cache cache, uintmax_t offset, uintmax_t size_) const
+                {
+                    return new Client(mData + offset);
+                }
+            };
+        };
     };
 };
 
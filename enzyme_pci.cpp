@@ -10,12 +10,50 @@
 
 #include "enzyme_pci.h"
 #include "enzyme_pcivendor.h"
+#include "enzyme_perf.h"
 #include "enzyme_platform.h"
 
+#include <cstring>
+
 
 // ---------------------------------------------------------------------------
 
 
+namespace enzyme
+{
+    namespace pci
+    {
+        typedef std::tr1::unordered_map<unsigned short, const char*> VendorMap;
+
+        ///
+        /// @brief Vendor name table; built once, thread-safely, on first use
+        ///
+
+        static const VendorMap& vendormap()
+        {
+            struct Builder
+            {
+                VendorMap map;
+
+                Builder()
+                {
+                    VendorID* cur = gVendor;
+                    VendorID* end = gVendor + (sizeof(gVendor) / sizeof(gVendor[0]));
+                    while(cur < end)
+                    {
+                        map.insert(std::make_pair(cur->id, cur->name));
+                        cur++;
+                    }
+                }
+            };
+
+            static const Builder table;
+            return table.map;
+        }
+    };
+};
+
+
 ///
 /// @brief Vendor AutoLex constructor
 ///
@@ -32,19 +70,102 @@ enzyme::pci::Vendor::Vendor(unsigned short vendor)
 
 std::ostream& enzyme::pci::Vendor::lex(std::ostream& os) const
 {
-    if(mVendorID.empty())
+    const VendorMap& vendors = vendormap();
+    VendorMap::const_iterator i = vendors.find(mVendor);
+    if(i != vendors.end())
+        os << i->second;
+    return os;
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+///
+/// @brief Set a BAR of a record; a size that is not a power of two is rounded up
+///
+
+void enzyme::pci::setbar(Record& r, unsigned int bar, uint64_t base, uint64_t size, uint8_t flag)
+{
+    if((bar >= Record::Bars) || !size)
+        return;
+
+    uint8_t order = 1;
+    while((order < 63) && (((uint64_t)1 << order) < size))
+        order++;
+
+    r.base[bar] = base;
+    r.size[bar] = order;
+    r.flag[bar] = flag;
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+///
+/// @brief Devices, built from the records on first access
+///
+
+std::pmr::list<enzyme::pci::Device>& enzyme::pci::Enumerator::device()
+{
+    std::call_once(mDeviceOnce, [this]()
     {
-        VendorID* cur = gVendor;
-        VendorID* end = gVendor + (sizeof(gVendor) / sizeof(gVendor[0]));
+        materialize();
+        index();
+    });
+    return mDevice;
+}
 
-        while(cur < end)
-        {
-            mVendorID.insert(std::make_pair(cur->id, cur->name));
-            cur++;
-        }
+
+const std::pmr::list<enzyme::pci::Device>& enzyme::pci::Enumerator::device() const
+{
+    // Materializing is serialized by the once flag; the records are not modified
+    return const_cast<Enumerator*>(this)->device();
+}
+
+
+const enzyme::pci::Record* enzyme::pci::Enumerator::record(const Location& location) const
+{
+    std::pmr::vector<Record>::const_iterator lo = mRecord.begin();
+    std::pmr::vector<Record>::const_iterator hi = mRecord.end();
+    while(lo < hi)
+    {
+        std::pmr::vector<Record>::const_iterator mid = lo + (hi - lo) / 2;
+        if(pci::location(*mid) < location)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+    return ((lo != mRecord.end()) && (pci::location(*lo) == location)) ? &*lo : NULL;
+}
 
-    return os;
+
+///
+/// @brief Append the record of a device built directly by the platform enumerator
+///
+
+void enzyme::pci::Enumerator::record(const Device& device)
+{
+    Record r;
+    memset(&r, 0, sizeof(r));
+    r.location = device.location().to_i();
+    r.vendor = device.config().vendor();
+    r.device = device.config().device();
+    r.subvendor = device.config().subvendor();
+    r.subdevice = device.config().subdevice();
+    r.classid = device.config().classid();
+    r.node = static_cast<int16_t>(device.node());
+    r.service = service(device.service());
+
+    for(unsigned int bar = 0; bar < Record::Bars; bar++)
+    {
+        if(device.bar(bar))
+            setbar(r, bar, device.bar(bar)->base(), device.bar(bar)->size(), (device.bar(bar)->flag() & 0x08) ? Record::BarPrefetch : 0);
+        else if(device.iobar(bar))
+            setbar(r, bar, device.iobar(bar)->base(), device.iobar(bar)->size(), Record::BarIO);
+    }
+    mRecord.push_back(r);
 }
 
 
@@ -58,7 +179,7 @@ std::ostream& enzyme::pci::Vendor::lex(std::ostream& os) const
 std::list<enzyme::pci::Device*> enzyme::pci::Enumerator::device(const Config& config)
 {
     std::list<enzyme::pci::Device*> result;
-    std::list<enzyme::pci::Device>::iterator i;
+    std::pmr::list<enzyme::pci::Device>::iterator i;
     for(i = device().begin(); i != device().end(); i++)
     {
         //TODO
@@ -74,7 +195,20 @@ std::list<enzyme::pci::Device*> enzyme::pci::Enumerator::device(const Config& co
 
 enzyme::pci::Device* enzyme::pci::Enumerator::device(const Location& location)
 {
-    std::list<enzyme::pci::Device>::iterator i;
+    std::pmr::list<enzyme::pci::Device>::iterator i;
+    for(i = device().begin(); i != device().end(); i++)
+    {
+        if(location == i->location())
+            return &*i;
+    }
+
+    throw std::runtime_error("Device not found");
+}
+
+
+const enzyme::pci::Device* enzyme::pci::Enumerator::device(const Location& location) const
+{
+    std::pmr::list<enzyme::pci::Device>::const_iterator i;
     for(i = device().begin(); i != device().end(); i++)
     {
         if(location == i->location())
@@ -85,11 +219,148 @@ enzyme::pci::Device* enzyme::pci::Enumerator::device(const Location& location)
 }
 
 
+///
+/// @brief Index the memory and I/O resources of all devices by address
+///
+
+void enzyme::pci::Enumerator::index()
+{
+    mMemIndex.clear();
+    mPortIndex.clear();
+
+    std::pmr::list<enzyme::pci::Device>::const_iterator i;
+    for(i = mDevice.begin(); i != mDevice.end(); i++)
+    {
+        std::pmr::set<const mem::Resource*>::const_iterator mi;
+        for(mi = i->mem().begin(); mi != i->mem().end(); mi++)
+            mMemIndex.insert(*mi, &*i);
+
+        std::pmr::set<const port::Resource*>::const_iterator pi;
+        for(pi = i->port().begin(); pi != i->port().end(); pi++)
+            mPortIndex.insert(*pi, &*i);
+    }
+
+    mMemIndex.build();
+    mPortIndex.build();
+}
+
+
 // ---------------------------------------------------------------------------
 
 
 ///
-/// @brief Detect and map MMR and PMR BARs
+/// @brief Device with no resources, allocating from the enumerator's resource
+///
+
+enzyme::pci::Device::Device(const Enumerator& enumerator, const Location& location, const Config& config)
+    : enzyme::Device(mLocation, mConfig, mVendor, mVendor)
+    , mEnumerator(enumerator)
+    , mLocation(location)
+    , mConfig(config)
+    , mVendor(config.vendor())
+    , mMemResource(enumerator.resource())
+    , mPortResource(enumerator.resource())
+    , mMemOwner(enumerator.resource())
+    , mPortOwner(enumerator.resource())
+    , mNode(-1)
+{
+    std::fill(mMemBar, mMemBar + Bars, static_cast<const mem::Resource*>(NULL));
+    std::fill(mPortBar, mPortBar + Bars, static_cast<const port::Resource*>(NULL));
+}
+
+
+///
+/// @brief Copy a device onto the default resource, so that it may outlive the enumerator
+///
+
+enzyme::pci::Device::Device(const Device& other)
+    : enzyme::Device(mLocation, mConfig, mVendor, mVendor)
+    , mEnumerator(other.mEnumerator)
+    , mLocation(other.mLocation)
+    , mConfig(other.mConfig)
+    , mVendor(other.mVendor)
+    , mMemResource(other.mMemResource)
+    , mPortResource(other.mPortResource)
+    , mMemOwner(other.mMemOwner)
+    , mPortOwner(other.mPortOwner)
+    , mNode(other.mNode)
+    , mLocalCPU(other.mLocalCPU)
+{
+    mService = other.mService;
+    std::copy(other.mMemBar, other.mMemBar + Bars, mMemBar);
+    std::copy(other.mPortBar, other.mPortBar + Bars, mPortBar);
+}
+
+
+///
+/// @brief Move a device into the enumerator list; containers keep their resource
+///
+
+enzyme::pci::Device::Device(Device&& other)
+    : enzyme::Device(mLocation, mConfig, mVendor, mVendor)
+    , mEnumerator(other.mEnumerator)
+    , mLocation(other.mLocation)
+    , mConfig(other.mConfig)
+    , mVendor(other.mVendor)
+    , mMemResource(std::move(other.mMemResource))
+    , mPortResource(std::move(other.mPortResource))
+    , mMemOwner(std::move(other.mMemOwner))
+    , mPortOwner(std::move(other.mPortOwner))
+    , mNode(other.mNode)
+    , mLocalCPU(std::move(other.mLocalCPU))
+{
+    mService.swap(other.mService);
+    std::copy(other.mMemBar, other.mMemBar + Bars, mMemBar);
+    std::copy(other.mPortBar, other.mPortBar + Bars, mPortBar);
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+///
+/// @brief Take ownership of a memory resource, optionally decoded by a BAR
+///
+
+void enzyme::pci::Device::add(const std::shared_ptr<const mem::Resource>& resource, int bar)
+{
+    mMemOwner.push_back(resource);
+    mMemResource.insert(resource.get());
+    if((bar >= 0) && (bar < Bars))
+        mMemBar[bar] = resource.get();
+}
+
+
+///
+/// @brief Take ownership of an I/O resource, optionally decoded by a BAR
+///
+
+void enzyme::pci::Device::add(const std::shared_ptr<const port::Resource>& resource, int bar)
+{
+    mPortOwner.push_back(resource);
+    mPortResource.insert(resource.get());
+    if((bar >= 0) && (bar < Bars))
+        mPortBar[bar] = resource.get();
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+namespace enzyme
+{
+    namespace pci
+    {
+        static bool isregbar(const mem::Resource& r, unsigned int index)
+        {
+            return !(r.flag() & 0x8) && (r.size() > 0) && (r.size() < 1 * 1024 * 1024);
+        }
+    };
+};
+
+
+///
+/// @brief Select default MMR and PMR BARs; nothing is mapped until first access
 ///
 
 enzyme::pci::Client::Client(const Device& device, bool writable, bool exclusive)
@@ -97,27 +368,27 @@ enzyme::pci::Client::Client(const Device& device, bool writable, bool exclusive)
 {
     mImpl = new os::Client(reinterpret_cast<const os::Device&>(device), writable, exclusive);
 
-    // Detect MMR BAR: Not prefetchable and under 1MB
-    std::set<const mem::Resource*>::const_iterator mi;
-    for(mi = device.mem().begin(); mi != device.mem().end(); mi++)
+    unsigned int i, j;
+    for(i = 0; i <= Device::Bars; i++)
     {
-        if(!((*mi)->flag() & 0x8) && ((*mi)->size() > 0) && ((*mi)->size() < 1 * 1024 * 1024))
-            break;
+        mMap[i].resource = (i < Device::Bars) ? device.bar(i) : &mem::dummy::gResource;
+        mMap[i].cache = mem::UC;
+        for(j = 0; j < 4; j++)
+            mMap[i].view[j].store(NULL, std::memory_order_relaxed);
+
+        mPortMap[i].resource = (i < Device::Bars) ? device.iobar(i) : &port::dummy::gResource;
+        for(j = 0; j < 3; j++)
+            mPortMap[i].view[j].store(NULL, std::memory_order_relaxed);
     }
 
-    if(mi != device.mem().end())
-        mMMReg32 = new mem::Client<uint32_t>(**mi);
-    else
-        mMMReg32 = new mem::Client<uint32_t>(mem::dummy::gResource);
-
-        mMMReg16 = new mem::Client<uint16_t>(*mMMReg32);
-        mMMReg8 = new mem::Client<uint8_t>(*mMMReg32);
+    // Detect MMR BAR: Not prefetchable and under 1MB
+    mMMIndex = find(isregbar);
 
     // Detect PMR BAR: First I/O BAR of at least 1KB
-    std::set<const port::Resource*>::const_iterator pi;
-    for(pi = device.port().begin(); pi != device.port().end(); pi++)
+    for(mPMIndex = 0; mPMIndex < Device::Bars; mPMIndex++)
     {
-        if((*pi)->size() >= 1024)
+        const port::Resource* r = device.iobar(mPMIndex);
+        if(r && (r->size() >= 1024))
             break;
     }
 }
@@ -129,14 +400,76 @@ enzyme::pci::Client::Client(const Device& device, bool writable, bool exclusive)
 
 enzyme::pci::Client::~Client()
 {
-    delete mMMReg32;
-    delete mMMReg16;
-    delete mMMReg8;
+    for(unsigned int i = 0; i <= Device::Bars; i++)
+    {
+        // Width views first; the byte view owns the mapping
+        delete static_cast<mem::Client<uint64_t>*>(mMap[i].view[3].load());
+        delete static_cast<mem::Client<uint32_t>*>(mMap[i].view[2].load());
+        delete static_cast<mem::Client<uint16_t>*>(mMap[i].view[1].load());
+        delete static_cast<mem::Client<uint8_t>*>(mMap[i].view[0].load());
+
+        delete static_cast<port::Client<uint32_t>*>(mPortMap[i].view[2].load());
+        delete static_cast<port::Client<uint16_t>*>(mPortMap[i].view[1].load());
+        delete static_cast<port::Client<uint8_t>*>(mPortMap[i].view[0].load());
+    }
 
     delete mImpl;
 }
 
 
+enzyme::pci::Client::Map& enzyme::pci::Client::slot(unsigned int index) const
+{
+    if(index > Device::Bars)
+        throw std::logic_error("PCI BAR: Index out of range");
+    if(!mMap[index].resource)
+        throw std::runtime_error("PCI BAR: Not a memory BAR");
+    return mMap[index];
+}
+
+
+enzyme::pci::Client::PortMap& enzyme::pci::Client::portslot(unsigned int index) const
+{
+    if(index > Device::Bars)
+        throw std::logic_error("PCI BAR: Index out of range");
+    if(!mPortMap[index].resource)
+        throw std::runtime_error("PCI BAR: Not an I/O BAR");
+    return mPortMap[index];
+}
+
+
+enzyme::mem::Client<uint8_t>* enzyme::pci::Client::mapbase(Map& m) const
+{
+    ENZYME_PERF_OPERATION("pci.map");
+
+    mem::Client<uint8_t>* base = new mem::Client<uint8_t>(*m.resource, m.cache);
+    m.view[0].store(base, std::memory_order_release);
+    return base;
+}
+
+
+///
+/// @brief Set the cache type of a memory BAR that has not yet been mapped
+///
+
+void enzyme::pci::Client::map(unsigned int index, mem::Cache cache)
+{
+    if(index >= Device::Bars)
+        throw std::logic_error("PCI BAR: Index out of range");
+
+    Map& m = slot(index);
+    std::lock_guard<std::mutex> lock(mLock);
+    if(m.view[0].load(std::memory_order_relaxed) && (m.cache != cache))
+        throw std::logic_error("PCI BAR: Already mapped with another cache type");
+    m.cache = cache;
+}
+
+
+bool enzyme::pci::Client::mapped(unsigned int index) const
+{
+    return (index <= Device::Bars) && (mMap[index].view[0].load(std::memory_order_acquire) != NULL);
+}
+
+
 ///
 /// @brief Read a range from PCI configuration space
 ///
@@ -146,7 +479,9 @@ void enzyme::pci::Client::cfgr(size_t offset, size_t len, void* dst)
     if(len > 4096)
         throw std::logic_error("PCI configuration space: Length out of range");
 
+    ENZYME_PERF_OPERATION("pci.cfgr");
     mImpl->cfgr(offset, len, dst);
+    ENZYME_TRACE_ACCESS(trace::Config, static_cast<unsigned int>(mDevice.location().to_i()), offset, dst, len, false);
 }
 
 
@@ -159,5 +494,7 @@ void enzyme::pci::Client::cfgw(size_t offset, size_t len, const void* src)
     if(len > 4096)
         throw std::logic_error("PCI configuration space: Length out of range");
 
+    ENZYME_PERF_OPERATION("pci.cfgw");
     mImpl->cfgw(offset, len, src);
+    ENZYME_TRACE_ACCESS(trace::Config, static_cast<unsigned int>(mDevice.location().to_i()), offset, src, len, true);
 }
@@ -14,12 +14,21 @@
 
 
 #include "enzyme.h"
+#include "enzyme_arena.h"
+#include "enzyme_cpu.h"
+#include "enzyme_index.h"
 #include "enzyme_mem.h"
 #include "enzyme_port.h"
 
+#include <atomic>
+#include <functional>
 #include <iomanip>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <type_traits>
+#include <vector>
 
 #if _MSC_VER >= 1600
 #include <unordered_map>
@@ -74,6 +83,14 @@ namespace enzyme
             {
             }
 
+            /// @brief Location from its to_i() value
+            static Location from_i(unsigned int value)
+            {
+                Location loc;
+                loc.mAll = value;
+                return loc;
+            }
+
             bool operator<(const Location& other) const
             {
                 return (to_i() < other.to_i());
@@ -160,7 +177,6 @@ namespace enzyme
         class Vendor : public AutoLex
         {
         private:
-            static std::tr1::unordered_map<unsigned short, const char*> mVendorID;
             unsigned short mVendor;
 
         public:
@@ -169,6 +185,105 @@ namespace enzyme
         };
 
 
+        ///
+        /// @brief Compact record of one PCI function
+        ///
+        /// Plain data, 80 bytes, and all that an enumerator keeps resident per
+        /// function. Lexers and Device objects are created from it on demand.
+        ///
+
+        typedef struct
+        {
+            enum { Bars = 6 };
+            enum { BarIO = 0x01, BarPrefetch = 0x02 };
+
+            uint64_t base[Bars];
+            uint32_t location;          // Location::to_i()
+            uint32_t classid;
+            uint16_t vendor;
+            uint16_t device;
+            uint16_t subvendor;
+            uint16_t subdevice;
+            int16_t node;               // -1 if unknown
+            uint16_t service;           // Driver name in the enumerator's pool
+            uint8_t size[Bars];         // log2 of the BAR size; 0 if the BAR is unused
+            uint8_t flag[Bars];
+        }
+        Record;
+
+        static_assert(sizeof(Record) <= 80, "pci::Record must stay within 80 bytes per function");
+
+        inline Location location(const Record& r) { return Location::from_i(r.location); }
+        inline Config config(const Record& r) { return Config(r.vendor, r.device, r.subvendor, r.subdevice, r.classid); }
+        inline Vendor vendor(const Record& r) { return Vendor(r.vendor); }
+
+        inline uint64_t barsize(const Record& r, unsigned int bar)
+        {
+            return (bar < Record::Bars && r.size[bar]) ? (uint64_t)1 << r.size[bar] : 0;
+        }
+
+        /// @brief Set a BAR; PCI BAR sizes are powers of two
+        void setbar(Record& r, unsigned int bar, uint64_t base, uint64_t size, uint8_t flag);
+
+
+        ///
+        /// @brief Selects the functions an enumerator keeps
+        ///
+        /// Tests are applied from the cheapest attribute to the dearest, so
+        /// that a rejected function costs as little as possible: the location
+        /// (known from the directory name alone), then the vendor, device and
+        /// class IDs (one small file each), then a predicate on the complete
+        /// record. An ID test matches when (id & mask) == (value & mask); a
+        /// default Filter matches everything. The setters are named for the
+        /// attribute and the tests accepts_<attribute>.
+        ///
+        /// Without Sysfs, the class is read from configuration space; where
+        /// that cannot be read, the class is unknown (0) and is not tested.
+        ///
+
+        class Filter
+        {
+        private:
+            uint16_t mVendor, mVendorMask;
+            uint16_t mDevice, mDeviceMask;
+            uint32_t mClass, mClassMask;
+
+            std::function<bool(const Location&)> mLocation;
+            std::function<bool(const Record&)> mRecord;
+
+        public:
+            Filter()
+                : mVendor(0), mVendorMask(0)
+                , mDevice(0), mDeviceMask(0)
+                , mClass(0), mClassMask(0)
+            {
+            }
+
+            Filter& vendor(uint16_t id, uint16_t mask = 0xFFFF)     { mVendor = id; mVendorMask = mask; return *this; }
+            Filter& device(uint16_t id, uint16_t mask = 0xFFFF)     { mDevice = id; mDeviceMask = mask; return *this; }
+
+            /// @brief Class code as in the class file, e.g. 0x020000 with mask 0xFF0000 for network controllers
+            Filter& classid(uint32_t id, uint32_t mask = 0xFFFFFF)  { mClass = id; mClassMask = mask; return *this; }
+
+            Filter& location(const std::function<bool(const Location&)>& f) { mLocation = f; return *this; }
+            Filter& where(const std::function<bool(const Record&)>& f)      { mRecord = f; return *this; }
+
+            bool accepts_location(const Location& loc)  const { return !mLocation || mLocation(loc); }
+            bool accepts_vendor(uint16_t id)            const { return ((id ^ mVendor) & mVendorMask) == 0; }
+            bool accepts_device(uint16_t id)            const { return ((id ^ mDevice) & mDeviceMask) == 0; }
+            bool accepts_class(uint32_t id)             const { return ((id ^ mClass) & mClassMask) == 0; }
+
+            /// @brief Only the predicate on the complete record
+            bool accepts_record(const Record& r)        const { return !mRecord || mRecord(r); }
+
+            /// @brief Every test, for platforms that learn all attributes at once
+            bool accepts(const Record& r) const
+            {
+                return accepts_location(pci::location(r)) && accepts_vendor(r.vendor) && accepts_device(r.device) && accepts_class(r.classid) && accepts_record(r);
+            }
+        };
+
+
         ///
         /// @brief PCI device
         ///
@@ -177,31 +292,60 @@ namespace enzyme
 
         class Device : public enzyme::Device
         {
+        public:
+            enum { Bars = 6 };
+
         protected:
             const Enumerator& mEnumerator;
             const Location mLocation;
             const Config mConfig;
             const Vendor mVendor;
 
-            std::set<const mem::Resource*> mMemResource;
-            std::set<const port::Resource*> mPortResource;
+            // Carved from the enumerator's resource; copies use the default resource
+            std::pmr::set<const mem::Resource*> mMemResource;
+            std::pmr::set<const port::Resource*> mPortResource;
+
+            // Shared, so that copies of the device keep them beyond the enumerator
+            std::pmr::vector<std::shared_ptr<const mem::Resource> > mMemOwner;
+            std::pmr::vector<std::shared_ptr<const port::Resource> > mPortOwner;
+
+            const mem::Resource* mMemBar[Bars];
+            const port::Resource* mPortBar[Bars];
+
+            int mNode;
+            cpu::Set mLocalCPU;
+
+            void add(const std::shared_ptr<const mem::Resource>& resource, int bar = -1);
+            void add(const std::shared_ptr<const port::Resource>& resource, int bar = -1);
 
         public:
-            Device(const Enumerator& enumerator, const Location& location, const Config& config)
-                : enzyme::Device(location, config, mVendor, mVendor)
-                , mEnumerator(enumerator)
-                , mLocation(location)
-                , mConfig(config)
-                , mVendor(config.vendor())
-            {
-            }
+            Device(const Enumerator& enumerator, const Location& location, const Config& config);
+            Device(const Device& other);
+            Device(Device&& other);
 
             const Enumerator& enumerator()  const { return mEnumerator; }
             const Location& location()      const { return mLocation; }
             const Config& config()          const { return mConfig; }
 
-            const std::set<const mem::Resource*>& mem()   const  { return mMemResource; }
-            const std::set<const port::Resource*>& port() const  { return mPortResource; }
+            const std::pmr::set<const mem::Resource*>& mem()   const  { return mMemResource; }
+            const std::pmr::set<const port::Resource*>& port() const  { return mPortResource; }
+
+            ///
+            /// @brief Memory or I/O resource decoded by a base address register; NULL if none
+            ///
+            /// On Windows, BAR numbers are found by matching each resource against
+            /// configuration space, which needs the kernel service; without it,
+            /// resources of each type are numbered in the order they were reported.
+            ///
+
+            const mem::Resource* bar(unsigned int index)    const { return (index < Bars) ? mMemBar[index] : NULL; }
+            const port::Resource* iobar(unsigned int index) const { return (index < Bars) ? mPortBar[index] : NULL; }
+
+            /// @brief NUMA node the device is attached to; -1 if unknown
+            int node() const { return mNode; }
+
+            /// @brief Processors local to the device; empty if unknown
+            const cpu::Set& localcpu() const { return mLocalCPU; }
 
             bool operator<(const Device& other) const
             {
@@ -213,6 +357,11 @@ namespace enzyme
         ///
         /// @brief Interface to abstract (real or emulated) PCI device
         ///
+        /// BARs are mapped lazily: map() only records the cache type to use for a
+        /// BAR, and the mapping is made on first access through bar<T>(), so a
+        /// client that touches only configuration space never maps anything. Each
+        /// BAR is mapped once; accessors of other widths are views of that mapping.
+        ///
 
         class Client
         {
@@ -220,13 +369,42 @@ namespace enzyme
             os::Client* mImpl;
             const pci::Device& mDevice;
 
-            mem::Client<uint32_t>*  mMMReg32;
-            mem::Client<uint16_t>*  mMMReg16;
-            mem::Client<uint8_t>*   mMMReg8;
+            /// @brief Mapping state of one BAR; slot Bars stands in for an absent BAR
+            typedef struct
+            {
+                const mem::Resource* resource;
+                mem::Cache cache;
+                std::atomic<void*> view[4];         // mem::Client<uint8_t/16/32/64>
+            }
+            Map;
+
+            typedef struct
+            {
+                const port::Resource* resource;
+                std::atomic<void*> view[3];         // port::Client<uint8_t/16/32>
+            }
+            PortMap;
+
+            mutable std::mutex mLock;
+            mutable Map mMap[Device::Bars + 1];
+            mutable PortMap mPortMap[Device::Bars + 1];
+
+            unsigned int mMMIndex;
+            unsigned int mPMIndex;
 
-            port::Client<uint32_t>* mPMReg32;
-            port::Client<uint16_t>* mPMReg16;
-            port::Client<uint8_t>*  mPMReg8;
+            Client(const Client&);
+            Client& operator=(const Client&);
+
+            template<typename T> static unsigned int width()
+            {
+                return (sizeof(T) == 1) ? 0 : (sizeof(T) == 2) ? 1 : (sizeof(T) == 4) ? 2 : 3;
+            }
+
+            Map& slot(unsigned int index) const;
+            PortMap& portslot(unsigned int index) const;
+
+            // Map a BAR as bytes; called with mLock held
+            mem::Client<uint8_t>* mapbase(Map& m) const;
 
         public:
             Client(const Device& dev, bool writable = true, bool exclusive = false);
@@ -234,15 +412,94 @@ namespace enzyme
 
             const Device& device() const { return mDevice; }
 
-            /// @brief Memory Mapped Register I/O
-            const mem::Client<uint32_t>&  mmreg32() const { return *mMMReg32; }
-            const mem::Client<uint16_t>&  mmreg16() const { return *mMMReg16; }
-            const mem::Client<uint8_t>&   mmreg8()  const { return *mMMReg8; }
+            /// @brief Set the cache type for a memory BAR; takes effect when it is first accessed
+            void map(unsigned int index, mem::Cache cache = mem::UC);
+
+            ///
+            /// @brief Set the cache type for every memory BAR for which pred(resource, index) holds
+            ///
+            /// Returns the number of BARs selected. Integral arguments select the
+            /// overload by index instead.
+            ///
 
-            /// @brief Port Mapped Register I/O
-            const port::Client<uint32_t>& pmreg32() const { return *mPMReg32; }
-            const port::Client<uint16_t>& pmreg16() const { return *mPMReg16; }
-            const port::Client<uint8_t>&  pmreg8()  const { return *mPMReg8; }
+            template<typename P> typename std::enable_if<!std::is_integral<P>::value, unsigned int>::type map(P pred, mem::Cache cache = mem::UC)
+            {
+                unsigned int cnt = 0;
+                for(unsigned int i = 0; i < Device::Bars; i++)
+                {
+                    const mem::Resource* r = mDevice.bar(i);
+                    if(r && pred(*r, i))
+                    {
+                        map(i, cache);
+                        cnt++;
+                    }
+                }
+                return cnt;
+            }
+
+            /// @brief Index of the first memory BAR for which pred(resource, index) holds, or Device::Bars
+            template<typename P> unsigned int find(P pred) const
+            {
+                for(unsigned int i = 0; i < Device::Bars; i++)
+                {
+                    const mem::Resource* r = mDevice.bar(i);
+                    if(r && pred(*r, i))
+                        return i;
+                }
+                return Device::Bars;
+            }
+
+            /// @brief True once a BAR has been mapped by a first access
+            bool mapped(unsigned int index) const;
+
+            /// @brief Memory BAR accessor; maps the BAR on first use
+            template<typename T> const mem::Client<T>& bar(unsigned int index) const
+            {
+                Map& m = slot(index);
+                void* v = m.view[width<T>()].load(std::memory_order_acquire);
+                if(v)
+                    return *static_cast<mem::Client<T>*>(v);
+
+                std::lock_guard<std::mutex> lock(mLock);
+                v = m.view[width<T>()].load(std::memory_order_relaxed);
+                if(!v)
+                {
+                    mem::Client<uint8_t>* base = static_cast<mem::Client<uint8_t>*>(m.view[0].load(std::memory_order_relaxed));
+                    if(!base)
+                        base = mapbase(m);
+                    v = (width<T>() == 0) ? static_cast<void*>(base) : static_cast<void*>(new mem::Client<T>(*base, base->cache()));
+                    m.view[width<T>()].store(v, std::memory_order_release);
+                }
+                return *static_cast<mem::Client<T>*>(v);
+            }
+
+            /// @brief I/O BAR accessor; opened on first use
+            template<typename T> const port::Client<T>& iobar(unsigned int index) const
+            {
+                PortMap& m = portslot(index);
+                void* v = m.view[width<T>()].load(std::memory_order_acquire);
+                if(v)
+                    return *static_cast<port::Client<T>*>(v);
+
+                std::lock_guard<std::mutex> lock(mLock);
+                v = m.view[width<T>()].load(std::memory_order_relaxed);
+                if(!v)
+                {
+                    v = new port::Client<T>(*m.resource);
+                    m.view[width<T>()].store(v, std::memory_order_release);
+                }
+                return *static_cast<port::Client<T>*>(v);
+            }
+
+            /// @brief Memory Mapped Register I/O: first non-prefetchable memory BAR under 1MB
+            const mem::Client<uint32_t>&  mmreg32() const { return bar<uint32_t>(mMMIndex); }
+            const mem::Client<uint16_t>&  mmreg16() const { return bar<uint16_t>(mMMIndex); }
+            const mem::Client<uint8_t>&   mmreg8()  const { return bar<uint8_t>(mMMIndex); }
+
+            /// @brief Port Mapped Register I/O: first I/O BAR of at least 1KB
+            const port::Client<uint32_t>& pmreg32() const { return iobar<uint32_t>(mPMIndex); }
+            const port::Client<uint16_t>& pmreg16() const { return iobar<uint16_t>(mPMIndex); }
+            const port::Client<uint8_t>&  pmreg8()  const { return iobar<uint8_t>(mPMIndex); }
 
             /// @brief PCI Config I/O
             void cfgr(size_t offset, size_t len, void* dst);
@@ -261,16 +518,80 @@ namespace enzyme
         ///
         /// @brief PCI bus enumerator
         ///
+        /// Enumeration produces one compact Record per function, sorted by
+        /// location. Device objects, which hold the resources, lexers and
+        /// indices needed to open a Client, are built from the records on the
+        /// first call to device(), once, from any thread.
+        ///
+        /// Records, devices and the containers of each device are allocated
+        /// from the given memory resource, or by default from an arena owned
+        /// by the enumerator and released with it in one step.
+        ///
 
         class Enumerator : public enzyme::Node
         {
         protected:
-            std::list<Device> mDevice;
+            Arena mArena;
+            std::pmr::memory_resource* mResource;
+            Intern mService;
+            std::pmr::vector<Record> mRecord;
+            std::pmr::list<Device> mDevice;
+            std::once_flag mDeviceOnce;
+
+            mem::Index mMemIndex;
+            port::Index mPortIndex;
+
+            void index();
+
+            /// @brief Build mDevice from mRecord; platforms that enumerate devices directly need not
+            virtual void materialize() { }
+
+            /// @brief Append the record of a device built directly
+            void record(const Device& device);
+
+            uint16_t service(const std::string& name) { return static_cast<uint16_t>(mService.index(name)); }
 
         public:
-            Device* device(const Location& location);
+            explicit Enumerator(std::pmr::memory_resource* resource = NULL)
+                : mResource(resource ? resource : &mArena)
+                , mService(mResource)
+                , mRecord(mResource)
+                , mDevice(mResource)
+            {
+                mService.index(std::string());
+            }
+
+            /// @brief One record per function, sorted by location
+            const std::pmr::vector<Record>& record() const { return mRecord; }
 
-            std::list<Device>& device() { return mDevice; }
+            /// @brief Record at a location; NULL if none
+            const Record* record(const Location& location) const;
+
+            /// @brief Driver bound to a function; empty if none
+            const StringLex& service(const Record& record) const { return mService[record.service]; }
+
+            std::pmr::memory_resource* resource() const { return mResource; }
+
+            /// @brief Default arena; empty if the enumerator was given a resource
+            const Arena& arena() const { return mArena; }
+
+            Device* device(const Location& location);
+            const Device* device(const Location& location) const;
+
+            /// @brief Resource address index; resolves addresses to the owning device
+            const mem::Index& memindex()   const { device(); return mMemIndex; }
+            const port::Index& portindex() const { device(); return mPortIndex; }
+
+            ///
+            /// @brief Devices, built from the records on first access
+            ///
+            /// Building is the only change a const enumerator undergoes; it
+            /// happens once, under a once flag, so const access from any
+            /// number of threads (as through a published Snapshot) is safe.
+            ///
+
+            std::pmr::list<Device>& device();
+            const std::pmr::list<Device>& device() const;
 //            std::list<Device*> device(const Location& location);
             std::list<Device*> device(const Config& config);
         };
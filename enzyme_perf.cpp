@@ -0,0 +1,281 @@
+///
+/// @file    enzyme_perf.cpp
+/// @brief   Enzyme Hardware Abstraction Layer: Performance Counter Scopes
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#include "enzyme_perf.h"
+#include "enzyme_corelocal.h"
+
+#include <cstring>
+#include <mutex>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+// ---------------------------------------------------------------------------
+
+
+namespace enzyme
+{
+    namespace perf
+    {
+        static std::mutex gSiteLock;
+        static Site* gSite = NULL;
+
+        static const char* gName[Counters] =
+        {
+            "cycles", "instructions", "cache_misses", "page_faults", "task_clock_ns"
+        };
+
+
+        ///
+        /// @brief Per-thread perf_event group
+        ///
+
+        class Group
+        {
+        private:
+            int mFD[Counters];
+            int mLeader;
+            unsigned int mSlot[Counters];       // Position in the group read
+            unsigned int mSlots;
+            uint32_t mAvailable;
+
+            Group(const Group&);
+            Group& operator=(const Group&);
+
+#ifdef __linux__
+            static int open(uint32_t type, uint64_t config, int leader)
+            {
+                struct perf_event_attr attr;
+                memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = type;
+                attr.config = config;
+                attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                attr.exclude_hv = 1;
+
+                // Count kernel time where allowed, else user time only
+                int fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0));
+                if(fd < 0)
+                {
+                    attr.exclude_kernel = 1;
+                    fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0));
+                }
+                return fd;
+            }
+
+            void add(Counter c, uint32_t type, uint64_t config)
+            {
+                int fd = open(type, config, mLeader);
+                if(fd < 0)
+                    return;
+                if(mLeader < 0)
+                    mLeader = fd;
+                mFD[c] = fd;
+                mSlot[c] = mSlots++;
+                mAvailable |= (uint32_t)1 << c;
+            }
+#endif
+
+        public:
+            Group()
+                : mLeader(-1)
+                , mSlots(0)
+                , mAvailable(0)
+            {
+                for(int c = 0; c < Counters; c++)
+                    mFD[c] = -1;
+
+#ifdef __linux__
+                // Hardware events first, so that one of them leads the group if the PMU is usable
+                add(Cycles, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+                add(Instructions, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+                add(CacheMisses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+                add(TaskClock, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+                add(PageFaults, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+#endif
+            }
+
+            ~Group()
+            {
+#ifdef __linux__
+                for(int c = 0; c < Counters; c++)
+                {
+                    if(mFD[c] >= 0)
+                        close(mFD[c]);
+                }
+#endif
+            }
+
+            uint32_t available() const { return mAvailable; }
+
+
+            ///
+            /// @brief Read all counters with one read(), scaled for multiplexing
+            ///
+
+            void read(uint64_t* value) const
+            {
+                memset(value, 0, sizeof(uint64_t) * Counters);
+#ifdef __linux__
+                if(mLeader < 0)
+                    return;
+
+                uint64_t buf[3 + Counters];
+                if(::read(mLeader, buf, sizeof(buf)) < static_cast<ssize_t>(sizeof(uint64_t) * (3 + mSlots)))
+                    return;
+
+                uint64_t enabled = buf[1];
+                uint64_t running = buf[2];
+                for(int c = 0; c < Counters; c++)
+                {
+                    if(!((mAvailable >> c) & 1))
+                        continue;
+                    uint64_t v = buf[3 + mSlot[c]];
+                    if(running && (running < enabled))
+                        v = static_cast<uint64_t>(static_cast<double>(v) * enabled / running);
+                    value[c] = v;
+                }
+#endif
+            }
+        };
+
+
+        static Group& group()
+        {
+            thread_local Group g;
+            return g;
+        }
+    };
+};
+
+
+// ---------------------------------------------------------------------------
+
+
+const char* enzyme::perf::name(Counter c)
+{
+    return (c < Counters) ? gName[c] : "unknown";
+}
+
+
+bool enzyme::perf::available(Counter c)
+{
+    return (group().available() >> c) & 1;
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+///
+/// @brief Register a named scope
+///
+
+enzyme::perf::Site::Site(const char* name)
+    : mName(name)
+    , mCounts(new cpu::CoreLocal<Counts>)
+{
+    std::lock_guard<std::mutex> lock(gSiteLock);
+    mNext = gSite;
+    gSite = this;
+}
+
+
+enzyme::perf::Site::~Site()
+{
+    delete mCounts;
+}
+
+
+///
+/// @brief Add one scope to the counters of the calling core
+///
+
+void enzyme::perf::Site::record(const uint64_t* delta, uint32_t available)
+{
+    Counts& s = mCounts->local();
+    s.count.fetch_add(1, std::memory_order_relaxed);
+    s.available.fetch_or(available, std::memory_order_relaxed);
+    for(int c = 0; c < Counters; c++)
+    {
+        if((available >> c) & 1)
+            s.value[c].fetch_add(delta[c], std::memory_order_relaxed);
+    }
+}
+
+
+uint64_t enzyme::perf::Site::count() const
+{
+    return mCounts->merge(uint64_t(0), [](uint64_t& acc, const Counts& s) { acc += s.count.load(std::memory_order_relaxed); });
+}
+
+
+uint64_t enzyme::perf::Site::value(Counter c) const
+{
+    return mCounts->merge(uint64_t(0), [c](uint64_t& acc, const Counts& s) { acc += s.value[c].load(std::memory_order_relaxed); });
+}
+
+
+bool enzyme::perf::Site::available(Counter c) const
+{
+    uint32_t bits = mCounts->merge(uint32_t(0), [](uint32_t& acc, const Counts& s) { acc |= s.available.load(std::memory_order_relaxed); });
+    return (bits >> c) & 1;
+}
+
+
+std::ostream& enzyme::perf::Site::lex(std::ostream& os) const
+{
+    uint64_t cnt = count();
+    os << std::dec << name() << " count=" << cnt;
+    for(int c = 0; c < Counters; c++)
+    {
+        os << ' ' << gName[c] << '=';
+        if(available(static_cast<Counter>(c)))
+            os << value(static_cast<Counter>(c));
+        else
+            os << "n/a";
+    }
+    return os;
+}
+
+
+std::ostream& enzyme::perf::Site::report(std::ostream& os)
+{
+    std::lock_guard<std::mutex> lock(gSiteLock);
+    for(const Site* site = gSite; site; site = site->mNext)
+        site->lex(os) << std::endl;
+    return os;
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+enzyme::perf::Scope::Scope(Site& site)
+    : mSite(site)
+{
+    Group& g = group();
+    mAvailable = g.available();
+    g.read(mStart);
+}
+
+
+enzyme::perf::Scope::~Scope()
+{
+    uint64_t end[Counters];
+    group().read(end);
+    for(int c = 0; c < Counters; c++)
+        end[c] -= mStart[c];
+    mSite.record(end, mAvailable);
+}
@@ -0,0 +1,148 @@
+///
+/// @file    enzyme_perf.h
+/// @brief   Enzyme Hardware Abstraction Layer: Performance Counter Scopes
+///
+/// Library operations are instrumented only when ENZYME_PERF is defined;
+/// the Scope and Site classes are always available to callers.
+/// ENZYME_PERF_OPERATION is for library translation units only: in inline
+/// code it would give the same function different definitions in callers
+/// built with and without the macro.
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef _enzyme_perf_h_
+#define _enzyme_perf_h_
+
+
+#include "enzyme_type.h"
+
+#include <atomic>
+#include <ostream>
+
+
+namespace enzyme
+{
+    namespace cpu
+    {
+        template<typename T> class CoreLocal;
+    };
+
+    namespace perf
+    {
+
+        ///
+        /// @brief Counters read for each scope
+        ///
+        /// Cycles, instructions and cache misses need a hardware PMU; where
+        /// perf_event_open refuses them (typically in VMs) only the software
+        /// events are counted and the others are reported as unavailable.
+        ///
+
+        typedef enum
+        {
+            Cycles, Instructions, CacheMisses, PageFaults, TaskClock,
+            Counters
+        }
+        Counter;
+
+        const char* name(Counter c);
+
+        /// @brief Counters this thread's group could open
+        bool available(Counter c);
+
+
+        ///
+        /// @brief Totals for one named scope
+        ///
+        /// Sites register themselves on construction and are listed by
+        /// report(). Counts from multiplexed groups are scaled by the fraction
+        /// of time the group was running. Each core adds into its own cache
+        /// line (a cpu::CoreLocal, held by pointer as enzyme_corelocal.h
+        /// includes this header); the accessors sum over cores.
+        ///
+
+        class Site
+        {
+        private:
+            typedef struct
+            {
+                std::atomic<uint64_t> count;
+                std::atomic<uint64_t> value[Counters];
+                std::atomic<uint32_t> available;
+            }
+            Counts;
+
+            const char* mName;
+            Site* mNext;
+            cpu::CoreLocal<Counts>* mCounts;
+
+            Site(const Site&);
+            Site& operator=(const Site&);
+
+        public:
+            explicit Site(const char* name);
+            ~Site();
+
+            void record(const uint64_t* delta, uint32_t available);
+
+            const char* name()              const { return mName; }
+            uint64_t count()                const;
+            uint64_t value(Counter c)       const;
+            bool available(Counter c)       const;
+
+            std::ostream& lex(std::ostream& os) const;
+
+            /// @brief Print every registered site
+            static std::ostream& report(std::ostream& os);
+        };
+
+
+        ///
+        /// @brief Count events on the calling thread from construction to destruction
+        ///
+        /// The thread's counter group is opened on first use and read with a
+        /// single read() at each end of the scope. Scopes may nest.
+        ///
+
+        class Scope
+        {
+        private:
+            Site& mSite;
+            uint64_t mStart[Counters];
+            uint32_t mAvailable;
+
+            Scope(const Scope&);
+            Scope& operator=(const Scope&);
+
+        public:
+            explicit Scope(Site& site);
+            ~Scope();
+        };
+    };
+};
+
+
+#define ENZYME_PERF_CONCAT2(a, b)   a##b
+#define ENZYME_PERF_CONCAT(a, b)    ENZYME_PERF_CONCAT2(a, b)
+
+///
+/// @brief Count the rest of the enclosing block against a named site
+///
+
+#define ENZYME_PERF_SCOPE(name) \
+    static enzyme::perf::Site ENZYME_PERF_CONCAT(perfsite_, __LINE__)(name); \
+    enzyme::perf::Scope ENZYME_PERF_CONCAT(perfscope_, __LINE__)(ENZYME_PERF_CONCAT(perfsite_, __LINE__))
+
+#ifdef ENZYME_PERF
+#define ENZYME_PERF_OPERATION(name)     ENZYME_PERF_SCOPE(name)
+#else
+#define ENZYME_PERF_OPERATION(name)     ((void)0)
+#endif
+
+
+#endif  // _enzyme_perf_h_
@@ -0,0 +1,236 @@
+///
+/// @file    enzyme_poll.cpp
+/// @brief   Enzyme Hardware Abstraction Layer: Register Polling
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#include "enzyme_poll.h"
+#include "enzyme_cpu.h"
+
+#include <iomanip>
+#include <mutex>
+#include <thread>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+
+// ---------------------------------------------------------------------------
+
+
+namespace enzyme
+{
+    namespace mem
+    {
+        static std::mutex gSiteLock;
+        static PollSite* gSite = NULL;
+
+        namespace poll
+        {
+
+            ///
+            /// @brief Timed wait cycle budget per tpause/umwait (a few microseconds)
+            ///
+
+            static const uint64_t gWaitCycles = 8192;
+
+            static const bool gWaitPkg = cpu::has(cpu::WAITPKG);
+
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+            __attribute__((target("waitpkg"))) static void tpause(uint64_t deadline)
+            {
+                _tpause(0, deadline);
+            }
+
+            __attribute__((target("waitpkg"))) static void umwait(volatile const void* addr, uint64_t deadline)
+            {
+                _umonitor(const_cast<void*>(addr));
+                _umwait(0, deadline);
+            }
+#define ENZYME_WAITPKG
+#elif defined(_MSC_VER) && (_MSC_VER >= 1920)
+            static void tpause(uint64_t deadline)
+            {
+                _tpause(0, deadline);
+            }
+
+            static void umwait(volatile const void* addr, uint64_t deadline)
+            {
+                _umonitor(const_cast<void*>(addr));
+                _umwait(0, deadline);
+            }
+#define ENZYME_WAITPKG
+#endif
+        };
+    };
+};
+
+
+// ---------------------------------------------------------------------------
+
+
+bool enzyme::mem::poll::waitpkg()
+{
+#ifdef ENZYME_WAITPKG
+    return gWaitPkg;
+#else
+    return false;
+#endif
+}
+
+
+void enzyme::mem::poll::pause()
+{
+#if defined(_MSC_VER) || defined(__i386__) || defined(__x86_64__)
+    _mm_pause();
+#endif
+}
+
+
+///
+/// @brief One timed wait; monitor the register itself where device writes are snooped
+///
+
+void enzyme::mem::poll::wait(volatile const void* addr, bool monitor)
+{
+#ifdef ENZYME_WAITPKG
+    uint64_t deadline = tsc::read() + gWaitCycles;
+    if(monitor)
+        umwait(addr, deadline);
+    else
+        tpause(deadline);
+#else
+    pause();
+#endif
+}
+
+
+void enzyme::mem::poll::sleep(Clock::duration d)
+{
+    std::this_thread::sleep_for(d);
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+///
+/// @brief Register a poll call site
+///
+
+enzyme::mem::PollSite::PollSite(const char* file, unsigned int line)
+    : mFile(file)
+    , mLine(line)
+{
+    std::lock_guard<std::mutex> lock(gSiteLock);
+    mNext = gSite;
+    gSite = this;
+}
+
+
+///
+/// @brief Record one wait in the counters of the calling core
+///
+
+void enzyme::mem::PollSite::record(uint64_t ns, Phase phase)
+{
+    unsigned int b = 0;
+    while((b < Buckets - 1) && (ns >> b))
+        b++;
+
+    Counts& c = mCounts.local();
+    c.bucket[b].fetch_add(1, std::memory_order_relaxed);
+    c.phase[phase].fetch_add(1, std::memory_order_relaxed);
+    c.total.fetch_add(ns, std::memory_order_relaxed);
+
+    // The thread may have migrated since local(), so another core may share the slot
+    uint64_t prev = c.max.load(std::memory_order_relaxed);
+    while((ns > prev) && !c.max.compare_exchange_weak(prev, ns, std::memory_order_relaxed))
+        ;
+}
+
+
+uint64_t enzyme::mem::PollSite::bucket(unsigned int i) const
+{
+    return mCounts.merge(uint64_t(0), [i](uint64_t& acc, const Counts& c) { acc += c.bucket[i].load(std::memory_order_relaxed); });
+}
+
+
+uint64_t enzyme::mem::PollSite::phase(Phase p) const
+{
+    return mCounts.merge(uint64_t(0), [p](uint64_t& acc, const Counts& c) { acc += c.phase[p].load(std::memory_order_relaxed); });
+}
+
+
+uint64_t enzyme::mem::PollSite::total() const
+{
+    return mCounts.merge(uint64_t(0), [](uint64_t& acc, const Counts& c) { acc += c.total.load(std::memory_order_relaxed); });
+}
+
+
+uint64_t enzyme::mem::PollSite::max() const
+{
+    return mCounts.merge(uint64_t(0), [](uint64_t& acc, const Counts& c) { acc = std::max(acc, c.max.load(std::memory_order_relaxed)); });
+}
+
+
+uint64_t enzyme::mem::PollSite::count() const
+{
+    uint64_t cnt = 0;
+    for(unsigned int i = 0; i < Buckets; i++)
+        cnt += bucket(i);
+    return cnt;
+}
+
+
+uint64_t enzyme::mem::PollSite::percentile(double pct) const
+{
+    uint64_t cnt = count();
+    if(!cnt)
+        return 0;
+
+    uint64_t want = static_cast<uint64_t>(cnt * pct / 100.0);
+    uint64_t seen = 0;
+    for(unsigned int i = 0; i < Buckets; i++)
+    {
+        seen += bucket(i);
+        if(seen > want)
+            return (i ? (uint64_t)1 << i : 0);
+    }
+    return max();
+}
+
+
+std::ostream& enzyme::mem::PollSite::lex(std::ostream& os) const
+{
+    uint64_t cnt = count();
+    os << std::dec << file() << ':' << line()
+       << " polls=" << cnt
+       << " immediate=" << phase(Immediate)
+       << " spin=" << phase(Spin)
+       << " wait=" << phase(Wait)
+       << " sleep=" << phase(Sleep)
+       << " timeout=" << phase(Timeout)
+       << " mean_ns=" << (cnt ? total() / cnt : 0)
+       << " p50_ns<=" << percentile(50)
+       << " p99_ns<=" << percentile(99)
+       << " max_ns=" << max();
+    return os;
+}
+
+
+std::ostream& enzyme::mem::PollSite::report(std::ostream& os)
+{
+    std::lock_guard<std::mutex> lock(gSiteLock);
+    for(const PollSite* site = gSite; site; site = site->mNext)
+        site->lex(os) << std::endl;
+    return os;
+}
@@ -0,0 +1,194 @@
+///
+/// @file    enzyme_poll.h
+/// @brief   Enzyme Hardware Abstraction Layer: Register Polling
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef _enzyme_poll_h_
+#define _enzyme_poll_h_
+
+
+#include "enzyme.h"
+#include "enzyme_corelocal.h"
+#include "enzyme_mem.h"
+#include "enzyme_tsc.h"
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <type_traits>
+
+
+namespace enzyme
+{
+    namespace mem
+    {
+
+        ///
+        /// @brief Wait time histogram for one poll_until() call site
+        ///
+        /// Buckets are powers of two of nanoseconds. Sites register themselves
+        /// on construction and are listed by report(). Each core counts into
+        /// its own cache line, so concurrent pollers may share a site without
+        /// contending; the accessors sum over cores.
+        ///
+
+        class PollSite
+        {
+        public:
+            enum { Buckets = 40 };
+
+            typedef enum
+            {
+                Immediate, Spin, Wait, Sleep, Timeout, Phases
+            }
+            Phase;
+
+        private:
+            typedef struct
+            {
+                std::atomic<uint64_t> bucket[Buckets];
+                std::atomic<uint64_t> phase[Phases];
+                std::atomic<uint64_t> total;
+                std::atomic<uint64_t> max;
+            }
+            Counts;
+
+            const char* mFile;
+            unsigned int mLine;
+            PollSite* mNext;
+
+            cpu::CoreLocal<Counts> mCounts;
+
+            PollSite(const PollSite&);
+            PollSite& operator=(const PollSite&);
+
+        public:
+            PollSite(const char* file, unsigned int line);
+
+            void record(uint64_t ns, Phase phase);
+
+            const char* file()                  const { return mFile; }
+            unsigned int line()                 const { return mLine; }
+            uint64_t bucket(unsigned int i)     const;
+            uint64_t phase(Phase p)             const;
+            uint64_t total()                    const;
+            uint64_t max()                      const;
+            uint64_t count()                    const;
+
+            /// @brief Upper bound (ns) of the bucket holding the given percentile
+            uint64_t percentile(double pct) const;
+
+            std::ostream& lex(std::ostream& os) const;
+
+            /// @brief Print every registered site
+            static std::ostream& report(std::ostream& os);
+        };
+
+
+        namespace poll
+        {
+            typedef tsc::Clock Clock;
+
+            /// @brief Time spent spinning with pause before timed waits begin
+            const Clock::duration gSpin = std::chrono::microseconds(2);
+
+            /// @brief Time spent in tpause/umwait before falling back to sleeping
+            const Clock::duration gWait = std::chrono::microseconds(200);
+
+            template<typename T> volatile const void* address(const Client<T>& client, size_t offset)
+            {
+                return client.mVirt + offset;
+            }
+
+            bool waitpkg();
+            void pause();
+            void wait(volatile const void* addr, bool monitor);
+            void sleep(Clock::duration d);
+        };
+
+
+        ///
+        /// @brief Wait until (read(offset) & mask) == value, or until deadline
+        ///
+        /// Spins with pause for a few microseconds, then uses tpause (or
+        /// umonitor/umwait on WB mappings, where device writes are snooped) when
+        /// CPUID reports WAITPKG, and finally sleeps with exponential backoff.
+        /// Returns true if the condition was met. The wait time and the phase it
+        /// ended in are recorded in site, if given.
+        ///
+
+        template<typename T> bool poll_until(const Client<T>& client, size_t offset, typename std::common_type<T>::type mask, typename std::common_type<T>::type value, poll::Clock::time_point deadline, PollSite* site = NULL)
+        {
+            if((client.read(offset) & mask) == value)
+            {
+                if(site)
+                    site->record(0, PollSite::Immediate);
+                return true;
+            }
+
+            poll::Clock::time_point start = poll::Clock::now();
+            poll::Clock::time_point now = start;
+            PollSite::Phase phase = PollSite::Spin;
+            poll::Clock::duration backoff = std::chrono::microseconds(1);
+            bool waitpkg = poll::waitpkg();
+            bool met = false;
+
+            while(now < deadline)
+            {
+                if(phase == PollSite::Spin)
+                {
+                    for(unsigned int i = 0; i < 64; i++)
+                        poll::pause();
+                    if(now - start >= poll::gSpin)
+                        phase = waitpkg ? PollSite::Wait : PollSite::Sleep;
+                }
+                else if(phase == PollSite::Wait)
+                {
+                    poll::wait(poll::address(client, offset), client.cache() == WB);
+                    if(now - start >= poll::gSpin + poll::gWait)
+                        phase = PollSite::Sleep;
+                }
+                else {
+                    poll::sleep(std::min(backoff, deadline - now));
+                    backoff = std::min<poll::Clock::duration>(backoff * 2, std::chrono::milliseconds(1));
+                }
+
+                now = poll::Clock::now();
+                if((client.read(offset) & mask) == value)
+                {
+                    met = true;
+                    break;
+                }
+            }
+
+            if(site)
+                site->record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count(), met ? phase : PollSite::Timeout);
+            return met;
+        }
+
+        template<typename T> bool poll_until(const Client<T>& client, size_t offset, typename std::common_type<T>::type mask, typename std::common_type<T>::type value, poll::Clock::duration timeout, PollSite* site = NULL)
+        {
+            return poll_until(client, offset, mask, value, poll::Clock::now() + timeout, site);
+        }
+    };
+};
+
+
+///
+/// @brief poll_until() with a histogram for the calling source line
+///
+
+#define ENZYME_POLL_UNTIL(client, offset, mask, value, deadline) \
+    ([&]() -> bool { \
+        static enzyme::mem::PollSite site_(__FILE__, __LINE__); \
+        return enzyme::mem::poll_until(client, offset, mask, value, deadline, &site_); \
+    }())
+
+
+#endif  // _enzyme_poll_h_
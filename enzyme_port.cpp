@@ -0,0 +1,26 @@
+///
+/// @file    enzyme_port.cpp
+/// @brief   Enzyme Hardware Abstraction Layer: I/O Port Resource
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#include "enzyme_port.h"
+
+
+// ---------------------------------------------------------------------------
+
+
+namespace enzyme
+{
+    namespace port
+    {
+        namespace dummy
+        {
+            Resource gResource;
+        };
+    };
+};
@@ -14,6 +14,14 @@
 
 
 #include "enzyme.h"
+#include "enzyme_trace.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 
 namespace enzyme
@@ -24,6 +32,13 @@ namespace enzyme
         ///
         /// @brief Abstract port resource accessor
         ///
+        /// If direct() is true for a port, the calling thread may issue in/out
+        /// instructions to it and port::Client does so inline. Otherwise the
+        /// access goes through read() and write(). I/O permission may be per
+        /// thread, so direct() is asked on every access and may request it for
+        /// the calling thread on first use. Block accesses transfer cnt values
+        /// through the same port, as string I/O instructions do.
+        ///
 
         namespace impl
         {
@@ -32,10 +47,54 @@ namespace enzyme
             public:
                 virtual ~Client() { };
                 virtual Client* client() = 0;
+
+                virtual bool direct(uint16_t port, size_t width) { return false; }
+                virtual void read(uint16_t port, size_t width, size_t cnt, void* dst) = 0;
+                virtual void write(uint16_t port, size_t width, size_t cnt, const void* src) = 0;
             };
         };
 
 
+        ///
+        /// @brief Port I/O instructions
+        ///
+
+        namespace io
+        {
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+#define ENZYME_PORTIO
+            inline void in(uint16_t port, uint8_t& v)                       { __asm __volatile("inb %w1, %b0" : "=a" (v) : "Nd" (port)); }
+            inline void in(uint16_t port, uint16_t& v)                      { __asm __volatile("inw %w1, %w0" : "=a" (v) : "Nd" (port)); }
+            inline void in(uint16_t port, uint32_t& v)                      { __asm __volatile("inl %w1, %0" : "=a" (v) : "Nd" (port)); }
+            inline void out(uint16_t port, uint8_t v)                       { __asm __volatile("outb %b0, %w1" : : "a" (v), "Nd" (port)); }
+            inline void out(uint16_t port, uint16_t v)                      { __asm __volatile("outw %w0, %w1" : : "a" (v), "Nd" (port)); }
+            inline void out(uint16_t port, uint32_t v)                      { __asm __volatile("outl %0, %w1" : : "a" (v), "Nd" (port)); }
+
+            inline void ins(uint16_t port, uint8_t* dst, size_t cnt)        { __asm __volatile("rep insb" : "+D" (dst), "+c" (cnt) : "d" (port) : "memory"); }
+            inline void ins(uint16_t port, uint16_t* dst, size_t cnt)       { __asm __volatile("rep insw" : "+D" (dst), "+c" (cnt) : "d" (port) : "memory"); }
+            inline void ins(uint16_t port, uint32_t* dst, size_t cnt)       { __asm __volatile("rep insl" : "+D" (dst), "+c" (cnt) : "d" (port) : "memory"); }
+            inline void outs(uint16_t port, const uint8_t* src, size_t cnt) { __asm __volatile("rep outsb" : "+S" (src), "+c" (cnt) : "d" (port) : "memory"); }
+            inline void outs(uint16_t port, const uint16_t* src, size_t cnt){ __asm __volatile("rep outsw" : "+S" (src), "+c" (cnt) : "d" (port) : "memory"); }
+            inline void outs(uint16_t port, const uint32_t* src, size_t cnt){ __asm __volatile("rep outsl" : "+S" (src), "+c" (cnt) : "d" (port) : "memory"); }
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#define ENZYME_PORTIO
+            inline void in(uint16_t port, uint8_t& v)                       { v = __inbyte(port); }
+            inline void in(uint16_t port, uint16_t& v)                      { v = __inword(port); }
+            inline void in(uint16_t port, uint32_t& v)                      { v = __indword(port); }
+            inline void out(uint16_t port, uint8_t v)                       { __outbyte(port, v); }
+            inline void out(uint16_t port, uint16_t v)                      { __outword(port, v); }
+            inline void out(uint16_t port, uint32_t v)                      { __outdword(port, v); }
+
+            inline void ins(uint16_t port, uint8_t* dst, size_t cnt)        { __inbytestring(port, dst, static_cast<unsigned long>(cnt)); }
+            inline void ins(uint16_t port, uint16_t* dst, size_t cnt)       { __inwordstring(port, dst, static_cast<unsigned long>(cnt)); }
+            inline void ins(uint16_t port, uint32_t* dst, size_t cnt)       { __indwordstring(port, reinterpret_cast<unsigned long*>(dst), static_cast<unsigned long>(cnt)); }
+            inline void outs(uint16_t port, const uint8_t* src, size_t cnt) { __outbytestring(port, const_cast<uint8_t*>(src), static_cast<unsigned long>(cnt)); }
+            inline void outs(uint16_t port, const uint16_t* src, size_t cnt){ __outwordstring(port, const_cast<uint16_t*>(src), static_cast<unsigned long>(cnt)); }
+            inline void outs(uint16_t port, const uint32_t* src, size_t cnt){ __outdwordstring(port, reinterpret_cast<unsigned long*>(const_cast<uint32_t*>(src)), static_cast<unsigned long>(cnt)); }
+#endif
+        };
+
+
 
         ///
         /// @brief I/O Port Resource
@@ -78,15 +137,37 @@ namespace enzyme
         ///
         /// @brief I/O Port resource accessor
         ///
+        /// Offsets are in units of T from the resource base, as for mem::Client.
+        /// Unlike memory, a block read or write transfers cnt values through the
+        /// single port at offset (a FIFO, e.g. a UART or KCS data register), using
+        /// string I/O instructions where direct access is available.
+        ///
 
         template<typename T> class Client : public Resource
         {
         protected:
             impl::Client* mImpl;
 
+            bool direct(uint16_t port) const
+            {
+#ifdef ENZYME_PORTIO
+                return mImpl->direct(port, sizeof(T));
+#else
+                return false;
+#endif
+            }
+
+            uint16_t port(size_t offset) const
+            {
+                if((offset + 1) * sizeof(T) > size())
+                    throw std::runtime_error("I/O port resource: Access out of range");
+                return static_cast<uint16_t>(base() + offset * sizeof(T));
+            }
+
         public:
-            Client(Resource& resource)
-                : mImpl(resource.client())
+            Client(const Resource& resource)
+                : Resource(resource)
+                , mImpl(resource.client())
             {
             }
 
@@ -95,20 +176,115 @@ namespace enzyme
                 delete mImpl;
             }
 
+            void read(unsigned short offset, size_t cnt, T* dst) const
+            {
+                uint16_t p = port(offset);
+#ifdef ENZYME_PORTIO
+                if(direct(p))
+                    io::ins(p, dst, cnt);
+                else
+#endif
+                    mImpl->read(p, sizeof(T), cnt, dst);
+                if(trace::gEnabled)
+                    trace::block(trace::Port, base(), offset, 0, dst, cnt, sizeof(T), false);
+            }
+
+            void write(unsigned short offset, size_t cnt, const T* src) const
+            {
+                uint16_t p = port(offset);
+#ifdef ENZYME_PORTIO
+                if(direct(p))
+                    io::outs(p, src, cnt);
+                else
+#endif
+                    mImpl->write(p, sizeof(T), cnt, src);
+                if(trace::gEnabled)
+                    trace::block(trace::Port, base(), offset, 0, src, cnt, sizeof(T), true);
+            }
+
             T read(unsigned short offset) const
             {
-                return 0;
+                T value;
+#ifdef ENZYME_PORTIO
+                uint16_t p = port(offset);
+                if(direct(p))
+                {
+                    io::in(p, value);
+                    if(trace::gEnabled)
+                        trace::block(trace::Port, base(), offset, 0, &value, 1, sizeof(T), false);
+                    return value;
+                }
+#endif
+                read(offset, 1, &value);
+                return value;
             }
 
             void write(unsigned short offset, T value) const
             {
+#ifdef ENZYME_PORTIO
+                uint16_t p = port(offset);
+                if(direct(p))
+                {
+                    io::out(p, value);
+                    if(trace::gEnabled)
+                        trace::block(trace::Port, base(), offset, 0, &value, 1, sizeof(T), true);
+                    return;
+                }
+#endif
+                write(offset, 1, &value);
             }
 
+            /// @brief True if the calling thread issues accesses in-process rather than through the OS
+            bool direct() const { return direct(base()); }
+
             impl::Client* client() const
             {
                 return mImpl->client();
             }
         };
+
+
+        ///
+        /// @brief Dummy port resource
+        ///
+        /// Stands in for an I/O BAR that does not exist, as mem::dummy does for memory.
+        ///
+
+        namespace dummy
+        {
+            class Client : public impl::Client
+            {
+                impl::Client* client()
+                {
+                    return new Client;
+                }
+
+                void read(uint16_t port, size_t width, size_t cnt, void* dst)
+                {
+                    memset(dst, 0xFF, width * cnt);
+                }
+
+                void write(uint16_t port, size_t width, size_t cnt, const void* src)
+                {
+                }
+            };
+
+            class Resource : public port::Resource
+            {
+            public:
+                Resource()
+                    : port::Resource(0, 0)
+                {
+                }
+
+                impl::Client* client() const
+                {
+                    return new Client;
+                }
+            };
+
+            extern Resource gResource;
+        };
     };
 };
 
@@ -0,0 +1,352 @@
+///
+/// @file    enzyme_ring.h
+/// @brief   Enzyme Hardware Abstraction Layer: Descriptor Ring
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef _enzyme_ring_h_
+#define _enzyme_ring_h_
+
+
+#include "enzyme.h"
+#include "enzyme_mem.h"
+#include "enzyme_tsc.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+
+namespace enzyme
+{
+    namespace ring
+    {
+
+        ///
+        /// @brief Single producer, single consumer descriptor ring in host memory
+        ///
+        /// Head and tail are free running indices on separate cache lines; the slot
+        /// is the index masked by the power-of-two count. As with most hardware
+        /// rings, one slot is kept empty so that a masked tail written to the device
+        /// doorbell is never ambiguous, so the usable capacity is count - 1.
+        ///
+        /// enqueue() copies a whole batch, publishes the tail, then issues a single
+        /// store fence and a single doorbell write for the batch.
+        ///
+        /// With timestamps() on, enqueue() also stamps each slot with tsc::now()
+        /// and dequeue() hands the stamps back, so the time each descriptor spent
+        /// in the ring can be measured.
+        ///
+
+        template<typename D> class Ring
+        {
+        private:
+            D* mDesc;
+            D* mAlloc;
+            uint64_t* mStamp;
+            uint32_t mMask;
+
+            const mem::Client<uint32_t>* mDoorbell;
+            size_t mDoorbellOffset;
+
+            alignas(ENZYME_CACHELINE) std::atomic<uint32_t> mHead;     // Written by consumer
+            alignas(ENZYME_CACHELINE) std::atomic<uint32_t> mTail;     // Written by producer
+            char mPad[ENZYME_CACHELINE - sizeof(std::atomic<uint32_t>)];
+
+            Ring(const Ring&);
+            Ring& operator=(const Ring&);
+
+            void init(uint32_t count)
+            {
+                if(!count || (count & (count - 1)))
+                    throw std::logic_error("Descriptor ring: Count must be a power of two");
+
+                mMask = count - 1;
+                mStamp = NULL;
+                mDoorbell = NULL;
+                mDoorbellOffset = 0;
+                mHead.store(0, std::memory_order_relaxed);
+                mTail.store(0, std::memory_order_relaxed);
+            }
+
+        public:
+            /// @brief Ring over caller provided (e.g. DMA capable) descriptor memory
+            Ring(D* desc, uint32_t count)
+                : mDesc(desc)
+                , mAlloc(NULL)
+            {
+                init(count);
+            }
+
+            /// @brief Ring over descriptor memory allocated from the heap
+            Ring(uint32_t count)
+                : mDesc(NULL)
+                , mAlloc(NULL)
+            {
+                init(count);
+                mDesc = mAlloc = new D[count]();
+            }
+
+            ~Ring()
+            {
+                delete [] mAlloc;
+                delete [] mStamp;
+            }
+
+            /// @brief Stamp descriptors as they are enqueued; switch before the ring is used
+            void timestamps(bool enable)
+            {
+                delete [] mStamp;
+                mStamp = enable ? new uint64_t[mMask + 1]() : NULL;
+            }
+
+            /// @brief Write the masked tail to a device register after each enqueue batch
+            void doorbell(const mem::Client<uint32_t>* client, size_t offset)
+            {
+                mDoorbell = client;
+                mDoorbellOffset = offset;
+            }
+
+            D* desc()                   const { return mDesc; }
+            uint32_t count()            const { return mMask + 1; }
+            uint32_t capacity()         const { return mMask; }
+            uint32_t mask()             const { return mMask; }
+
+            uint32_t head()             const { return mHead.load(std::memory_order_acquire); }
+            uint32_t tail()             const { return mTail.load(std::memory_order_acquire); }
+            uint32_t used()             const { return tail() - head(); }
+            uint32_t avail()            const { return mMask - used(); }
+
+            ///
+            /// @brief Producer: copy up to cnt descriptors in; return the number enqueued
+            ///
+
+            uint32_t enqueue(const D* src, uint32_t cnt)
+            {
+                uint32_t tail = mTail.load(std::memory_order_relaxed);
+                uint32_t head = mHead.load(std::memory_order_acquire);
+                uint32_t n = std::min(cnt, mMask - (tail - head));
+                if(!n)
+                    return 0;
+
+                uint32_t slot = tail & mMask;
+                uint32_t first = std::min(n, mMask + 1 - slot);
+                std::copy(src, src + first, mDesc + slot);
+                std::copy(src + first, src + n, mDesc);
+
+                if(mStamp)
+                {
+                    uint64_t now = tsc::now();
+                    std::fill(mStamp + slot, mStamp + slot + first, now);
+                    std::fill(mStamp, mStamp + (n - first), now);
+                }
+
+                tail += n;
+                mTail.store(tail, std::memory_order_release);
+
+                if(mDoorbell)
+                {
+                    mem::sfence();
+                    mDoorbell->write(mDoorbellOffset, tail & mMask);
+                }
+                return n;
+            }
+
+            ///
+            /// @brief Consumer: copy up to cnt descriptors out; return the number dequeued
+            ///
+            /// If stamp is given and timestamps() is on, the enqueue time of each
+            /// descriptor is copied to it.
+            ///
+
+            uint32_t dequeue(D* dst, uint32_t cnt, uint64_t* stamp = NULL)
+            {
+                uint32_t head = mHead.load(std::memory_order_relaxed);
+                uint32_t tail = mTail.load(std::memory_order_acquire);
+                uint32_t n = std::min(cnt, tail - head);
+                if(!n)
+                    return 0;
+
+                uint32_t slot = head & mMask;
+                uint32_t first = std::min(n, mMask + 1 - slot);
+                std::copy(mDesc + slot, mDesc + slot + first, dst);
+                std::copy(mDesc, mDesc + (n - first), dst + first);
+                if(stamp && mStamp)
+                {
+                    std::copy(mStamp + slot, mStamp + slot + first, stamp);
+                    std::copy(mStamp, mStamp + (n - first), stamp + first);
+                }
+
+                mHead.store(head + n, std::memory_order_release);
+                return n;
+            }
+
+            ///
+            /// @brief Consumer is hardware: advance head to a device reported (masked) index
+            ///
+
+            void consumed(uint32_t index)
+            {
+                uint32_t head = mHead.load(std::memory_order_relaxed);
+                mHead.store(head + ((index - head) & mMask), std::memory_order_release);
+            }
+        };
+
+
+        ///
+        /// @brief Emulated device consuming a ring
+        ///
+        /// A worker thread watches the doorbell register (normally in a
+        /// mem::emu::Resource), and dequeues descriptors up to the rung tail in
+        /// batches, passing each batch to process(). Ring throughput and latency can
+        /// then be measured without hardware.
+        ///
+        /// The emulator turns on the ring's timestamps, so it must be constructed
+        /// before anything is enqueued. The time from enqueue() to dequeue of each
+        /// descriptor, the doorbell path end to end, is counted in buckets of
+        /// powers of two of nanoseconds, as PollSite does for waits.
+        ///
+
+        template<typename D> class Emulator
+        {
+        public:
+            enum { Buckets = 40 };
+
+        private:
+            Ring<D>& mRing;
+            const mem::Client<uint32_t>& mDoorbell;
+            size_t mDoorbellOffset;
+            uint32_t mBatch;
+
+            std::atomic<bool> mStop;
+            std::atomic<uint64_t> mConsumed;
+            std::atomic<uint64_t> mBatches;
+            std::atomic<uint64_t> mLatency[Buckets];
+            std::atomic<uint64_t> mLatencyTotal;
+            std::atomic<uint64_t> mLatencyMax;
+            std::thread mThread;
+
+            Emulator(const Emulator&);
+            Emulator& operator=(const Emulator&);
+
+            void run()
+            {
+                std::vector<D> buf(mBatch);
+                std::vector<uint64_t> stamp(mBatch);
+                while(!mStop.load(std::memory_order_relaxed))
+                {
+                    uint32_t rung = mDoorbell.read(mDoorbellOffset);
+                    uint32_t pending = (rung - mRing.head()) & mRing.mask();
+                    if(!pending)
+                    {
+                        std::this_thread::yield();
+                        continue;
+                    }
+
+                    uint32_t n = mRing.dequeue(&buf[0], std::min(pending, mBatch), &stamp[0]);
+                    uint64_t now = tsc::now();
+                    for(uint32_t i = 0; i < n; i++)
+                        record((now > stamp[i]) ? now - stamp[i] : 0);
+
+                    process(&buf[0], n);
+                    mConsumed.fetch_add(n, std::memory_order_relaxed);
+                    mBatches.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+
+            void record(uint64_t ns)
+            {
+                unsigned int b = 0;
+                while((b < Buckets - 1) && (ns >> b))
+                    b++;
+
+                // Only the worker writes; readers on other threads see relaxed values
+                mLatency[b].store(mLatency[b].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                mLatencyTotal.store(mLatencyTotal.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+                if(ns > mLatencyMax.load(std::memory_order_relaxed))
+                    mLatencyMax.store(ns, std::memory_order_relaxed);
+            }
+
+        protected:
+            /// @brief Device action for each consumed batch; default discards
+            virtual void process(const D* desc, uint32_t cnt)
+            {
+            }
+
+        public:
+            Emulator(Ring<D>& ring, const mem::Client<uint32_t>& doorbell, size_t offset = 0, uint32_t batch = 64)
+                : mRing(ring)
+                , mDoorbell(doorbell)
+                , mDoorbellOffset(offset)
+                , mBatch(batch ? batch : 1)
+                , mStop(true)
+                , mConsumed(0)
+                , mBatches(0)
+                , mLatencyTotal(0)
+                , mLatencyMax(0)
+            {
+                for(unsigned int i = 0; i < Buckets; i++)
+                    mLatency[i].store(0, std::memory_order_relaxed);
+                mRing.timestamps(true);
+            }
+
+            virtual ~Emulator()
+            {
+                stop();
+            }
+
+            /// @brief Derived classes start() once constructed and stop() in their destructor
+            void start()
+            {
+                if(!mStop.exchange(false))
+                    return;
+                mThread = std::thread(&Emulator::run, this);
+            }
+
+            void stop()
+            {
+                mStop.store(true);
+                if(mThread.joinable())
+                    mThread.join();
+            }
+
+            uint64_t consumed()     const { return mConsumed.load(std::memory_order_relaxed); }
+            uint64_t batches()      const { return mBatches.load(std::memory_order_relaxed); }
+
+            /// @brief Descriptors whose enqueue to dequeue time fell in bucket i, below 2^i ns
+            uint64_t latency(unsigned int i) const { return mLatency[i].load(std::memory_order_relaxed); }
+            uint64_t latency_total()        const { return mLatencyTotal.load(std::memory_order_relaxed); }
+            uint64_t latency_max()          const { return mLatencyMax.load(std::memory_order_relaxed); }
+
+            /// @brief Upper bound (ns) of the bucket holding the given percentile
+            uint64_t percentile(double pct) const
+            {
+                uint64_t cnt = 0;
+                for(unsigned int i = 0; i < Buckets; i++)
+                    cnt += latency(i);
+                if(!cnt)
+                    return 0;
+
+                uint64_t want = static_cast<uint64_t>(cnt * pct / 100.0);
+                uint64_t seen = 0;
+                for(unsigned int i = 0; i < Buckets; i++)
+                {
+                    seen += latency(i);
+                    if(seen > want)
+                        return (i ? (uint64_t)1 << i : 0);
+                }
+                return latency_max();
+            }
+        };
+    };
+};
+
+
+#endif  // _enzyme_ring_h_
@@ -0,0 +1,324 @@
+///
+/// @file    enzyme_simd.cpp
+/// @brief   Enzyme Hardware Abstraction Layer: Dispatched Memory Kernels
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#include "enzyme_simd.h"
+#include "enzyme_cpu.h"
+#include "enzyme_perf.h"
+
+#include <cstring>
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#define ENZYME_SIMD_X86
+#define ENZYME_TARGET(isa)
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+#include <x86intrin.h>
+#define ENZYME_SIMD_X86
+#define ENZYME_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+
+// ---------------------------------------------------------------------------
+
+
+namespace enzyme
+{
+    namespace simd
+    {
+
+        ///
+        /// @brief Baseline kernels
+        ///
+
+        static void copy_base(void* dst, const void* src, size_t len)
+        {
+            memcpy(dst, src, len);
+        }
+
+        static size_t compare_base(const void* a, const void* b, size_t len)
+        {
+            const uint8_t* pa = static_cast<const uint8_t*>(a);
+            const uint8_t* pb = static_cast<const uint8_t*>(b);
+            size_t i = 0;
+            for(; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+            {
+                uint64_t wa, wb;
+                memcpy(&wa, pa + i, sizeof(wa));
+                memcpy(&wb, pb + i, sizeof(wb));
+                if(wa != wb)
+                    break;
+            }
+            for(; i < len; i++)
+            {
+                if(pa[i] != pb[i])
+                    return i;
+            }
+            return len;
+        }
+
+        static uint32_t gCRCTable[256];
+
+        static void crcinit()
+        {
+            for(uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t crc = i;
+                for(int bit = 0; bit < 8; bit++)
+                    crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78 : 0);
+                gCRCTable[i] = crc;
+            }
+        }
+
+        static uint32_t checksum_base(uint32_t crc, const void* data, size_t len)
+        {
+            const uint8_t* p = static_cast<const uint8_t*>(data);
+            crc = ~crc;
+            while(len--)
+                crc = gCRCTable[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+            return ~crc;
+        }
+
+
+#ifdef ENZYME_SIMD_X86
+
+        ///
+        /// @brief AVX2 kernels
+        ///
+
+        ENZYME_TARGET("avx2") static void copy_avx2(void* dst, const void* src, size_t len)
+        {
+            uint8_t* d = static_cast<uint8_t*>(dst);
+            const uint8_t* s = static_cast<const uint8_t*>(src);
+            for(; len >= 128; len -= 128, d += 128, s += 128)
+            {
+                __m256i r0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s));
+                __m256i r1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + 32));
+                __m256i r2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + 64));
+                __m256i r3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + 96));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(d), r0);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(d + 32), r1);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(d + 64), r2);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(d + 96), r3);
+            }
+            for(; len >= 32; len -= 32, d += 32, s += 32)
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(d), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s)));
+            memcpy(d, s, len);
+        }
+
+        ENZYME_TARGET("avx2,bmi") static size_t compare_avx2(const void* a, const void* b, size_t len)
+        {
+            const uint8_t* pa = static_cast<const uint8_t*>(a);
+            const uint8_t* pb = static_cast<const uint8_t*>(b);
+            size_t i = 0;
+            for(; i + 32 <= len; i += 32)
+            {
+                __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pa + i));
+                __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pb + i));
+                uint32_t eq = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)));
+                if(eq != 0xFFFFFFFF)
+                    return i + _tzcnt_u32(~eq);
+            }
+            return i + compare_base(pa + i, pb + i, len - i);
+        }
+
+
+        ///
+        /// @brief AVX-512 kernels
+        ///
+
+        ENZYME_TARGET("avx512f") static void copy_avx512(void* dst, const void* src, size_t len)
+        {
+            uint8_t* d = static_cast<uint8_t*>(dst);
+            const uint8_t* s = static_cast<const uint8_t*>(src);
+            for(; len >= 256; len -= 256, d += 256, s += 256)
+            {
+                __m512i r0 = _mm512_loadu_si512(s);
+                __m512i r1 = _mm512_loadu_si512(s + 64);
+                __m512i r2 = _mm512_loadu_si512(s + 128);
+                __m512i r3 = _mm512_loadu_si512(s + 192);
+                _mm512_storeu_si512(d, r0);
+                _mm512_storeu_si512(d + 64, r1);
+                _mm512_storeu_si512(d + 128, r2);
+                _mm512_storeu_si512(d + 192, r3);
+            }
+            for(; len >= 64; len -= 64, d += 64, s += 64)
+                _mm512_storeu_si512(d, _mm512_loadu_si512(s));
+            memcpy(d, s, len);
+        }
+
+        ENZYME_TARGET("avx512f,avx512bw,bmi") static size_t compare_avx512(const void* a, const void* b, size_t len)
+        {
+            const uint8_t* pa = static_cast<const uint8_t*>(a);
+            const uint8_t* pb = static_cast<const uint8_t*>(b);
+            size_t i = 0;
+            for(; i + 64 <= len; i += 64)
+            {
+                __mmask64 ne = _mm512_cmpneq_epu8_mask(_mm512_loadu_si512(pa + i), _mm512_loadu_si512(pb + i));
+                if(ne)
+                    return i + static_cast<size_t>(_tzcnt_u64(ne));
+            }
+            return i + compare_base(pa + i, pb + i, len - i);
+        }
+
+
+        ///
+        /// @brief SSE4.2 CRC32 instruction kernel
+        ///
+
+        ENZYME_TARGET("sse4.2") static uint32_t checksum_sse42(uint32_t crc, const void* data, size_t len)
+        {
+            const uint8_t* p = static_cast<const uint8_t*>(data);
+            crc = ~crc;
+#if defined(__x86_64__) || defined(_M_X64)
+            uint64_t crc64 = crc;
+            for(; len >= 8; len -= 8, p += 8)
+            {
+                uint64_t v;
+                memcpy(&v, p, sizeof(v));
+                crc64 = _mm_crc32_u64(crc64, v);
+            }
+            crc = static_cast<uint32_t>(crc64);
+#endif
+            for(; len >= 4; len -= 4, p += 4)
+            {
+                uint32_t v;
+                memcpy(&v, p, sizeof(v));
+                crc = _mm_crc32_u32(crc, v);
+            }
+            while(len--)
+                crc = _mm_crc32_u8(crc, *p++);
+            return ~crc;
+        }
+#endif
+
+
+        static Dispatch select()
+        {
+            crcinit();
+
+            Dispatch d;
+            d.copy = copy_base;                 d.copyname = "base";
+            d.compare = compare_base;           d.comparename = "base";
+            d.checksum = checksum_base;         d.checksumname = "base";
+
+#ifdef ENZYME_SIMD_X86
+            if(cpu::has(cpu::AVX512F))
+            {
+                d.copy = copy_avx512;           d.copyname = "avx512";
+            }
+            else if(cpu::has(cpu::AVX2))
+            {
+                d.copy = copy_avx2;             d.copyname = "avx2";
+            }
+
+            // The compare kernels locate the first difference with TZCNT
+            if(cpu::has(cpu::AVX512BW) && cpu::has(cpu::BMI1))
+            {
+                d.compare = compare_avx512;     d.comparename = "avx512";
+            }
+            else if(cpu::has(cpu::AVX2) && cpu::has(cpu::BMI1))
+            {
+                d.compare = compare_avx2;       d.comparename = "avx2";
+            }
+
+            if(cpu::has(cpu::SSE42))
+            {
+                d.checksum = checksum_sse42;    d.checksumname = "sse4.2";
+            }
+#endif
+
+            return d;
+        }
+    };
+};
+
+
+// ---------------------------------------------------------------------------
+
+
+const enzyme::simd::Dispatch& enzyme::simd::dispatch()
+{
+    static const Dispatch result = select();
+    return result;
+}
+
+
+std::vector<enzyme::simd::Dispatch> enzyme::simd::variants()
+{
+    // Selecting also fills the CRC table used by the base checksum
+    dispatch();
+
+    Dispatch base;
+    base.copy = copy_base;              base.copyname = "base";
+    base.compare = compare_base;        base.comparename = "base";
+    base.checksum = checksum_base;      base.checksumname = "base";
+
+    std::vector<Dispatch> result;
+    result.push_back(base);
+
+#ifdef ENZYME_SIMD_X86
+    if(cpu::has(cpu::SSE42))
+    {
+        Dispatch d = base;
+        d.checksum = checksum_sse42;    d.checksumname = "sse4.2";
+        result.push_back(d);
+    }
+
+    if(cpu::has(cpu::AVX2))
+    {
+        Dispatch d = base;
+        d.copy = copy_avx2;             d.copyname = "avx2";
+        if(cpu::has(cpu::BMI1))
+        {
+            d.compare = compare_avx2;   d.comparename = "avx2";
+        }
+        result.push_back(d);
+    }
+
+    if(cpu::has(cpu::AVX512F))
+    {
+        Dispatch d = base;
+        d.copy = copy_avx512;           d.copyname = "avx512";
+        if(cpu::has(cpu::AVX512BW) && cpu::has(cpu::BMI1))
+        {
+            d.compare = compare_avx512; d.comparename = "avx512";
+        }
+        result.push_back(d);
+    }
+#endif
+
+    return result;
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+///
+/// @brief Copy through the selected kernel; counted when the library is built with ENZYME_PERF
+///
+
+void enzyme::simd::copy(void* dst, const void* src, size_t len)
+{
+    ENZYME_PERF_OPERATION("simd.copy");
+    dispatch().copy(dst, src, len);
+}
+
+
+size_t enzyme::simd::compare(const void* a, const void* b, size_t len)
+{
+    return dispatch().compare(a, b, len);
+}
+
+
+uint32_t enzyme::simd::checksum(const void* data, size_t len, uint32_t crc)
+{
+    return dispatch().checksum(crc, data, len);
+}
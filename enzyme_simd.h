@@ -0,0 +1,87 @@
+///
+/// @file    enzyme_simd.h
+/// @brief   Enzyme Hardware Abstraction Layer: Dispatched Memory Kernels
+///
+/// Bulk copy, compare and checksum kernels are built for several
+/// instruction sets; the best one supported by the processor is selected
+/// once, on first use, through a table of function pointers.
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef _enzyme_simd_h_
+#define _enzyme_simd_h_
+
+
+#include "enzyme_type.h"
+
+#include <cstddef>
+#include <vector>
+
+
+namespace enzyme
+{
+    namespace simd
+    {
+        typedef void (*CopyFn)(void* dst, const void* src, size_t len);
+        typedef size_t (*CompareFn)(const void* a, const void* b, size_t len);
+        typedef uint32_t (*ChecksumFn)(uint32_t crc, const void* data, size_t len);
+
+
+        ///
+        /// @brief Selected kernels and the name of the variant behind each
+        ///
+
+        typedef struct
+        {
+            CopyFn copy;
+            CompareFn compare;
+            ChecksumFn checksum;
+
+            const char* copyname;
+            const char* comparename;
+            const char* checksumname;
+        }
+        Dispatch;
+
+        const Dispatch& dispatch();
+
+        ///
+        /// @brief One table per instruction set the processor supports, base first
+        ///
+        /// Each table holds that instruction set's kernels, and the base kernel
+        /// for any function it has none for. dispatch() picks among these; all
+        /// of them are listed so that each can be checked against the base.
+        ///
+
+        std::vector<Dispatch> variants();
+
+
+        ///
+        /// @brief Copy len bytes between non-overlapping buffers
+        ///
+
+        void copy(void* dst, const void* src, size_t len);
+
+
+        ///
+        /// @brief Offset of the first differing byte, or len if the buffers are equal
+        ///
+
+        size_t compare(const void* a, const void* b, size_t len);
+
+
+        ///
+        /// @brief CRC-32C (Castagnoli) of len bytes, continuing from crc (0 to start)
+        ///
+
+        uint32_t checksum(const void* data, size_t len, uint32_t crc = 0);
+    };
+};
+
+
+#endif  // _enzyme_simd_h_
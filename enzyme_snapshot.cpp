@@ -0,0 +1,136 @@
+///
+/// @file    enzyme_snapshot.cpp
+/// @brief   Enzyme Hardware Abstraction Layer: Published Device Tree Snapshots
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#include "enzyme_snapshot.h"
+
+#include <thread>
+
+
+// ---------------------------------------------------------------------------
+
+
+///
+/// @brief Enumerate every subsystem and collect the root device list
+///
+
+enzyme::Snapshot::Snapshot(Enumerator::Option option, uint64_t generation)
+    : mEnumerator(new Enumerator(option))
+    , mGeneration(generation)
+{
+    try {
+        std::list<Device*>& child = mEnumerator->child();
+        mChild.assign(child.begin(), child.end());
+    }
+    catch(...) {
+        delete mEnumerator;
+        throw;
+    }
+}
+
+
+enzyme::Snapshot::~Snapshot()
+{
+    delete mEnumerator;
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+///
+/// @brief Enter the reader generation and take the current snapshot
+///
+/// The generation is read again after counting in; if a rescan flipped it
+/// in between, the count may be one the rescan has already stopped
+/// waiting for, so the reader backs out and retries on the new generation.
+///
+
+enzyme::Tree::View::View(Tree& tree)
+    : mTree(&tree)
+{
+    for(;;)
+    {
+        uint64_t epoch = tree.mEpoch.load(std::memory_order_seq_cst);
+        mSlot = static_cast<unsigned int>(epoch & 1);
+        tree.mReaders[mSlot].fetch_add(1, std::memory_order_seq_cst);
+        if(tree.mEpoch.load(std::memory_order_seq_cst) == epoch)
+            break;
+        tree.mReaders[mSlot].fetch_sub(1, std::memory_order_release);
+    }
+    mSnapshot = tree.mCurrent.load(std::memory_order_seq_cst);
+}
+
+
+enzyme::Tree::View::View(const View& other)
+    : mTree(other.mTree)
+    , mSnapshot(other.mSnapshot)
+    , mSlot(other.mSlot)
+{
+    // The original still holds the generation open, so no revalidation is needed
+    mTree->mReaders[mSlot].fetch_add(1, std::memory_order_relaxed);
+}
+
+
+enzyme::Tree::View::~View()
+{
+    mTree->mReaders[mSlot].fetch_sub(1, std::memory_order_release);
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+///
+/// @brief Enumerate and publish the first snapshot
+///
+
+enzyme::Tree::Tree(Enumerator::Option option)
+    : mCurrent(NULL)
+    , mEpoch(0)
+    , mOption(option)
+{
+    mReaders[0].store(0, std::memory_order_relaxed);
+    mReaders[1].store(0, std::memory_order_relaxed);
+    mCurrent.store(new Snapshot(option, 1), std::memory_order_release);
+}
+
+
+///
+/// @brief Release the current snapshot; no View may outlive the Tree
+///
+
+enzyme::Tree::~Tree()
+{
+    delete mCurrent.load(std::memory_order_acquire);
+}
+
+
+///
+/// @brief Publish a fresh snapshot and retire the previous one after a grace period
+///
+/// Concurrent rescans are serialized; readers are never blocked by one.
+///
+
+uint64_t enzyme::Tree::rescan()
+{
+    std::lock_guard<std::mutex> lock(mRescan);
+
+    Snapshot* next = new Snapshot(mOption, mCurrent.load(std::memory_order_relaxed)->generation() + 1);
+    Snapshot* prev = mCurrent.exchange(next, std::memory_order_seq_cst);
+
+    // Readers that count in from here on see the new generation and snapshot
+    uint64_t epoch = mEpoch.fetch_add(1, std::memory_order_seq_cst);
+    while(mReaders[epoch & 1].load(std::memory_order_acquire))
+        std::this_thread::yield();
+
+    uint64_t generation = next->generation();
+    delete prev;
+    return generation;
+}
@@ -0,0 +1,122 @@
+///
+/// @file    enzyme_snapshot.h
+/// @brief   Enzyme Hardware Abstraction Layer: Published Device Tree Snapshots
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef _enzyme_snapshot_h_
+#define _enzyme_snapshot_h_
+
+
+#include "enzyme.h"
+
+#include <atomic>
+#include <mutex>
+
+
+namespace enzyme
+{
+
+    ///
+    /// @brief Fully enumerated device tree that is never modified once published
+    ///
+    /// Every subsystem and the root child() list are materialized before the
+    /// snapshot is published, so readers on any thread only ever walk it.
+    /// PCI Device objects are the exception: they are built from the
+    /// records on first access to pci().device(), once, under a once flag.
+    ///
+    /// Readers are given only const access, to the subsystems and to every
+    /// device in child().
+    ///
+
+    class Snapshot
+    {
+    private:
+        Enumerator* mEnumerator;
+        uint64_t mGeneration;
+        std::list<const Device*> mChild;
+
+        Snapshot(const Snapshot&);
+        Snapshot& operator=(const Snapshot&);
+
+    public:
+        Snapshot(Enumerator::Option option, uint64_t generation);
+        ~Snapshot();
+
+        /// @brief 1 for the first snapshot of a Tree, incremented on each rescan
+        uint64_t generation() const { return mGeneration; }
+
+        const cpu::Enumerator& cpu() const { return mEnumerator->cpu(); }
+        const pci::Enumerator& pci() const { return mEnumerator->pci(); }
+
+        const std::list<const Device*>& child() const { return mChild; }
+        Timing timing() const { return mEnumerator->timing(); }
+    };
+
+
+    ///
+    /// @brief Current snapshot of the device tree, shared by any number of threads
+    ///
+    /// Readers take a View, which costs two atomic increments and never
+    /// blocks. rescan() builds a new snapshot, swaps it in with one atomic
+    /// exchange and deletes the old one once every View taken before the swap
+    /// has been released (a grace period, as in RCU). Readers count
+    /// themselves in one of two generations; a rescan flips the generation
+    /// and waits for the old count to drain. Views should therefore be short
+    /// lived: a View held across a rescan delays the rescan, not other readers.
+    ///
+
+    class Tree
+    {
+    private:
+        std::atomic<Snapshot*> mCurrent;
+        std::atomic<uint64_t> mEpoch;
+        alignas(ENZYME_CACHELINE) std::atomic<uint64_t> mReaders[2];
+
+        std::mutex mRescan;
+        Enumerator::Option mOption;
+
+        Tree(const Tree&);
+        Tree& operator=(const Tree&);
+
+    public:
+
+        ///
+        /// @brief Read access to the snapshot current when the View was taken
+        ///
+
+        class View
+        {
+        private:
+            Tree* mTree;
+            const Snapshot* mSnapshot;
+            unsigned int mSlot;
+
+            View& operator=(const View&);
+
+        public:
+            explicit View(Tree& tree);
+            View(const View& other);
+            ~View();
+
+            const Snapshot& operator*()  const { return *mSnapshot; }
+            const Snapshot* operator->() const { return mSnapshot; }
+        };
+
+        explicit Tree(Enumerator::Option option = Enumerator::Concurrent);
+        ~Tree();
+
+        View view() { return View(*this); }
+
+        /// @brief Enumerate again and publish the result; returns its generation
+        uint64_t rescan();
+    };
+};
+
+
+#endif  // _enzyme_snapshot_h_
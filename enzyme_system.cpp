@@ -11,6 +11,10 @@
 #include "enzyme.h"
 #include "enzyme_cpu.h"
 #include "enzyme_pci.h"
+#include "enzyme_platform.h"
+
+#include <chrono>
+#include <future>
 
 
 // ---------------------------------------------------------------------------
@@ -30,6 +34,14 @@ namespace enzyme
 
     static EmptyLex gEmpty;
     static SystemLex gSystem;
+
+    // Phases are timed with the steady clock, which needs no calibration
+    typedef std::chrono::steady_clock Clock;
+
+    static uint64_t elapsed(Clock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    }
 };
 
 
@@ -39,14 +51,24 @@ namespace enzyme
 ///
 /// @brief System Enumerator constructor
 ///
+/// Lazy leaves every subsystem to be enumerated on first access.
+///
 
-enzyme::Enumerator::Enumerator()
+enzyme::Enumerator::Enumerator(Option option)
     : enzyme::Device(gEmpty, gEmpty, gEmpty, gSystem)
+    , mCPU(NULL)
+    , mPCI(NULL)
+    , mCPUTime(0)
+    , mPCITime(0)
+    , mCollectTime(0)
+    , mConstructorTime(0)
 {
-    mCPU = new cpu::Enumerator;
-    mChild.insert(mChild.end(), cpu().child().begin(), cpu().child().end());
-    mPCI = new pci::Enumerator;
-    mChild.insert(mChild.end(), pci().child().begin(), pci().child().end());
+    if(option == Concurrent)
+    {
+        Clock::time_point start = Clock::now();
+        concurrent();
+        mConstructorTime.store(elapsed(start), std::memory_order_relaxed);
+    }
 }
 
 
@@ -59,3 +81,110 @@ enzyme::Enumerator::~Enumerator()
     delete mPCI;
     delete mCPU;
 }
+
+
+///
+/// @brief Enumerate PCI on a second thread while CPU is enumerated on this one
+///
+/// The two share no state: CPU enumeration is CPUID and pinned threads,
+/// PCI enumeration is sysfs I/O. An exception from either is rethrown once
+/// both have finished.
+///
+
+void enzyme::Enumerator::concurrent()
+{
+    std::future<void> pcidone = std::async(std::launch::async, [this]() { pci(); });
+
+    try {
+        cpu();
+    }
+    catch(...) {
+        pcidone.wait();
+        delete mPCI;
+        throw;
+    }
+
+    try {
+        pcidone.get();
+    }
+    catch(...) {
+        delete mCPU;
+        throw;
+    }
+}
+
+
+enzyme::Timing enzyme::Enumerator::timing() const
+{
+    Timing t;
+    t.cpu = mCPUTime.load(std::memory_order_relaxed);
+    t.pci = mPCITime.load(std::memory_order_relaxed);
+    t.collect = mCollectTime.load(std::memory_order_relaxed);
+    t.constructor = mConstructorTime.load(std::memory_order_relaxed);
+    return t;
+}
+
+
+std::ostream& enzyme::Enumerator::report(std::ostream& os) const
+{
+    Timing t = timing();
+    return os << std::dec << "cpu=" << t.cpu << "ns pci=" << t.pci << "ns collect=" << t.collect << "ns constructor=" << t.constructor << "ns";
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+///
+/// @brief CPU enumerator, built on first access
+///
+
+enzyme::cpu::Enumerator& enzyme::Enumerator::cpu()
+{
+    std::call_once(mCPUOnce, [this]()
+    {
+        Clock::time_point start = Clock::now();
+        mCPU = new cpu::Enumerator;
+        mCPUTime.store(elapsed(start), std::memory_order_relaxed);
+    });
+    return *mCPU;
+}
+
+
+///
+/// @brief PCI enumerator, built on first access
+///
+
+enzyme::pci::Enumerator& enzyme::Enumerator::pci()
+{
+    std::call_once(mPCIOnce, [this]()
+    {
+        Clock::time_point start = Clock::now();
+        mPCI = new pci::os::Enumerator;
+        mPCITime.store(elapsed(start), std::memory_order_relaxed);
+    });
+    return *mPCI;
+}
+
+
+///
+/// @brief Devices of every subsystem, collected on first access
+///
+
+std::list<enzyme::Device*>& enzyme::Enumerator::child()
+{
+    std::call_once(mChildOnce, [this]()
+    {
+        // Enumerating is timed as its own phase, so collection starts after it
+        cpu::Enumerator& c = cpu();
+        pci::Enumerator& p = pci();
+
+        Clock::time_point start = Clock::now();
+        std::list<Device*> devices;
+        devices.insert(devices.end(), c.child().begin(), c.child().end());
+        devices.insert(devices.end(), p.child().begin(), p.child().end());
+        mChild.swap(devices);
+        mCollectTime.store(elapsed(start), std::memory_order_relaxed);
+    });
+    return mChild;
+}
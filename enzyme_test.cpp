@@ -1,11 +1,1625 @@
+///
+/// @file    enzyme_test.cpp
+/// @brief   Enzyme Hardware Abstraction Layer: Self Test
+///
+/// Runs the library against a synthetic Sysfs tree built in a temporary
+/// directory and against emulated resources, so that no hardware or
+/// privilege is needed. Prints each failed check and exits non-zero if
+/// there was any.
+///
+///     make test
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
 
 
 #include "enzyme.h"
-#include "enzyme_pci.h"
+#include "enzyme_corelocal.h"
+#include "enzyme_index.h"
+#include "enzyme_platform.h"
+#include "enzyme_ring.h"
+#include "enzyme_simd.h"
+#include "enzyme_snapshot.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <limits>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// ---------------------------------------------------------------------------
+
+
+namespace
+{
+    unsigned int gChecks = 0;
+    unsigned int gFailures = 0;
+
+    void check(bool ok, const char* what, int line)
+    {
+        gChecks++;
+        if(!ok)
+        {
+            gFailures++;
+            fprintf(stderr, "enzyme_test.cpp:%d: FAILED: %s\n", line, what);
+        }
+    }
+
+#define CHECK(expr) check((expr), #expr, __LINE__)
+
+    template<typename E> bool throws(void (*f)())
+    {
+        try {
+            f();
+        }
+        catch(E&) {
+            return true;
+        }
+        return false;
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    // Live heap blocks, for checking that a failed construction frees everything
+    std::atomic<long> gBlocks(0);
+
+    void* counted(void* p)
+    {
+        if(!p)
+            throw std::bad_alloc();
+        gBlocks.fetch_add(1, std::memory_order_relaxed);
+        return p;
+    }
+
+    void* counted(void* p, const std::nothrow_t&)
+    {
+        if(p)
+            gBlocks.fetch_add(1, std::memory_order_relaxed);
+        return p;
+    }
+
+    void* aligned(size_t size, std::align_val_t align)
+    {
+        return aligned_alloc(static_cast<size_t>(align), (size + static_cast<size_t>(align) - 1) & ~(static_cast<size_t>(align) - 1));
+    }
+
+    void release(void* p)
+    {
+        if(p)
+            gBlocks.fetch_sub(1, std::memory_order_relaxed);
+        free(p);
+    }
+};
+
+
+void* operator new(size_t size)                                                         { return counted(malloc(size ? size : 1)); }
+void* operator new(size_t size, std::align_val_t align)                                 { return counted(aligned(size, align)); }
+void* operator new(size_t size, const std::nothrow_t& nt) noexcept                      { return counted(malloc(size ? size : 1), nt); }
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t& nt) noexcept { return counted(aligned(size, align), nt); }
+void operator delete(void* p) noexcept                                                  { release(p); }
+void operator delete(void* p, size_t) noexcept                                          { release(p); }
+void operator delete(void* p, std::align_val_t) noexcept                                { release(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept                        { release(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept                           { release(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept         { release(p); }
+
+
+// ---------------------------------------------------------------------------
+
+
+namespace
+{
+
+    ///
+    /// @brief Synthetic Sysfs tree of PCI functions, removed on destruction
+    ///
+
+    class Tree
+    {
+    private:
+        std::string mRoot;
+
+        static int remove(const char* path, const struct stat*, int, struct FTW*)
+        {
+            return ::remove(path);
+        }
+
+        static void put(const std::string& path, const std::string& text)
+        {
+            FILE* f = fopen(path.c_str(), "w");
+            if(!f)
+                throw std::runtime_error("Test: Failed to create " + path);
+            fwrite(text.data(), 1, text.size(), f);
+            fclose(f);
+        }
+
+    public:
+        Tree()
+        {
+            char root[] = "/tmp/enzyme_test.XXXXXX";
+            if(!mkdtemp(root))
+                throw std::runtime_error("Test: Failed to create a temporary directory");
+            mRoot = root;
+
+            const char* dir[] = { "/bus", "/bus/pci", "/bus/pci/devices", "/bus/pci/drivers", "/bus/pci/drivers/nvme" };
+            for(size_t i = 0; i < sizeof(dir) / sizeof(dir[0]); i++)
+                mkdir((mRoot + dir[i]).c_str(), 0755);
+        }
+
+        ~Tree()
+        {
+            nftw(mRoot.c_str(), remove, 16, FTW_DEPTH | FTW_PHYS);
+        }
+
+        const std::string& root() const { return mRoot; }
+
+        ///
+        /// @brief Add a function; an empty node or cpulist leaves the file out
+        ///
+
+        void add(const char* name, uint16_t vendor, uint16_t device, uint32_t classid, const char* node, const char* cpulist, bool nvme, const char* resource = NULL)
+        {
+            std::string path = mRoot + "/bus/pci/devices/" + name;
+            mkdir(path.c_str(), 0755);
+
+            char buf[256];
+            snprintf(buf, sizeof(buf), "0x%04x\n", vendor);
+            put(path + "/vendor", buf);
+            snprintf(buf, sizeof(buf), "0x%04x\n", device);
+            put(path + "/device", buf);
+            snprintf(buf, sizeof(buf), "0x%06x\n", classid);
+            put(path + "/class", buf);
+            put(path + "/subsystem_vendor", "0x8086\n");
+            put(path + "/subsystem_device", "0x0001\n");
+            if(*node)
+                put(path + "/numa_node", std::string(node) + "\n");
+            if(*cpulist)
+                put(path + "/local_cpulist", std::string(cpulist) + "\n");
+            put(path + "/resource", resource ? resource :
+                "0x00000000f0000000 0x00000000f0003fff 0x0000000000040200\n"
+                "0x0000000000000000 0x0000000000000000 0x0000000000000000\n"
+                "0x0000000000002000 0x000000000000201f 0x0000000000040101\n");
+            if(nvme && (symlink("../../../bus/pci/drivers/nvme", (path + "/driver").c_str()) < 0))
+                throw std::runtime_error("Test: Failed to link driver of " + path);
+        }
+
+        ///
+        /// @brief Add a file of size bytes of fill to a function, e.g. config or resource0
+        ///
+
+        std::string file(const char* name, const char* file, size_t size, uint8_t fill)
+        {
+            std::string path = mRoot + "/bus/pci/devices/" + name + "/" + file;
+            put(path, std::string(size, static_cast<char>(fill)));
+            return path;
+        }
+
+        ///
+        /// @brief Add a function to a synthetic Procfs under root()/proc; class 0 leaves its config out
+        ///
+
+        void proc(unsigned int bus, unsigned int devfn, uint32_t id, uint32_t classid)
+        {
+            std::string path = mRoot + "/proc";
+            const char* dir[] = { "", "/bus", "/bus/pci" };
+            for(size_t i = 0; i < sizeof(dir) / sizeof(dir[0]); i++)
+                mkdir((path + dir[i]).c_str(), 0755);
+
+            FILE* f = fopen((path + "/bus/pci/devices").c_str(), "a");
+            if(!f)
+                throw std::runtime_error("Test: Failed to create " + path);
+            fprintf(f, "%04x\t%08x\t0\tf0000000\t0\t0\t0\t0\t0\t0\t4000\t0\t0\t0\t0\t0\t0\n", (bus << 8) | devfn, id);
+            fclose(f);
+
+            if(!classid)
+                return;
+
+            char buf[64];
+            snprintf(buf, sizeof(buf), "/bus/pci/%02x", bus);
+            mkdir((path + buf).c_str(), 0755);
+            snprintf(buf, sizeof(buf), "/bus/pci/%02x/%02x.%x", bus, devfn >> 3, devfn & 0x7);
+
+            std::string config(64, '\0');
+            config[0x09] = static_cast<char>(classid);
+            config[0x0A] = static_cast<char>(classid >> 8);
+            config[0x0B] = static_cast<char>(classid >> 16);
+            put(path + buf, config);
+        }
+
+        ///
+        /// @brief Give a processor a cpufreq maximum in kHz, e.g. "3600000"
+        ///
+
+        void cpufreq(unsigned int id, const std::string& khz)
+        {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "/devices/system/cpu/cpu%u", id);
+            const char* dir[] = { "/devices", "/devices/system", "/devices/system/cpu", buf };
+            for(size_t i = 0; i < sizeof(dir) / sizeof(dir[0]); i++)
+                mkdir((mRoot + dir[i]).c_str(), 0755);
+            std::string path = mRoot + buf + "/cpufreq";
+            mkdir(path.c_str(), 0755);
+            put(path + "/cpuinfo_max_freq", khz + "\n");
+        }
+    };
+
+
+    ///
+    /// @brief Five functions, written out of location order
+    ///
+
+    void populate(Tree& tree)
+    {
+        tree.add("0000:03:00.0", 0x8086, 0x0953, 0x010802, "1", "8-15", true);
+        tree.add("0000:00:1f.3", 0x8086, 0x1234, 0x040300, "0", "0-7", false);
+        tree.add("0000:81:00.1", 0x15b3, 0x1017, 0x020000, "-1", "", false);
+        tree.add("0000:81:00.0", 0x15b3, 0x1017, 0x020000, "", "0-3,8-11", false);
+        tree.add("0000:00:02.0", 0x8086, 0x3e92, 0x030000, "0", "0-7", false);
+    }
+
+    const enzyme::pci::Device* find(enzyme::pci::Enumerator& e, const enzyme::pci::Location& loc)
+    {
+        std::pmr::list<enzyme::pci::Device>::const_iterator i;
+        for(i = e.device().begin(); i != e.device().end(); i++)
+        {
+            if(i->location() == loc)
+                return &*i;
+        }
+        return NULL;
+    }
+
+    std::vector<enzyme::pci::Location> locations(enzyme::pci::Enumerator& e)
+    {
+        std::vector<enzyme::pci::Location> result;
+        for(size_t i = 0; i < e.record().size(); i++)
+            result.push_back(enzyme::pci::location(e.record()[i]));
+        return result;
+    }
+
+    bool sorted(const std::vector<enzyme::pci::Location>& loc)
+    {
+        for(size_t i = 1; i < loc.size(); i++)
+        {
+            if(!(loc[i - 1] < loc[i]))
+                return false;
+        }
+        return true;
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    std::string lex(const enzyme::AutoLex& l)
+    {
+        std::ostringstream os;
+        os << l;
+        return os.str();
+    }
+
+    void test_set()
+    {
+        enzyme::cpu::Set s("0-7,16-23");
+        CHECK(s.count() == 16);
+        CHECK(s.test(0) && s.test(7) && s.test(16) && s.test(23));
+        CHECK(!s.test(8) && !s.test(15) && !s.test(24));
+        CHECK(lex(s) == "0-7,16-23");
+
+        // Sysfs lines end in a newline; single processors and ranges mix
+        enzyme::cpu::Set t("3,5-6,64\n");
+        CHECK(t.count() == 4);
+        CHECK(t.test(3) && t.test(5) && t.test(6) && t.test(64));
+        CHECK(lex(t) == "3,5-6,64");
+
+        CHECK(enzyme::cpu::Set("").empty());
+        CHECK(enzyme::cpu::Set("\n").empty());
+        CHECK(lex(enzyme::cpu::Set("")) == "");
+
+        CHECK((s & t) == enzyme::cpu::Set("3,5-6"));
+        CHECK(enzyme::cpu::Set("0-3") == enzyme::cpu::Set("0,1,2,3"));
+        CHECK(!(enzyme::cpu::Set("0-3") == enzyme::cpu::Set("0-4")));
+    }
+
+
+    void test_locality()
+    {
+        using enzyme::pci::Location;
+
+        Tree tree;
+        populate(tree);
+        enzyme::kernel::sysfs(tree.root());
+
+        {
+            enzyme::pci::os::Enumerator all;
+            CHECK(all.device().size() == 5);
+
+            const enzyme::pci::Device* nvme = find(all, Location(0, 0x03, 0x00, 0));
+            CHECK(nvme && (nvme->node() == 1));
+            CHECK(nvme && (nvme->localcpu() == enzyme::cpu::Set("8-15")));
+            CHECK(nvme && (nvme->service() == "nvme"));
+            CHECK(nvme && nvme->bar(0) && (nvme->bar(0)->size() == 0x4000) && !nvme->bar(1));
+            CHECK(nvme && nvme->iobar(2) && (nvme->iobar(2)->size() == 0x20));
+
+            // Unknown node, written as -1 or absent; absent cpulist is empty
+            const enzyme::pci::Device* nic1 = find(all, Location(0, 0x81, 0x00, 1));
+            CHECK(nic1 && (nic1->node() == -1) && nic1->localcpu().empty());
+            const enzyme::pci::Device* nic0 = find(all, Location(0, 0x81, 0x00, 0));
+            CHECK(nic0 && (nic0->node() == -1) && (nic0->localcpu() == enzyme::cpu::Set("0-3,8-11")));
+        }
+
+        enzyme::kernel::sysfs("/sys");
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    void test_procfs()
+    {
+        using enzyme::pci::Location;
+
+        Tree tree;
+        tree.proc(0x03, 0x00, 0x80861533, 0x020000);
+        tree.proc(0x04, 0x00, 0x80861534, 0);
+        tree.proc(0x00, 0x10, 0x80863e92, 0x030000);
+        enzyme::kernel::sysfs(tree.root() + "/absent");
+        enzyme::kernel::procfs(tree.root() + "/proc");
+
+        {
+            // The class comes from configuration space; 0 where that cannot be read
+            enzyme::pci::os::Enumerator all;
+            CHECK(all.record().size() == 3);
+            CHECK(sorted(locations(all)));
+            const enzyme::pci::Record* nic = all.record(Location(0, 0x03, 0x00, 0));
+            CHECK(nic && (nic->classid == 0x020000) && (nic->vendor == 0x8086) && (nic->device == 0x1533));
+            CHECK(nic && (enzyme::pci::barsize(*nic, 0) == 0x4000));
+            const enzyme::pci::Record* unknown = all.record(Location(0, 0x04, 0x00, 0));
+            CHECK(unknown && (unknown->classid == 0));
+            const enzyme::pci::Record* display = all.record(Location(0, 0x00, 0x02, 0));
+            CHECK(display && (display->classid == 0x030000));
+
+            // A function of unknown class is not taken for a network controller
+            enzyme::pci::Filter network;
+            network.classid(0x020000, 0xFF0000);
+            enzyme::pci::os::Enumerator e(network);
+            CHECK((e.record().size() == 1) && (enzyme::pci::location(e.record()[0]) == Location(0, 0x03, 0x00, 0)));
+
+            // Without a class mask it is kept
+            enzyme::pci::Filter intel;
+            intel.vendor(0x8086);
+            enzyme::pci::os::Enumerator v(intel);
+            CHECK(v.record().size() == 3);
+        }
+
+        enzyme::kernel::sysfs("/sys");
+        enzyme::kernel::procfs("/proc");
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    void enumerate_pci()
+    {
+        enzyme::Enumerator e;
+        e.pci();
+    }
+
+    void enumerate_concurrent()
+    {
+        enzyme::Enumerator e(enzyme::Enumerator::Concurrent);
+    }
+
+    void test_system()
+    {
+        Tree tree;
+        populate(tree);
+        enzyme::kernel::sysfs(tree.root());
+
+        {
+            // Each phase is timed separately; collection runs no enumeration of its own
+            enzyme::Enumerator e(enzyme::Enumerator::Concurrent);
+            enzyme::Timing t = e.timing();
+            CHECK(t.cpu && t.pci && !t.collect);
+            CHECK(t.constructor >= std::max(t.cpu, t.pci));
+            CHECK(!e.child().empty());
+            enzyme::Timing u = e.timing();
+            CHECK(u.collect && (u.cpu == t.cpu) && (u.pci == t.pci) && (u.constructor == t.constructor));
+        }
+
+        // A PCI bus directory that cannot be read fails enumeration, however it is started
+        Tree broken;
+        std::string devices = broken.root() + "/bus/pci/devices";
+        rmdir(devices.c_str());
+        close(open(devices.c_str(), O_CREAT | O_WRONLY, 0644));
+        enzyme::kernel::sysfs(broken.root());
+
+        CHECK(throws<std::runtime_error>(enumerate_pci));
+        long before = gBlocks.load();
+        CHECK(throws<std::runtime_error>(enumerate_concurrent));
+        CHECK(gBlocks.load() == before);
+
+        // Lazily, the CPU alone never touches PCI; PCI fails only when asked for
+        {
+            enzyme::Enumerator e;
+            bool threw = false;
+            try {
+                CHECK(!e.cpu().core().empty());
+            }
+            catch(std::exception&) {
+                threw = true;
+            }
+            CHECK(!threw);
+            CHECK(e.timing().cpu && !e.timing().pci && !e.timing().constructor);
+
+            threw = false;
+            try {
+                e.pci();
+            }
+            catch(std::runtime_error&) {
+                threw = true;
+            }
+            CHECK(threw);
+        }
+
+        enzyme::kernel::sysfs("/sys");
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    void test_record()
+    {
+        using enzyme::pci::Location;
+
+        Tree tree;
+        populate(tree);
+        enzyme::kernel::sysfs(tree.root());
+
+        {
+            enzyme::pci::os::Enumerator all;
+            std::vector<Location> loc = locations(all);
+            CHECK(loc.size() == 5);
+            CHECK(sorted(loc));
+
+            const enzyme::pci::Record* audio = all.record(Location(0, 0x00, 0x1f, 3));
+            CHECK(audio && (audio->classid == 0x040300) && (audio->vendor == 0x8086) && (audio->device == 0x1234));
+            CHECK(audio && (audio->subvendor == 0x8086) && (audio->subdevice == 0x0001) && (audio->node == 0));
+            CHECK(audio && (enzyme::pci::barsize(*audio, 0) == 0x4000) && (enzyme::pci::barsize(*audio, 1) == 0));
+            CHECK(audio && (audio->flag[2] & enzyme::pci::Record::BarIO) && (audio->base[2] == 0x2000));
+            CHECK(!all.record(Location(0, 0x00, 0x1f, 4)));
+
+            const enzyme::pci::Record* nic1 = all.record(Location(0, 0x81, 0x00, 1));
+            CHECK(nic1 && (nic1->node == -1));
+        }
+
+        enzyme::kernel::sysfs("/sys");
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    void test_filter()
+    {
+        using enzyme::pci::Location;
+
+        Tree tree;
+        populate(tree);
+        enzyme::kernel::sysfs(tree.root());
+
+        {
+            // Every filter keeps the matching functions, in the same order as a full scan
+            enzyme::pci::os::Enumerator all;
+            std::vector<Location> order = locations(all);
+
+            enzyme::pci::Filter intel;
+            intel.vendor(0x8086);
+            enzyme::pci::os::Enumerator e(intel);
+            std::vector<Location> loc = locations(e);
+            CHECK(loc.size() == 3);
+            CHECK(sorted(loc));
+            for(size_t i = 0; i < loc.size(); i++)
+                CHECK(std::find(order.begin(), order.end(), loc[i]) != order.end());
+
+            enzyme::pci::Filter network;
+            network.classid(0x020000, 0xFF0000);
+            enzyme::pci::os::Enumerator n(network);
+            loc = locations(n);
+            CHECK(loc.size() == 2);
+            CHECK(sorted(loc));
+            CHECK(n.device().size() == 2);
+
+            enzyme::pci::Filter bus0;
+            bus0.location([](const Location& l) { return l.bus() == 0; }).classid(0x030000, 0xFF0000);
+            enzyme::pci::os::Enumerator b(bus0);
+            CHECK((b.record().size() == 1) && (enzyme::pci::location(b.record()[0]) == Location(0, 0x00, 0x02, 0)));
+
+            enzyme::pci::Filter local;
+            local.where([](const enzyme::pci::Record& r) { return r.node == 0; });
+            enzyme::pci::os::Enumerator l(local);
+            CHECK(l.record().size() == 2);
+
+            enzyme::pci::Filter none;
+            none.vendor(0x1002);
+            enzyme::pci::os::Enumerator z(none);
+            CHECK(z.record().empty() && z.device().empty());
+
+            // Masked IDs
+            enzyme::pci::Filter family;
+            family.device(0x1000, 0xF000);
+            enzyme::pci::os::Enumerator f(family);
+            CHECK(f.record().size() == 3);
+        }
+
+        enzyme::kernel::sysfs("/sys");
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    ///
+    /// @brief Memory resource with an arbitrary base and size, never mapped
+    ///
+
+    class Window : public enzyme::mem::Resource
+    {
+    public:
+        Window(uintmax_t base, uintmax_t size)
+            : enzyme::mem::Resource(base, size, 0)
+        {
+        }
+
+        enzyme::mem::impl::Client* client(enzyme::mem::Cache, uintmax_t, uintmax_t) const
+        {
+            return NULL;
+        }
+    };
+
+    void test_index()
+    {
+        const uintmax_t top = std::numeric_limits<uintmax_t>::max();
+
+        Window outer(0x1000, 0x1000);
+        Window inner(0x1400, 0x100);
+        Window innermost(0x1480, 0x10);
+        Window overlap(0x1F00, 0x200);
+        Window high(top - 0xFFF, 0x1000);
+        Window wraps(top - 0xFF, 0x1000);
+        Window empty(0x5000, 0);
+
+        enzyme::mem::Index index;
+        CHECK(!index.find(0x1000));
+
+        index.insert(&outer, NULL);
+        index.insert(&inner, NULL);
+        index.insert(&innermost, NULL);
+        index.insert(&overlap, NULL);
+        index.insert(&high, NULL);
+        index.insert(&wraps, NULL);
+        index.insert(&empty, NULL);
+        index.build();
+
+        CHECK(index.size() == 6);
+        CHECK(!index.find(0x0FFF));
+        CHECK(index.find(0x1000) && (index.find(0x1000)->resource == &outer));
+        CHECK(index.find(0x1400) && (index.find(0x1400)->resource == &inner));
+        CHECK(index.find(0x1485) && (index.find(0x1485)->resource == &innermost));
+        CHECK(index.find(0x1490) && (index.find(0x1490)->resource == &inner));
+        CHECK(index.find(0x1500) && (index.find(0x1500)->resource == &outer));
+        CHECK(index.find(0x1FFF) && (index.find(0x1FFF)->resource == &overlap));
+        CHECK(index.find(0x20FF) && (index.find(0x20FF)->resource == &overlap));
+        CHECK(!index.find(0x2100));
+        CHECK(!index.find(0x5000));
+
+        // Ends at the top of the space are exact; an end past it saturates
+        CHECK(index.find(top) && (index.find(top)->resource == &wraps));
+        CHECK(index.find(top - 0x100) && (index.find(top - 0x100)->resource == &high));
+        CHECK(index.find(top - 0xFFF) && (index.find(top - 0xFFF)->resource == &high));
+        CHECK(!index.find(top - 0x1000));
+        CHECK(index.find(top - 0xFF)->last == top);
+
+        std::vector<const enzyme::mem::Index::Entry*> found;
+        CHECK(index.overlap(0x1470, 0x20, found) == 3);
+        found.clear();
+        CHECK(index.overlap(0x0, 0x1000, found) == 0);
+        found.clear();
+        CHECK(index.overlap(top - 1, 0x100, found) == 2);
+        found.clear();
+        CHECK(index.overlap(0x1000, 0, found) == 0);
+
+        std::vector<std::pair<const enzyme::mem::Index::Entry*, const enzyme::mem::Index::Entry*> > pairs;
+        CHECK(index.conflict(pairs) == 5);
+        CHECK(pairs.size() == 5);
+
+        // Many disjoint windows around a wide one; every lookup lands on the right one
+        std::vector<Window*> many;
+        enzyme::mem::Index big;
+        Window wide(0x100000, 0x100000);
+        big.insert(&wide, NULL);
+        for(unsigned int i = 0; i < 1000; i++)
+        {
+            many.push_back(new Window(0x100000 + i * 0x100, 0x80));
+            big.insert(many.back(), NULL);
+        }
+        big.build();
+        bool right = true;
+        for(unsigned int i = 0; i < 1000; i++)
+        {
+            right = right && (big.find(0x100000 + i * 0x100 + 0x40)->resource == many[i]);
+            right = right && (big.find(0x100000 + i * 0x100 + 0x80)->resource == &wide);
+        }
+        CHECK(right);
+        for(size_t i = 0; i < many.size(); i++)
+            delete many[i];
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    enzyme::mem::emu::Resource* gEmu = NULL;
+
+    void gather_past_end()
+    {
+        enzyme::mem::Client<uint32_t> client(*gEmu);
+        enzyme::mem::Program program;
+        program.push_back(0);
+        program.push_back(16);
+        uint32_t value[2];
+        client.read_gather(program, value);
+    }
+
+    void scatter_at_max()
+    {
+        enzyme::mem::Client<uint32_t> client(*gEmu);
+        enzyme::mem::Program program;
+        program.push_back(std::numeric_limits<size_t>::max());
+        uint32_t value = 0;
+        client.write_scatter(program, &value);
+    }
+
+    void scatter_wrapping()
+    {
+        // offset * sizeof(T) wraps to a small number
+        enzyme::mem::Client<uint32_t> client(*gEmu);
+        enzyme::mem::Program program;
+        program.push_back(std::numeric_limits<size_t>::max() / 4 + 1);
+        uint32_t value = 0;
+        client.write_scatter(program, &value);
+    }
+
+    void test_program()
+    {
+        enzyme::mem::Program empty;
+        CHECK(empty.empty() && empty.fits<uint32_t>(0));
+
+        enzyme::mem::Program max;
+        max.push_back(std::numeric_limits<size_t>::max());
+        CHECK(max.maxoffset() == std::numeric_limits<size_t>::max());
+        CHECK(!max.fits<uint8_t>(std::numeric_limits<uintmax_t>::max()));
+        CHECK(!max.fits<uint64_t>(std::numeric_limits<uintmax_t>::max()));
+
+        enzyme::mem::Program three;
+        three.push_back(3);
+        three.push_back(1);
+        CHECK((three.size() == 2) && (three.maxoffset() == 3));
+        CHECK(three.fits<uint32_t>(16) && !three.fits<uint32_t>(15));
+        CHECK(three.fits<uint64_t>(32) && !three.fits<uint64_t>(31));
+        three.clear();
+        CHECK(three.empty() && (three.maxoffset() == 0));
+
+        enzyme::mem::emu::Resource emu(64);
+        gEmu = &emu;
+        {
+            enzyme::mem::Client<uint32_t> client(emu);
+            std::vector<size_t> offset;
+            offset.push_back(15);
+            offset.push_back(0);
+            offset.push_back(7);
+            enzyme::mem::Program program(offset.begin(), offset.end());
+
+            uint32_t in[3] = { 0x11111111, 0x22222222, 0x33333333 };
+            uint32_t out[3] = { 0, 0, 0 };
+            client.write_scatter(program, in);
+            client.read_gather(program, out);
+            CHECK((out[0] == in[0]) && (out[1] == in[1]) && (out[2] == in[2]));
+            CHECK(client.read(15) == 0x11111111);
+        }
+        CHECK(throws<std::runtime_error>(gather_past_end));
+        CHECK(throws<std::runtime_error>(scatter_at_max));
+        CHECK(throws<std::runtime_error>(scatter_wrapping));
+        gEmu = NULL;
+    }
+
+
+    void test_batch()
+    {
+        // Merged runs land exactly where queued, at any alignment, and nowhere else
+        for(int cache = enzyme::mem::UC; cache <= enzyme::mem::WB; cache++)
+        {
+            enzyme::mem::emu::Resource emu(256);
+            enzyme::mem::Client<uint16_t> client(emu, static_cast<enzyme::mem::Cache>(cache));
+            {
+                enzyme::mem::Batch<uint16_t> batch(client);
+                for(size_t i = 3; i < 60; i++)
+                    batch.write(i, static_cast<uint16_t>(0x100 + i));
+                batch.write(90, 0x5A5A);
+                CHECK(batch.pending() == 58);
+            }
+
+            bool right = true;
+            for(size_t i = 0; i < 128; i++)
+            {
+                uint16_t want = ((i >= 3) && (i < 60)) ? static_cast<uint16_t>(0x100 + i) : ((i == 90) ? 0x5A5A : 0);
+                right = right && (client.read(i) == want);
+            }
+            CHECK(right);
+        }
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    void port_past_end()
+    {
+        enzyme::port::os::Resource uart(0, 0x2F8, 8);
+        enzyme::port::Client<uint16_t> client(uart);
+        client.write(4, 0);
+    }
+
+    void port_missing()
+    {
+        enzyme::port::os::Resource uart(0, 0x2F8, 8);
+        enzyme::port::Client<uint8_t> client(uart);
+    }
+
+    void test_port()
+    {
+        // An ordinary file stands in for /dev/port; the byte at offset N is port N
+        char path[] = "/tmp/enzyme_port.XXXXXX";
+        int fd = mkstemp(path);
+        CHECK(fd >= 0);
+        if(fd < 0)
+            return;
+        CHECK(ftruncate(fd, 0x400) == 0);
+        enzyme::kernel::devport(path);
+
+        {
+            enzyme::port::os::Resource uart(0, 0x2F8, 8);
+            enzyme::port::os::Resource bar(1, 0x300, 0x10);
+
+            enzyme::port::Client<uint8_t> c8(uart);
+            enzyme::port::Client<uint16_t> c16(bar);
+            enzyme::port::Client<uint32_t> c32(bar);
+            CHECK(!c8.direct() && !c16.direct() && !c32.direct());
+
+            c8.write(0, 0x41);
+            const uint8_t fifo[3] = { 'a', 'b', 'c' };
+            c8.write(1, 3, fifo);
+            c16.write(2, 0xBEEF);
+            c32.write(2, 0x12345678);
+
+            uint8_t file[0x20];
+            CHECK(pread(fd, file, 0x10, 0x2F8) == 0x10);
+            CHECK((file[0] == 0x41) && (file[1] == 'c') && (file[2] == 0));
+            CHECK(pread(fd, file, 0x10, 0x300) == 0x10);
+            CHECK((file[4] == 0xEF) && (file[5] == 0xBE));
+            CHECK((file[8] == 0x78) && (file[9] == 0x56) && (file[10] == 0x34) && (file[11] == 0x12));
+            CHECK((file[3] == 0) && (file[6] == 0) && (file[12] == 0));
+
+            // Reads, and block reads through one port
+            CHECK(c8.read(0) == 0x41);
+            CHECK(c16.read(2) == 0xBEEF);
+            CHECK(c32.read(2) == 0x12345678);
+            uint8_t in[3] = { 0, 0, 0 };
+            c8.read(1, 3, in);
+            CHECK((in[0] == 'c') && (in[1] == 'c') && (in[2] == 'c'));
+            uint16_t win[2] = { 0, 0 };
+            c16.read(4, 2, win);
+            CHECK((win[0] == 0x5678) && (win[1] == 0x5678));
+        }
+        CHECK(throws<std::runtime_error>(port_past_end));
+
+        close(fd);
+        unlink(path);
+        CHECK(throws<std::runtime_error>(port_missing));
+        enzyme::kernel::devport("/dev/port");
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    void test_msr()
+    {
+        // <root>/N/msr as regular files; a register is the 8 bytes at its address,
+        // so registers less than 8 apart would overlap
+        Tree tree;
+        enzyme::kernel::devcpu(tree.root());
+
+        {
+            enzyme::cpu::Enumerator cpu;
+            std::pmr::list<enzyme::cpu::Core>::const_iterator c;
+            for(c = cpu.core().begin(); c != cpu.core().end(); c++)
+            {
+                std::ostringstream dir;
+                dir << tree.root() << "/" << c->id();
+                mkdir(dir.str().c_str(), 0755);
+                int fd = open((dir.str() + "/msr").c_str(), O_RDWR | O_CREAT, 0644);
+                CHECK(fd >= 0);
+                uint64_t aperf = 0xA000 + c->id();
+                uint64_t tsc = 0xB000 + c->id();
+                CHECK(pwrite(fd, &tsc, 8, 0x10) == 8);
+                CHECK(pwrite(fd, &aperf, 8, 0xE8) == 8);
+                close(fd);
+            }
+
+            const enzyme::cpu::Core& first = cpu.core().front();
+            CHECK(first.rdmsr(0xE8) == 0xA000 + first.id());
+            first.wrmsr(0xE8, 0x1234);
+            CHECK(first.rdmsr(0xE8) == 0x1234);
+            first.wrmsr(0xE8, 0xA000 + first.id());
+
+            // Past the end of the file, as an unimplemented register would be
+            uint64_t value;
+            CHECK(!first.rdmsr(0x10000, value));
+
+            std::vector<uint32_t> msr;
+            msr.push_back(0xE8);
+            msr.push_back(0x10);
+            msr.push_back(0x10000);
+            std::vector<uint64_t> result;
+            CHECK(cpu.rdmsr(msr, result) == cpu.core().size());
+            CHECK(result.size() == 3 * cpu.core().size());
+
+            bool right = true;
+            size_t i = 0;
+            for(c = cpu.core().begin(); c != cpu.core().end(); c++, i += 3)
+                right = right && (result[i] == 0xA000 + c->id()) && (result[i + 1] == 0xB000 + c->id()) && (result[i + 2] == 0);
+            CHECK(right);
+        }
+
+        enzyme::kernel::devcpu("/dev/cpu");
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    void test_ring()
+    {
+        enzyme::mem::emu::Resource regs(64);
+        enzyme::mem::Client<uint32_t> doorbell(regs);
+
+        enzyme::ring::Ring<uint32_t> ring(8);
+        ring.doorbell(&doorbell, 1);
+        ring.timestamps(true);
+        CHECK((ring.capacity() == 7) && (ring.avail() == 7));
+
+        // Full: one slot stays empty
+        uint32_t in[16];
+        for(uint32_t i = 0; i < 16; i++)
+            in[i] = 100 + i;
+        CHECK(ring.enqueue(in, 10) == 7);
+        CHECK((ring.used() == 7) && (ring.avail() == 0));
+        CHECK(ring.enqueue(in + 7, 1) == 0);
+        CHECK(doorbell.read(1) == 7);
+
+        uint32_t out[16];
+        uint64_t stamp[16];
+        CHECK(ring.dequeue(out, 5, stamp) == 5);
+        CHECK((out[0] == 100) && (out[4] == 104));
+        CHECK(stamp[0] && (stamp[0] == stamp[4]));
+
+        // Wraps around the end of the descriptor array
+        CHECK(ring.enqueue(in + 7, 5) == 5);
+        CHECK(doorbell.read(1) == ((7 + 5) & 7));
+        CHECK(ring.dequeue(out, 16, stamp) == 7);
+        bool right = true;
+        for(uint32_t i = 0; i < 7; i++)
+            right = right && (out[i] == 105 + i);
+        CHECK(right);
+        CHECK(stamp[1] <= stamp[2]);
+        CHECK((ring.used() == 0) && (ring.dequeue(out, 1) == 0));
+
+        // A hardware consumer reports a masked index
+        CHECK(ring.enqueue(in, 6) == 6);
+        ring.consumed((ring.head() + 4) & ring.mask());
+        CHECK(ring.used() == 2);
+
+        // Every descriptor through an emulated device has its latency counted
+        enzyme::ring::Ring<uint32_t> big(64);
+        big.doorbell(&doorbell, 0);
+        enzyme::ring::Emulator<uint32_t> device(big, doorbell, 0, 16);
+        device.start();
+        uint32_t sent = 0;
+        while(sent < 1000)
+        {
+            sent += big.enqueue(in, std::min<uint32_t>(16, 1000 - sent));
+            std::this_thread::yield();
+        }
+        while(device.consumed() < 1000)
+            std::this_thread::yield();
+        device.stop();
+
+        uint64_t counted = 0;
+        for(unsigned int i = 0; i < enzyme::ring::Emulator<uint32_t>::Buckets; i++)
+            counted += device.latency(i);
+        CHECK((device.consumed() == 1000) && (counted == 1000));
+        CHECK(device.percentile(50) <= device.percentile(99));
+        CHECK(device.latency_max() <= device.latency_total());
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    void trace_oversize()
+    {
+        enzyme::trace::capacity(0x80000001u);
+    }
+
+    std::vector<enzyme::trace::Record> traced(const char* path)
+    {
+        std::vector<enzyme::trace::Record> result;
+        FILE* f = fopen(path, "rb");
+        if(!f)
+            return result;
+        enzyme::trace::Record r;
+        while(fread(&r, sizeof(r), 1, f) == 1)
+            result.push_back(r);
+        fclose(f);
+        return result;
+    }
+
+    void test_trace()
+    {
+        // A full ring drops, and keeps what it holds in order
+        enzyme::trace::Buffer buffer(5);
+        enzyme::trace::Record r;
+        memset(&r, 0, sizeof(r));
+        for(uint32_t i = 0; i < 10; i++)
+        {
+            r.offset = i;
+            buffer.push(r);
+        }
+        CHECK(buffer.dropped() == 2);
+        bool right = true;
+        for(uint32_t i = 0; i < 8; i++)
+            right = right && buffer.pop(r) && (r.offset == i);
+        CHECK(right);
+        CHECK(!buffer.pop(r));
+        buffer.push(r);
+        CHECK(buffer.pop(r) && (r.offset == 7));
+
+        CHECK(throws<std::runtime_error>(trace_oversize));
+
+        char path[] = "/tmp/enzyme_trace.XXXXXX";
+        int fd = mkstemp(path);
+        CHECK(fd >= 0);
+        if(fd < 0)
+            return;
+        close(fd);
+
+        // Start from empty rings, whatever was traced before
+        enzyme::trace::drain(path);
+        truncate(path, 0);
+        uint64_t before = enzyme::trace::dropped();
+
+        // Interleave two threads; the drained file is in timestamp order
+        uint32_t value = 0;
+        enzyme::trace::record(enzyme::trace::Port, 0x2F8, 1, &value, 1, true);
+        enzyme::trace::capacity(4);
+        std::thread other([]() {
+            uint32_t v = 0;
+            for(uint32_t i = 0; i < 10; i++)
+                enzyme::trace::record(enzyme::trace::Memory, 0xF0000000, 100 + i, &v, 4, false);
+        });
+        other.join();
+        enzyme::trace::record(enzyme::trace::Port, 0x2F8, 2, &value, 1, true);
+        enzyme::trace::capacity(1 << 16);
+
+        CHECK(enzyme::trace::drain(path) == 6);
+        std::vector<enzyme::trace::Record> file = traced(path);
+        CHECK(file.size() == 6);
+        right = file.size() == 6;
+        for(size_t i = 1; right && (i < file.size()); i++)
+            right = file[i - 1].tsc <= file[i].tsc;
+        CHECK(right);
+        CHECK((file.size() == 6) && (file[0].offset == 1) && (file[1].offset == 100) && (file[4].offset == 103) && (file[5].offset == 2));
+        CHECK((file.size() == 6) && (file[1].space == enzyme::trace::Memory) && (file[1].width == 4) && !file[1].write);
+
+        // The exited thread's ring was released with its losses counted
+        CHECK(enzyme::trace::dropped() - before == 6);
+        CHECK(enzyme::trace::drain(path) == 0);
+
+        // Client accesses are traced exactly when the library was built with ENZYME_TRACE
+        enzyme::mem::emu::Resource regs(64);
+        enzyme::mem::Client<uint32_t> client(regs, enzyme::mem::UC);
+        uint32_t block[4] = { 1, 2, 3, 4 };
+        client.write(2, 4, block);
+        client.read(2, 4, block);
+        CHECK(enzyme::trace::drain(path) == (enzyme::trace::gEnabled ? 8u : 0u));
+        unlink(path);
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    const enzyme::pci::Device* gMapped = NULL;
+
+    void map_absent()
+    {
+        enzyme::pci::Client client(*gMapped);
+        client.bar<uint32_t>(1);
+    }
+
+    void map_remap()
+    {
+        enzyme::pci::Client client(*gMapped);
+        client.map(2, enzyme::mem::WC);
+        client.bar<uint8_t>(2);
+        client.map(2, enzyme::mem::UC);
+    }
+
+    void map_exclusive()
+    {
+        enzyme::pci::Client first(*gMapped, true, true);
+        enzyme::pci::Client second(*gMapped, true, true);
+    }
+
+    void test_map()
+    {
+        using enzyme::pci::Location;
+
+        // Registers in BAR 0, a prefetchable BAR 2 with a _wc file, an I/O BAR 4
+        Tree tree;
+        tree.add("0000:05:00.0", 0x8086, 0x1572, 0x020000, "0", "0-7", false,
+                 "0x00000000f1000000 0x00000000f1003fff 0x0000000000040200\n"
+                 "0x0000000000000000 0x0000000000000000 0x0000000000000000\n"
+                 "0x0000380000000000 0x000038000000ffff 0x000000000014220c\n"
+                 "0x0000000000000000 0x0000000000000000 0x0000000000000000\n"
+                 "0x0000000000003000 0x000000000000301f 0x0000000000040101\n");
+        std::string config = tree.file("0000:05:00.0", "config", 256, 0);
+        std::string regs = tree.file("0000:05:00.0", "resource0", 0x4000, 0);
+        tree.file("0000:05:00.0", "resource2", 0x10000, 0xAA);
+        tree.file("0000:05:00.0", "resource2_wc", 0x10000, 0xBB);
+        {
+            int fd = open(config.c_str(), O_WRONLY);
+            uint16_t vendor = 0x8086;
+            CHECK(pwrite(fd, &vendor, 2, 0) == 2);
+            close(fd);
+        }
+        enzyme::kernel::sysfs(tree.root());
+
+        {
+            enzyme::pci::os::Enumerator e;
+            const enzyme::pci::Device* dev = find(e, Location(0, 0x05, 0x00, 0));
+            CHECK(dev && dev->bar(0) && dev->bar(2) && !dev->bar(1) && dev->iobar(4));
+            if(!dev)
+                return;
+            gMapped = dev;
+
+            {
+                // Configuration space alone maps nothing
+                enzyme::pci::Client client(*dev);
+                CHECK(client.cfgr16(0) == 0x8086);
+                CHECK(!client.mapped(0) && !client.mapped(2));
+
+                // By index: WC maps the _wc file, on first access
+                client.map(2, enzyme::mem::WC);
+                CHECK(!client.mapped(2));
+                CHECK(client.bar<uint32_t>(2).read(0) == 0xBBBBBBBB);
+                CHECK(client.mapped(2) && (client.bar<uint32_t>(2).cache() == enzyme::mem::WC));
+                CHECK(client.bar<uint8_t>(2).read(0xFFFF) == 0xBB);
+
+                // Registers default to UC, and all widths share one mapping
+                client.bar<uint32_t>(0).write(1, 0x12345678);
+                CHECK(client.bar<uint8_t>(0).read(4) == 0x78);
+                CHECK(client.mmreg32().read(1) == 0x12345678);
+                CHECK(!client.mapped(4));
+            }
+
+            int fd = open(regs.c_str(), O_RDONLY);
+            uint32_t value = 0;
+            CHECK((pread(fd, &value, 4, 4) == 4) && (value == 0x12345678));
+            close(fd);
+
+            {
+                // By predicate: every prefetchable BAR
+                enzyme::pci::Client client(*dev);
+                unsigned int n = client.map([](const enzyme::mem::Resource& r, unsigned int) { return (r.flag() & 0x08) != 0; }, enzyme::mem::WC);
+                CHECK(n == 1);
+                CHECK(!client.mapped(2));
+                CHECK(client.bar<uint16_t>(2).read(0) == 0xBBBB);
+                CHECK(client.bar<uint32_t>(0).cache() == enzyme::mem::UC);
+                CHECK(client.find([](const enzyme::mem::Resource& r, unsigned int) { return r.size() == 0x10000; }) == 2);
+            }
+
+            {
+                enzyme::pci::Client client(*dev);
+                CHECK(client.bar<uint64_t>(2).read(0) == 0xAAAAAAAAAAAAAAAAULL);
+            }
+
+            CHECK(throws<std::runtime_error>(map_absent));
+            CHECK(throws<std::logic_error>(map_remap));
+            CHECK(throws<std::runtime_error>(map_exclusive));
+            {
+                enzyme::pci::Client first(*dev, true, true);
+                enzyme::pci::Client shared(*dev);
+            }
+            {
+                enzyme::pci::Client again(*dev, true, true);
+            }
+            gMapped = NULL;
+        }
+
+        enzyme::kernel::sysfs("/sys");
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    ///
+    /// @brief Every kernel of every variant against the base, at every alignment
+    ///
+    /// Sources and destinations start at each offset within a 64 byte line,
+    /// so the vector loops, their tails and any unaligned head are all run;
+    /// lengths cover 0..257, past two of the widest (256 byte) loop steps.
+    ///
+
+    void test_simd()
+    {
+        const char* digits = "123456789";
+        CHECK(enzyme::simd::checksum(digits, 9) == 0xE3069283);
+        CHECK(enzyme::simd::checksum(digits + 4, 5, enzyme::simd::checksum(digits, 4)) == 0xE3069283);
+
+        std::vector<enzyme::simd::Dispatch> variant = enzyme::simd::variants();
+        CHECK(!variant.empty() && (strcmp(variant[0].copyname, "base") == 0));
+        const enzyme::simd::Dispatch& base = variant[0];
+
+        const size_t Max = 257;
+        const size_t Guard = 64;
+        std::vector<uint8_t> src(Max + 2 * Guard);
+        std::vector<uint8_t> dst(Max + 2 * Guard);
+        std::vector<uint8_t> other(Max + 2 * Guard);
+        for(size_t i = 0; i < src.size(); i++)
+            src[i] = static_cast<uint8_t>(i * 7 + 1);
+
+        for(size_t v = 0; v < variant.size(); v++)
+        {
+            const enzyme::simd::Dispatch& d = variant[v];
+            bool copied = true;
+            bool compared = true;
+            bool summed = true;
+
+            for(size_t len = 0; len <= Max; len++)
+            {
+                for(size_t head = 0; head < Guard; head += ((head < 9) ? 1 : 9))
+                {
+                    // Copy writes exactly len bytes, leaving both guards intact
+                    size_t to = Guard - head;
+                    std::fill(dst.begin(), dst.end(), 0xEE);
+                    d.copy(&dst[to], &src[head], len);
+                    copied = copied && std::equal(src.begin() + head, src.begin() + head + len, dst.begin() + to);
+                    copied = copied && (std::count(dst.begin(), dst.begin() + to, 0xEE) == static_cast<ptrdiff_t>(to));
+                    copied = copied && (std::count(dst.begin() + to + len, dst.end(), 0xEE) == static_cast<ptrdiff_t>(dst.size() - to - len));
+
+                    // Compare finds a difference at every position, and none in equal buffers
+                    std::copy(src.begin() + head, src.begin() + head + len, other.begin() + to);
+                    compared = compared && (d.compare(&src[head], &other[to], len) == len);
+                    for(size_t at = 0; at < len; at++)
+                    {
+                        other[to + at] ^= 0x40;
+                        compared = compared && (d.compare(&src[head], &other[to], len) == at) && (base.compare(&src[head], &other[to], len) == at);
+                        other[to + at] ^= 0x40;
+                    }
+
+                    summed = summed && (d.checksum(0, &src[head], len) == base.checksum(0, &src[head], len));
+                    summed = summed && (d.checksum(0x12345678, &src[head], len) == base.checksum(0x12345678, &src[head], len));
+                }
+            }
+
+            if(!copied || !compared || !summed)
+                fprintf(stderr, "enzyme_test: simd variant %s/%s/%s differs from base\n", d.copyname, d.comparename, d.checksumname);
+            CHECK(copied);
+            CHECK(compared);
+            CHECK(summed);
+        }
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    void test_snapshot()
+    {
+        Tree tree;
+        populate(tree);
+        enzyme::kernel::sysfs(tree.root());
+
+        {
+            enzyme::Tree snapshots(enzyme::Enumerator::Lazy);
+            {
+                enzyme::Tree::View v = snapshots.view();
+                CHECK(v->generation() == 1);
+                CHECK(std::is_const<std::remove_reference<decltype(v->pci())>::type>::value);
+                CHECK(std::is_const<std::remove_reference<decltype(v->cpu())>::type>::value);
+                CHECK((std::is_same<decltype(v->child()), const std::list<const enzyme::Device*>&>::value));
+            }
+
+            // Readers walk whichever snapshot is current while it is replaced under them
+            std::atomic<bool> stop(false);
+            std::atomic<uint64_t> views(0);
+            std::atomic<uint64_t> bad(0);
+            std::vector<std::thread> reader;
+            for(unsigned int t = 0; t < 3; t++)
+            {
+                reader.push_back(std::thread([&]()
+                {
+                    uint64_t last = 0;
+                    while(!stop.load())
+                    {
+                        enzyme::Tree::View v = snapshots.view();
+                        enzyme::Tree::View copy(v);
+                        const enzyme::pci::Enumerator& pci = copy->pci();
+                        if((v->generation() < last) || (pci.record().size() != 5) || (pci.device().size() != 5) || v->child().empty())
+                            bad++;
+                        last = v->generation();
+                        views++;
+                    }
+                }));
+            }
+
+            // The Sysfs root is redirected (to itself) while rescans read it
+            std::thread writer([&]()
+            {
+                while(!stop.load())
+                {
+                    enzyme::kernel::sysfs(tree.root());
+                    std::this_thread::yield();
+                }
+            });
+
+            for(uint64_t i = 0; i < 20; i++)
+                CHECK(snapshots.rescan() == i + 2);
+            while(views.load() < 100)
+                std::this_thread::yield();
+
+            stop.store(true);
+            writer.join();
+            for(size_t t = 0; t < reader.size(); t++)
+                reader[t].join();
+            CHECK(bad.load() == 0);
+            CHECK(snapshots.view()->generation() == 21);
+        }
+
+        enzyme::kernel::sysfs("/sys");
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    enzyme::cpu::Set only(unsigned int id)
+    {
+        enzyme::cpu::Set set;
+        set.set(id);
+        return set;
+    }
+
+    void fail()
+    {
+        throw std::runtime_error("Test: Worker failure");
+    }
+
+    void test_worker()
+    {
+        enzyme::cpu::Set saved = enzyme::cpu::Set::affinity();
+        enzyme::cpu::Enumerator* cpu = new enzyme::cpu::Enumerator;
+        const enzyme::cpu::Core* last = cpu->ordered().back();
+
+        // Each guard narrows the mask for its lifetime and restores what was there before
+        {
+            enzyme::cpu::Affinity pin(*last);
+            CHECK(enzyme::cpu::Set::affinity() == only(last->id()));
+            {
+                enzyme::cpu::Affinity wide(saved);
+                CHECK(enzyme::cpu::Set::affinity() == saved);
+            }
+            CHECK(enzyme::cpu::Set::affinity() == only(last->id()));
+        }
+        CHECK(enzyme::cpu::Set::affinity() == saved);
+
+        // The worker keeps only the core id, so it outlives the enumerator
+        unsigned int id = last->id();
+        enzyme::cpu::Worker worker(*last);
+        delete cpu;
+        CHECK(worker.pinned() && (worker.id() == id));
+
+        std::vector<unsigned int> order;
+        std::vector<std::future<unsigned int> > done;
+        for(unsigned int i = 0; i < 100; i++)
+            done.push_back(worker.submit([&order, i]() { order.push_back(i); return i; }));
+        std::future<void> failed = worker.submit(fail);
+        std::future<enzyme::cpu::Set> mask = worker.submit([]() { return enzyme::cpu::Set::affinity(); });
+
+        bool right = true;
+        for(unsigned int i = 0; i < done.size(); i++)
+            right = right && (done[i].get() == i);
+        CHECK(right && (order.size() == 100));
+        for(unsigned int i = 0; i < order.size(); i++)
+            right = right && (order[i] == i);
+        CHECK(right);
+
+        bool threw = false;
+        try {
+            failed.get();
+        }
+        catch(std::runtime_error&) {
+            threw = true;
+        }
+        CHECK(threw);
+        CHECK(mask.get() == only(id));
+        CHECK(enzyme::cpu::Set::affinity() == saved);
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    void test_activecore()
+    {
+        enzyme::cpu::Enumerator cpu;
+        std::list<const enzyme::cpu::Core*> allowed = cpu.allowed();
+        CHECK(!allowed.empty());
+
+        // Pinned, the fast lookup must name the processor the kernel reports
+        bool right = true;
+        std::list<const enzyme::cpu::Core*>::const_iterator c;
+        for(c = allowed.begin(); c != allowed.end(); c++)
+        {
+            enzyme::cpu::Affinity pin(**c);
+            const enzyme::cpu::Core* active = cpu.activecore();
+            right = right && (enzyme::cpu::current() == static_cast<unsigned int>(sched_getcpu()));
+            right = right && active && (active->id() == (*c)->id());
+        }
+        CHECK(right);
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    void test_corelocal()
+    {
+        enzyme::cpu::Enumerator cpu;
+        const std::pmr::list<enzyme::cpu::Core>& cores = cpu.core();
+        std::pmr::list<enzyme::cpu::Core>::const_iterator c;
+
+        // One cache line aligned slot per core, and a spare
+        enzyme::cpu::CoreLocal<uint64_t> counts(cpu, 0);
+        CHECK(counts.size() == cores.size() + 1);
+        uint64_t n = 0;
+        bool aligned = true;
+        for(c = cores.begin(); c != cores.end(); c++)
+        {
+            counts[*c] = ++n;
+            aligned = aligned && !(reinterpret_cast<uintptr_t>(&counts[*c]) % ENZYME_CACHELINE);
+        }
+        CHECK(aligned);
+
+        // A processor that was not enumerated gets the spare slot
+        enzyme::StringLex none;
+        enzyme::cpu::Core stranger(100000, none, none, none);
+        counts[stranger] = 1000;
+        CHECK(&counts[stranger] != &counts[cores.front()]);
+        CHECK(counts.sum() == n * (n + 1) / 2 + 1000);
+        CHECK(counts.max() == 1000);
+        counts[stranger] = 0;
+        CHECK(counts.max() == n);
+
+        {
+            enzyme::cpu::Affinity pin(cores.front());
+            CHECK(&counts.local() == &counts[cores.front()]);
+        }
+
+        // Threads add into whichever slot they run on; merge() sees every one
+        enzyme::cpu::CoreLocal<std::atomic<uint64_t> > hits(cpu);
+        std::vector<std::thread> adder;
+        for(unsigned int t = 0; t < 4; t++)
+        {
+            adder.push_back(std::thread([&hits]()
+            {
+                for(unsigned int i = 0; i < 1000; i++)
+                    hits.local().fetch_add(1, std::memory_order_relaxed);
+            }));
+        }
+        for(size_t t = 0; t < adder.size(); t++)
+            adder[t].join();
+        CHECK(hits.merge(uint64_t(0), [](uint64_t& acc, const std::atomic<uint64_t>& v) { acc += v.load(); }) == 4000);
+
+        // Without an enumerator, one slot per configured processor
+        enzyme::cpu::CoreLocal<uint64_t> configured;
+        CHECK(configured.size() == enzyme::cpu::Set::configured().count() + 1);
+        CHECK(configured.sum() == 0);
+    }
+
+
+    // -----------------------------------------------------------------------
+
+
+    ///
+    /// @brief Faster first; a class per distinct (type, frequency); faster cores of a type in lower classes
+    ///
+
+    bool ranked(const enzyme::cpu::Enumerator& cpu)
+    {
+        bool right = true;
+        std::list<const enzyme::cpu::Core*> order = cpu.ordered();
+        std::list<const enzyme::cpu::Core*>::const_iterator a, b;
+        for(a = order.begin(); a != order.end(); a++)
+        {
+            for(b = order.begin(); b != order.end(); b++)
+            {
+                if((*a)->type() != (*b)->type())
+                    continue;
+                if((*a)->maxfreq() > (*b)->maxfreq())
+                    right = right && ((*a)->performance() < (*b)->performance());
+                if((*a)->maxfreq() == (*b)->maxfreq())
+                    right = right && ((*a)->performance() == (*b)->performance());
+            }
+        }
+
+        unsigned int cls = 0;
+        for(a = order.begin(); a != order.end(); a++)
+        {
+            right = right && ((*a)->performance() >= cls);
+            cls = (*a)->performance();
+        }
+
+        std::vector<std::list<const enzyme::cpu::Core*> > group = cpu.classes();
+        size_t cnt = 0;
+        for(size_t g = 0; g < group.size(); g++)
+        {
+            cnt += group[g].size();
+            right = right && !group[g].empty();
+            if(g && !group[g].empty() && !group[g - 1].empty())
+                right = right && (group[g - 1].front()->performance() < group[g].front()->performance());
+        }
+        return right && (cnt == order.size()) && (!order.empty()) && (order.front()->performance() == 0);
+    }
+
+    void test_rank()
+    {
+        unsigned int limit = enzyme::cpu::Set::configured().limit();
+
+        // Slower with each processor id
+        {
+            Tree tree;
+            for(unsigned int id = 0; id < limit; id++)
+                tree.cpufreq(id, std::to_string(1000000 + (limit - id) * 100000));
+            enzyme::kernel::sysfs(tree.root());
+
+            enzyme::cpu::Enumerator cpu;
+            bool read = true;
+            std::pmr::list<enzyme::cpu::Core>::const_iterator c;
+            for(c = cpu.core().begin(); c != cpu.core().end(); c++)
+                read = read && (c->maxfreq() == 1000000 + (limit - c->id()) * 100000);
+            CHECK(read);
+            CHECK(ranked(cpu));
+        }
+
+        // Faster with each processor id, so the order turns over within a type
+        {
+            Tree tree;
+            for(unsigned int id = 0; id < limit; id++)
+                tree.cpufreq(id, std::to_string(1000000 + id * 100000));
+            enzyme::kernel::sysfs(tree.root());
+
+            enzyme::cpu::Enumerator cpu;
+            CHECK(ranked(cpu));
+            const enzyme::cpu::Core* first = cpu.ordered().front();
+            std::list<const enzyme::cpu::Core*> allowed = cpu.allowed();
+            std::list<const enzyme::cpu::Core*>::const_iterator c;
+            bool fastest = true;
+            for(c = allowed.begin(); c != allowed.end(); c++)
+            {
+                if((*c)->type() == first->type())
+                    fastest = fastest && ((*c)->maxfreq() <= first->maxfreq());
+            }
+            CHECK(fastest);
+        }
+
+        // Unreadable or absent frequencies are unknown, 0, and rank alike
+        {
+            Tree tree;
+            for(unsigned int id = 0; id < limit; id++)
+                tree.cpufreq(id, (id % 2) ? "fast" : "");
+            enzyme::kernel::sysfs(tree.root());
+
+            enzyme::cpu::Enumerator cpu;
+            bool unknown = true;
+            std::pmr::list<enzyme::cpu::Core>::const_iterator c;
+            for(c = cpu.core().begin(); c != cpu.core().end(); c++)
+                unknown = unknown && (c->maxfreq() == 0);
+            CHECK(unknown);
+            CHECK(ranked(cpu));
+        }
+
+        {
+            Tree tree;
+            enzyme::kernel::sysfs(tree.root());
+            enzyme::cpu::Enumerator cpu;
+            CHECK(cpu.core().front().maxfreq() == 0);
+        }
+
+        enzyme::kernel::sysfs("/sys");
+    }
+};
+
+
+// ---------------------------------------------------------------------------
 
 
 int main()
 {
-    enzyme::Enumerator root;
+    try {
+        test_set();
+        test_locality();
+        test_record();
+        test_procfs();
+        test_system();
+        test_filter();
+        test_index();
+        test_program();
+        test_batch();
+        test_port();
+        test_msr();
+        test_ring();
+        test_trace();
+        test_map();
+        test_simd();
+        test_snapshot();
+        test_worker();
+        test_activecore();
+        test_corelocal();
+        test_rank();
+
+        // The real tree, whatever it holds, enumerates without throwing
+        enzyme::Enumerator root;
+        CHECK(!root.child().empty());
+    }
+    catch(std::exception& e) {
+        fprintf(stderr, "enzyme_test: %s\n", e.what());
+        gFailures++;
+    }
 
+    printf("enzyme_test: %u checks, %u failed\n", gChecks, gFailures);
+    return gFailures ? 1 : 0;
 }
@@ -0,0 +1,203 @@
+///
+/// @file    enzyme_trace.cpp
+/// @brief   Enzyme Hardware Abstraction Layer: Register Access Trace
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#include "enzyme_trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+// ---------------------------------------------------------------------------
+
+
+namespace enzyme
+{
+    namespace trace
+    {
+        thread_local Buffer* gBuffer = NULL;
+
+#ifdef ENZYME_TRACE
+        const bool gEnabled = true;
+#else
+        const bool gEnabled = false;
+#endif
+
+        static std::mutex gLock;
+        static std::list<Buffer*> gList;
+        static const uint32_t gMaxCapacity = 0x80000000u;
+        static std::atomic<uint32_t> gCapacity(1 << 16);
+        static uint64_t gDropped = 0;
+
+
+        ///
+        /// @brief Hands the calling thread's ring to drain() when the thread exits
+        ///
+
+        class Owner
+        {
+        public:
+            ~Owner()
+            {
+                if(gBuffer)
+                    gBuffer->orphan(true);
+                gBuffer = NULL;
+            }
+        };
+
+        static thread_local Owner gOwner;
+
+
+        static bool earlier(const Record& a, const Record& b)
+        {
+            return a.tsc < b.tsc;
+        }
+    };
+};
+
+
+// ---------------------------------------------------------------------------
+
+
+///
+/// @brief Allocate a record ring of count (rounded up to a power of two, at most 2^31) entries
+///
+
+enzyme::trace::Buffer::Buffer(uint32_t count)
+    : mHead(0)
+    , mTail(0)
+    , mDropped(0)
+    , mOrphan(false)
+{
+    // Past 2^31 the rounding below would wrap to 0 and never end
+    if(count > gMaxCapacity)
+        count = gMaxCapacity;
+
+    uint32_t size = 1;
+    while(size < count)
+        size <<= 1;
+
+    mRecord = new Record[size];
+    mMask = size - 1;
+}
+
+
+enzyme::trace::Buffer::~Buffer()
+{
+    delete [] mRecord;
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+///
+/// @brief Register a ring for the calling thread on its first traced access
+///
+
+enzyme::trace::Buffer* enzyme::trace::attach()
+{
+    (void)&gOwner;
+
+    Buffer* b = new Buffer(gCapacity.load(std::memory_order_relaxed));
+    {
+        std::lock_guard<std::mutex> lock(gLock);
+        gList.push_back(b);
+    }
+
+    gBuffer = b;
+    return b;
+}
+
+
+void enzyme::trace::block(Space space, uint64_t device, size_t offset, size_t stride, const void* value, size_t cnt, size_t width, bool write)
+{
+    const uint8_t* v = static_cast<const uint8_t*>(value);
+    for(size_t i = 0; i < cnt; i++)
+        record(space, device, offset + i * stride, v + i * width, width, write);
+}
+
+
+void enzyme::trace::gather(Space space, uint64_t device, const size_t* offset, const void* value, size_t cnt, size_t width, bool write)
+{
+    const uint8_t* v = static_cast<const uint8_t*>(value);
+    for(size_t i = 0; i < cnt; i++)
+        record(space, device, offset[i], v + i * width, width, write);
+}
+
+
+void enzyme::trace::capacity(uint32_t count)
+{
+    if(count > gMaxCapacity)
+        throw std::runtime_error("Trace: Ring size exceeds 2^31 records");
+    gCapacity.store(count ? count : 1, std::memory_order_relaxed);
+}
+
+
+///
+/// @brief Drain every ring, merge by timestamp and append to a binary file
+///
+
+size_t enzyme::trace::drain(const char* path)
+{
+    std::vector<Record> merged;
+    {
+        std::lock_guard<std::mutex> lock(gLock);
+
+        std::list<Buffer*>::iterator i = gList.begin();
+        while(i != gList.end())
+        {
+            // An orphan records nothing further, so it can be released once emptied
+            bool orphan = (*i)->orphan();
+
+            // Each ring is already in timestamp order; merge it into the result
+            size_t mid = merged.size();
+            Record r;
+            while((*i)->pop(r))
+                merged.push_back(r);
+            std::inplace_merge(merged.begin(), merged.begin() + mid, merged.end(), earlier);
+
+            if(orphan)
+            {
+                gDropped += (*i)->dropped();
+                delete *i;
+                i = gList.erase(i);
+            }
+            else
+                i++;
+        }
+    }
+
+    if(merged.empty())
+        return 0;
+
+    std::ofstream os(path, std::ios::out | std::ios::binary | std::ios::app);
+    os.write(reinterpret_cast<const char*>(&merged[0]), merged.size() * sizeof(Record));
+    if(!os)
+        throw std::runtime_error("Trace: Failed to write " + std::string(path));
+
+    return merged.size();
+}
+
+
+uint64_t enzyme::trace::dropped()
+{
+    std::lock_guard<std::mutex> lock(gLock);
+
+    uint64_t total = gDropped;
+    std::list<Buffer*>::const_iterator i;
+    for(i = gList.begin(); i != gList.end(); i++)
+        total += (*i)->dropped();
+    return total;
+}
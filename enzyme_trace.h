@@ -0,0 +1,209 @@
+///
+/// @file    enzyme_trace.h
+/// @brief   Enzyme Hardware Abstraction Layer: Register Access Trace
+///
+/// Tracing is compiled into the library only when ENZYME_TRACE is defined.
+/// Each thread records accesses into its own preallocated ring without
+/// locking; drain() merges the rings in timestamp order into a binary file.
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef _enzyme_trace_h_
+#define _enzyme_trace_h_
+
+
+#include "enzyme_type.h"
+#include "enzyme_tsc.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+
+
+namespace enzyme
+{
+    namespace trace
+    {
+
+        ///
+        /// @brief Address space of a traced access
+        ///
+
+        typedef enum
+        {
+            Memory, Port, Config
+        }
+        Space;
+
+
+        ///
+        /// @brief Traced access, as written to the trace file
+        ///
+        /// The device is the physical base of the memory or port resource for
+        /// Memory/Port accesses, and the PCI location for Config accesses.
+        ///
+
+        typedef struct
+        {
+            uint64_t tsc;
+            uint64_t device;
+            uint64_t value;
+            uint32_t offset;
+            uint8_t  space;
+            uint8_t  width;
+            uint8_t  write;
+            uint8_t  reserved;
+        }
+        Record;
+
+
+        ///
+        /// @brief Per-thread single producer, single consumer record ring
+        ///
+
+        class Buffer
+        {
+        private:
+            Record* mRecord;
+            uint32_t mMask;
+
+            alignas(ENZYME_CACHELINE) std::atomic<uint32_t> mHead;     // Written by drain()
+            alignas(ENZYME_CACHELINE) std::atomic<uint32_t> mTail;     // Written by owning thread
+            std::atomic<uint64_t> mDropped;
+            std::atomic<bool> mOrphan;
+
+            Buffer(const Buffer&);
+            Buffer& operator=(const Buffer&);
+
+        public:
+            Buffer(uint32_t count);
+            ~Buffer();
+
+            void push(const Record& record)
+            {
+                uint32_t tail = mTail.load(std::memory_order_relaxed);
+                if(tail - mHead.load(std::memory_order_acquire) > mMask)
+                {
+                    mDropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                mRecord[tail & mMask] = record;
+                mTail.store(tail + 1, std::memory_order_release);
+            }
+
+            bool pop(Record& record)
+            {
+                uint32_t head = mHead.load(std::memory_order_relaxed);
+                if(head == mTail.load(std::memory_order_acquire))
+                    return false;
+                record = mRecord[head & mMask];
+                mHead.store(head + 1, std::memory_order_release);
+                return true;
+            }
+
+            uint64_t dropped()  const { return mDropped.load(std::memory_order_relaxed); }
+            bool orphan()       const { return mOrphan.load(std::memory_order_acquire); }
+            void orphan(bool o)       { mOrphan.store(o, std::memory_order_release); }
+        };
+
+
+        extern thread_local Buffer* gBuffer;
+
+        Buffer* attach();
+
+
+        ///
+        /// @brief True if the library was built with ENZYME_TRACE
+        ///
+        /// Inline accessors (the mem and port Client templates) test this and
+        /// call block() or gather() rather than testing the macro, so their
+        /// definition is the same in every translation unit.
+        ///
+
+        extern const bool gEnabled;
+
+        /// @brief Record cnt accesses of width bytes at offset, offset + stride, ...
+        void block(Space space, uint64_t device, size_t offset, size_t stride, const void* value, size_t cnt, size_t width, bool write);
+
+        /// @brief Record cnt accesses of width bytes at a list of offsets
+        void gather(Space space, uint64_t device, const size_t* offset, const void* value, size_t cnt, size_t width, bool write);
+
+
+        ///
+        /// @brief Per-thread ring size in records; applies to threads that have not yet traced
+        ///
+        /// Rounded up to a power of two; throws if above 2^31.
+        ///
+
+        void capacity(uint32_t count);
+
+
+        ///
+        /// @brief Merge all thread rings in timestamp order and append to a binary file
+        ///
+        /// Returns the number of records written. Records of threads that have
+        /// exited are drained and their rings released.
+        ///
+
+        size_t drain(const char* path);
+
+
+        ///
+        /// @brief Total records lost to full rings
+        ///
+
+        uint64_t dropped();
+
+
+        ///
+        /// @brief Record timestamp; convert with tsc::cycles_to_ns()
+        ///
+
+        inline uint64_t tsc()
+        {
+            return enzyme::tsc::read();
+        }
+
+
+        ///
+        /// @brief Record one access of width bytes from the calling thread
+        ///
+        /// Only the first 8 bytes of wider (configuration block) accesses are kept.
+        ///
+
+        inline void record(Space space, uint64_t device, size_t offset, const void* value, size_t width, bool write)
+        {
+            Buffer* b = gBuffer;
+            if(!b)
+                b = attach();
+
+            Record r;
+            r.tsc = tsc();
+            r.device = device;
+            r.value = 0;
+            memcpy(&r.value, value, (width < sizeof(r.value)) ? width : sizeof(r.value));
+            r.offset = static_cast<uint32_t>(offset);
+            r.space = static_cast<uint8_t>(space);
+            r.width = static_cast<uint8_t>((width < 0xFF) ? width : 0xFF);
+            r.write = write ? 1 : 0;
+            r.reserved = 0;
+            b->push(r);
+        }
+    };
+};
+
+
+// For library translation units; headers test trace::gEnabled instead
+#ifdef ENZYME_TRACE
+#define ENZYME_TRACE_ACCESS(space, device, offset, value, width, write)     enzyme::trace::record(space, device, offset, value, width, write)
+#else
+#define ENZYME_TRACE_ACCESS(space, device, offset, value, width, write)     ((void)0)
+#endif
+
+
+#endif  // _enzyme_trace_h_
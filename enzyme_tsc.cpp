@@ -0,0 +1,239 @@
+///
+/// @file    enzyme_tsc.cpp
+/// @brief   Enzyme Hardware Abstraction Layer: Time Stamp Counter Clock
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#include "enzyme_tsc.h"
+#include "enzyme_cpu.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+
+// ---------------------------------------------------------------------------
+
+
+namespace enzyme
+{
+    namespace tsc
+    {
+        static const uint32_t gShift = 32;
+
+        static uint64_t steadyns()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+
+        ///
+        /// @brief Frequency from CPUID leaves 0x15/0x16 or the hypervisor timing leaf; 0 if not reported
+        ///
+
+        static uint64_t enumerated(Source& source)
+        {
+            cpu::Leaf l;
+            if(!cpu::cpuid(0, 0, l))
+                return 0;
+            uint32_t max = l.eax;
+
+            cpu::cpuid(0x01, 0, l);
+            if((l.ecx >> 31) & 1)
+            {
+                cpu::cpuid(0x40000000, 0, l);
+                if((l.eax >= 0x40000010) && (l.eax < 0x40010000))
+                {
+                    cpu::cpuid(0x40000010, 0, l);
+                    if(l.eax)
+                    {
+                        source = Hypervisor;
+                        return (uint64_t)l.eax * 1000;
+                    }
+                }
+            }
+
+            if(max >= 0x15)
+            {
+                cpu::cpuid(0x15, 0, l);
+                if(l.eax && l.ebx && l.ecx)
+                {
+                    source = Crystal;
+                    return (uint64_t)l.ecx * l.ebx / l.eax;
+                }
+            }
+            if(max >= 0x16)
+            {
+                cpu::cpuid(0x16, 0, l);
+                if(l.eax & 0xFFFF)
+                {
+                    source = Nominal;
+                    return (uint64_t)(l.eax & 0xFFFF) * 1000000;
+                }
+            }
+            return 0;
+        }
+
+
+        ///
+        /// @brief Sample the counter and steady_clock together, taking the tighter of a few tries
+        ///
+
+        static void sample(uint64_t& cycles, uint64_t& ns)
+        {
+            uint64_t best = ~(uint64_t)0;
+            for(int i = 0; i < 5; i++)
+            {
+                uint64_t t0 = steadyns();
+                uint64_t c = readp();
+                uint64_t t1 = steadyns();
+                if(t1 - t0 < best)
+                {
+                    best = t1 - t0;
+                    cycles = c;
+                    ns = t0 + (t1 - t0) / 2;
+                }
+            }
+        }
+
+
+        static Calibration calibrate()
+        {
+            Calibration c;
+            c.hz = 0;
+            c.mult = 0;
+            c.shift = gShift;
+            c.source = None;
+
+            if(cpu::has(cpu::InvariantTSC))
+            {
+                c.hz = enumerated(c.source);
+                if(!c.hz)
+                {
+                    uint64_t c0, t0, c1, t1;
+                    sample(c0, t0);
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                    sample(c1, t1);
+                    if((t1 > t0) && (c1 > c0))
+                    {
+                        c.hz = static_cast<uint64_t>((c1 - c0) * 1e9 / (t1 - t0));
+                        c.source = Calibrated;
+                    }
+                }
+            }
+
+            if(c.hz)
+                c.mult = static_cast<uint64_t>((1e9 * ((uint64_t)1 << gShift)) / c.hz);
+            else
+                c.source = None;
+
+            sample(c.base, c.basens);
+            return c;
+        }
+
+
+        ///
+        /// @brief Exchange counter readings between two processors
+        ///
+        /// The threads take turns; each checks that its own counter is not
+        /// below the last value published by the other, then publishes its own.
+        ///
+
+        static uint64_t exchange(unsigned int first, unsigned int second)
+        {
+            const int rounds = 1000;
+
+            std::atomic<uint64_t> stamp(0);
+            std::atomic<int> turn(0);
+            std::atomic<uint64_t> worst(0);
+
+            auto run = [&](unsigned int id, int me) {
+                try {
+                    cpu::Set self;
+                    self.set(id);
+                    self.pin();
+                }
+                catch(std::exception&) {
+                }
+
+                for(int i = 0; i < rounds; i++)
+                {
+                    unsigned int spin = 0;
+                    while(turn.load(std::memory_order_acquire) != me)
+                    {
+                        if(++spin > 1000)
+                            std::this_thread::yield();
+                    }
+
+                    uint64_t last = stamp.load(std::memory_order_relaxed);
+                    uint64_t t = readp();
+                    if((t < last) && (last - t > worst.load(std::memory_order_relaxed)))
+                        worst.store(last - t, std::memory_order_relaxed);
+                    stamp.store(t, std::memory_order_relaxed);
+                    turn.store(1 - me, std::memory_order_release);
+                }
+            };
+
+            std::thread a(run, first, 0);
+            std::thread b(run, second, 1);
+            a.join();
+            b.join();
+            return worst.load();
+        }
+
+
+        static uint64_t measure()
+        {
+            cpu::Set allowed = cpu::Set::affinity();
+
+            unsigned int first = allowed.limit();
+            uint64_t worst = 0;
+            for(unsigned int id = 0; id < allowed.limit(); id++)
+            {
+                if(!allowed.test(id))
+                    continue;
+                if(first == allowed.limit())
+                {
+                    first = id;
+                    continue;
+                }
+                worst = std::max(worst, exchange(first, id));
+            }
+            return worst;
+        }
+    };
+};
+
+
+// ---------------------------------------------------------------------------
+
+
+bool enzyme::tsc::rdtscp()
+{
+    static const bool result = cpu::has(cpu::RDTSCP);
+    return result;
+}
+
+
+const enzyme::tsc::Calibration& enzyme::tsc::calibration()
+{
+    static const Calibration result = calibrate();
+    return result;
+}
+
+
+uint64_t enzyme::tsc::skew()
+{
+    static const uint64_t result = measure();
+    return result;
+}
+
+
+bool enzyme::tsc::synchronized()
+{
+    return !skew();
+}
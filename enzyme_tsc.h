@@ -0,0 +1,185 @@
+///
+/// @file    enzyme_tsc.h
+/// @brief   Enzyme Hardware Abstraction Layer: Time Stamp Counter Clock
+///
+/// @author  Adam Leggett
+///
+
+// ---------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef _enzyme_tsc_h_
+#define _enzyme_tsc_h_
+
+
+#include "enzyme_type.h"
+
+#include <chrono>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+
+namespace enzyme
+{
+    namespace tsc
+    {
+
+        ///
+        /// @brief Read the time stamp counter; 0 where there is none
+        ///
+
+        inline uint64_t read()
+        {
+#if defined(_MSC_VER) || defined(__i386__) || defined(__x86_64__)
+            return __rdtsc();
+#else
+            return 0;
+#endif
+        }
+
+
+        /// @brief True if the processor has rdtscp, detected on first use
+        bool rdtscp();
+
+
+        ///
+        /// @brief Read the time stamp counter after all earlier instructions complete
+        ///
+        /// Uses rdtscp, or lfence and rdtsc on processors and hypervisors that
+        /// do not expose it.
+        ///
+
+        inline uint64_t readp()
+        {
+#if defined(_MSC_VER) || defined(__i386__) || defined(__x86_64__)
+            if(rdtscp())
+            {
+                unsigned int aux;
+                return __rdtscp(&aux);
+            }
+            _mm_lfence();
+            return __rdtsc();
+#else
+            return 0;
+#endif
+        }
+
+
+        ///
+        /// @brief How the counter frequency was obtained
+        ///
+
+        typedef enum
+        {
+            None,           // No usable invariant TSC; times come from the OS monotonic clock
+            Crystal,        // CPUID leaf 0x15 crystal clock and ratio
+            Nominal,        // CPUID leaf 0x16 base frequency
+            Hypervisor,     // Hypervisor timing leaf 0x40000010
+            Calibrated      // Measured against the OS monotonic clock
+        }
+        Source;
+
+
+        ///
+        /// @brief Counter to nanosecond conversion, fixed at first use
+        ///
+        /// ns = ((cycles - base) * mult) >> shift, plus basens, which lines the
+        /// result up with std::chrono::steady_clock at calibration time.
+        ///
+
+        typedef struct
+        {
+            uint64_t hz;
+            uint64_t mult;
+            uint32_t shift;
+            uint64_t base;
+            uint64_t basens;
+            Source source;
+        }
+        Calibration;
+
+        const Calibration& calibration();
+
+
+        inline uint64_t cycles_to_ns(uint64_t cycles, const Calibration& c)
+        {
+#if defined(__SIZEOF_INT128__)
+            return static_cast<uint64_t>((static_cast<unsigned __int128>(cycles) * c.mult) >> c.shift);
+#elif defined(_MSC_VER) && defined(_M_X64)
+            uint64_t hi;
+            uint64_t lo = _umul128(cycles, c.mult, &hi);
+            return c.shift ? ((lo >> c.shift) | (hi << (64 - c.shift))) : lo;
+#else
+            return static_cast<uint64_t>(static_cast<double>(cycles) * c.mult / ((uint64_t)1 << c.shift));
+#endif
+        }
+
+        inline uint64_t cycles_to_ns(uint64_t cycles)
+        {
+            return cycles_to_ns(cycles, calibration());
+        }
+
+
+        ///
+        /// @brief Nanoseconds on the steady_clock timeline
+        ///
+        /// A core whose TSC trails the one calibrated on may read below the
+        /// base; the delta is taken signed and clamped, so such a read returns
+        /// the calibration time rather than wrapping to the far future.
+        ///
+
+        inline uint64_t now()
+        {
+            const Calibration& c = calibration();
+            if(c.source == None)
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+            int64_t delta = static_cast<int64_t>(read() - c.base);
+            return c.basens + ((delta > 0) ? cycles_to_ns(static_cast<uint64_t>(delta), c) : 0);
+        }
+
+
+        ///
+        /// @brief std::chrono clock over now(), for deadlines and durations
+        ///
+
+        class Clock
+        {
+        public:
+            typedef std::chrono::nanoseconds duration;
+            typedef duration::rep rep;
+            typedef duration::period period;
+            typedef std::chrono::time_point<Clock> time_point;
+
+            static const bool is_steady = true;
+
+            static time_point now()
+            {
+                return time_point(duration(tsc::now()));
+            }
+        };
+
+
+        ///
+        /// @brief True if the counters of all processors in the process affinity agree
+        ///
+        /// Each processor in turn exchanges counter readings with the first one;
+        /// a reading lower than one already observed from the other side means
+        /// the counters are offset by more than the exchange latency. The result
+        /// is measured once and cached.
+        ///
+
+        bool synchronized();
+
+        /// @brief Largest backwards step, in cycles, seen by synchronized()
+        uint64_t skew();
+    };
+};
+
+
+#endif  // _enzyme_tsc_h_
@@ -18,6 +18,13 @@
 #endif
 
 
+///
+/// @brief Cache line size assumed for padding shared state
+///
+
+#define ENZYME_CACHELINE    64
+
+
 namespace enzyme
 {
 #if !defined(_MSC_VER) || (_MSC_VER >= 1600)
@@ -10,33 +10,126 @@
 
 #include "enzyme_linuxkernel.h"
 
+#include <atomic>
 #include <cerrno>
+#include <mutex>
 #include <sys/stat.h>
 
 
 // ---------------------------------------------------------------------------
 
 
+namespace enzyme
+{
+    namespace kernel
+    {
+        // Paths may be redirected while another thread enumerates, so each is
+        // read and written only under the lock, and handed out by value
+        static std::mutex gLock;
+        static std::string gSysfs("/sys");
+        static std::atomic<int> gSysfsState(-1);   // -1 unchecked, else 0 or 1
+        static std::string gProcfs("/proc");
+        static std::string gDevport("/dev/port");
+        static std::string gDevcpu("/dev/cpu");
+    };
+};
+
+
+// ---------------------------------------------------------------------------
+
+
 ///
 /// @brief Return true if Sysfs is supported; false otherwise
 ///
 
 bool enzyme::kernel::have_sysfs()
 {
-    static bool already = false;
-    static bool result;
-
-    if(already)
-        return result;
+    int state = gSysfsState.load(std::memory_order_acquire);
+    if(state >= 0)
+        return state != 0;
 
+    // Racing callers compute the same answer; any of them may store it
     struct stat st;
-    if(stat("/sys", &st) < 0)
-        result = false;
+    if(stat(sysfs().c_str(), &st) < 0)
+        state = 0;
     else if((st.st_mode & S_IFMT) != S_IFDIR)
-        result = false;
+        state = 0;
     else
-        result = true;
+        state = 1;
+
+    gSysfsState.store(state, std::memory_order_release);
+    return state != 0;
+}
+
+
+std::string enzyme::kernel::sysfs()
+{
+    std::lock_guard<std::mutex> lock(gLock);
+    return gSysfs;
+}
 
-    already = true;
-    return result;
+
+///
+/// @brief Redirect Sysfs lookups; call before enumerating
+///
+
+void enzyme::kernel::sysfs(const std::string& root)
+{
+    std::lock_guard<std::mutex> lock(gLock);
+    gSysfs = root;
+    gSysfsState.store(-1, std::memory_order_release);
+}
+
+
+std::string enzyme::kernel::procfs()
+{
+    std::lock_guard<std::mutex> lock(gLock);
+    return gProcfs;
+}
+
+
+///
+/// @brief Redirect Procfs lookups; call before enumerating
+///
+
+void enzyme::kernel::procfs(const std::string& root)
+{
+    std::lock_guard<std::mutex> lock(gLock);
+    gProcfs = root;
+}
+
+
+std::string enzyme::kernel::devport()
+{
+    std::lock_guard<std::mutex> lock(gLock);
+    return gDevport;
+}
+
+
+///
+/// @brief Redirect port accesses; applies to port clients created afterwards
+///
+
+void enzyme::kernel::devport(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(gLock);
+    gDevport = path;
+}
+
+
+std::string enzyme::kernel::devcpu()
+{
+    std::lock_guard<std::mutex> lock(gLock);
+    return gDevcpu;
+}
+
+
+///
+/// @brief Redirect MSR accesses; applies to cores that have not yet opened their device
+///
+
+void enzyme::kernel::devcpu(const std::string& root)
+{
+    std::lock_guard<std::mutex> lock(gLock);
+    gDevcpu = root;
 }
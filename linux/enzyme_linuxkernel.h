@@ -21,6 +21,40 @@ namespace enzyme
     namespace kernel
     {
         bool have_sysfs();
+
+        ///
+        /// @brief Sysfs mount point; may be redirected to a synthetic tree for testing
+        ///
+        /// The paths below are returned by value and may be redirected from any
+        /// thread, including while another enumerates.
+        ///
+
+        std::string sysfs();
+        void sysfs(const std::string& root);
+
+        ///
+        /// @brief Procfs mount point, read when there is no Sysfs; may be redirected for testing
+        ///
+
+        std::string procfs();
+        void procfs(const std::string& root);
+
+        ///
+        /// @brief Port device used when in/out cannot be issued directly
+        ///
+        /// Redirecting it to an ordinary file also disables direct port access,
+        /// so that port clients can be exercised without hardware.
+        ///
+
+        std::string devport();
+        void devport(const std::string& path);
+
+        ///
+        /// @brief Directory of per-processor devices (N/msr); may be redirected for testing
+        ///
+
+        std::string devcpu();
+        void devcpu(const std::string& root);
     };
 };
 
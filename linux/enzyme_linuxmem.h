@@ -15,6 +15,11 @@
 
 #include "../enzyme_mem.h"
 
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 
 namespace enzyme
 {
@@ -26,32 +31,72 @@ namespace enzyme
             ///
             /// @brief Memory resource mapped from physical to user virtual
             ///
+            /// Maps the Sysfs resource file of a BAR; WC requests use the _wc
+            /// variant where the kernel provides one (prefetchable BARs).
+            ///
 
             class Client : public impl::Client
             {
             private:
-                uintmax_t mSize;
+                void* mMap;
+                size_t mMapSize;
+                volatile uint8_t* mVirt;
+
+                /// @brief View into an existing mapping
+                Client(volatile uint8_t* virt)
+                    : mMap(NULL)
+                    , mMapSize(0)
+                    , mVirt(virt)
+                {
+                }
 
             public:
-                Client(uintmax_t rbase, uintmax_t rsize, Cache cache, uintmax_t offset, uintmax_t size)
+                Client(const std::string& path, uintmax_t rsize, Cache cache, uintmax_t offset, uintmax_t size)
+                    : mMap(NULL)
+                    , mMapSize(0)
+                    , mVirt(NULL)
                 {
+                    if(offset > rsize)
+                        throw std::runtime_error("Failed to map memory resource: Offset out of range");
+                    if(size > rsize - offset)
+                        size = rsize - offset;
+
+                    int fd = -1;
+                    if(cache == WC)
+                        fd = open((path + "_wc").c_str(), O_RDWR | O_SYNC);
+                    if(fd < 0)
+                        fd = open(path.c_str(), O_RDWR | O_SYNC);
+                    if(fd < 0)
+                        throw std::runtime_error("Failed to map memory resource: " + path);
+
+                    uintmax_t page = static_cast<uintmax_t>(sysconf(_SC_PAGESIZE));
+                    uintmax_t start = offset & ~(page - 1);
+                    mMapSize = static_cast<size_t>(offset - start + size);
+                    mMap = mmap(NULL, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, static_cast<off_t>(start));
+                    close(fd);
+
+                    if(mMap == MAP_FAILED)
                     {
-                        throw std::runtime_error("Failed to map memory resource");
+                        mMap = NULL;
+                        throw std::runtime_error("Failed to map memory resource: " + path);
                     }
+                    mVirt = static_cast<volatile uint8_t*>(mMap) + (offset - start);
                 }
 
                 ~Client()
                 {
+                    if(mMap)
+                        munmap(mMap, mMapSize);
                 }
 
                 volatile void* vaddr() const
                 {
-                    return reinterpret_cast<void*>(0);
+                    return mVirt;
                 }
 
                 impl::Client* client(Cache cache, uintmax_t offset, uintmax_t size) const
                 {
-                    return const_cast<Client*>(this); // FIXME!!
+                    return new Client(mVirt + offset);
                 }
             };
 
@@ -63,20 +108,22 @@ namespace enzyme
             class Resource : public mem::Resource
             {
             protected:
+                std::string mPath;
                 unsigned int mIndex;
 
             public:
-                Resource(unsigned int index)
-                    : mem::Resource(static_cast<uintmax_t>(0),
-                                    static_cast<uintmax_t>(0),
-                                    static_cast<uintmax_t>(0x00))
+                Resource(const std::string& path, unsigned int index, uintmax_t base, uintmax_t size, uintmax_t flag)
+                    : mem::Resource(base, size, flag)
+                    , mPath(path)
                     , mIndex(index)
                 {
                 }
 
+                unsigned int index() const { return mIndex; }
+
                 impl::Client* client(Cache cache, uintmax_t offset, uintmax_t size_) const
                 {
-                    return new Client(base(), size(), cache, offset, size_);
+                    return new Client(mPath, size(), cache, offset, size_);
                 }
             };
         };
@@ -10,9 +10,16 @@
 
 #include "enzyme_linuxkernel.h"
 #include "enzyme_linuxpci.h"
+#include "../enzyme_perf.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
 #include <dirent.h>
+#include <fcntl.h>
 #include <fstream>
+#include <sstream>
+#include <sys/file.h>
 
 
 // ---------------------------------------------------------------------------
@@ -24,6 +31,80 @@ namespace enzyme
     {
         namespace os
         {
+            enum
+            {
+                IORESOURCE_IO       = 0x00000100,
+                IORESOURCE_MEM      = 0x00000200,
+                IORESOURCE_PREFETCH = 0x00002000
+            };
+
+
+            ///
+            /// @brief Sysfs directory of a device
+            ///
+
+            static std::string sysfs(const Location& loc)
+            {
+                char buf[64];
+                snprintf(buf, sizeof(buf), "/bus/pci/devices/%04x:%02x:%02x.%x", loc.domain(), loc.bus(), loc.device(), loc.function());
+                return kernel::sysfs() + buf;
+            }
+
+
+            ///
+            /// @brief Procfs configuration space file of a device
+            ///
+
+            static std::string procfs(const Location& loc)
+            {
+                char buf[64];
+                snprintf(buf, sizeof(buf), "/bus/pci/%02x/%02x.%x", loc.bus(), loc.device(), loc.function());
+                return kernel::procfs() + buf;
+            }
+
+
+            ///
+            /// @brief Read a hex value (e.g. "0x8086") from a Sysfs attribute
+            ///
+
+            static unsigned int readhex(const std::string& path, unsigned int def)
+            {
+                std::ifstream is(path.c_str());
+                unsigned int value;
+                if(is >> std::hex >> value)
+                    return value;
+                return def;
+            }
+
+
+            ///
+            /// @brief Parse a line of /proc/bus/pci/devices
+            ///
+
+            typedef struct
+            {
+                unsigned int devfn;
+                unsigned int id;
+                unsigned int irq;
+                unsigned long long base[7];
+                unsigned long long size[7];
+            }
+            ProcEntry;
+
+            static ProcEntry procentry(const std::string& buf)
+            {
+                ProcEntry e;
+                memset(&e, 0, sizeof(e));
+
+                std::istringstream is(buf);
+                is >> std::hex >> e.devfn >> e.id >> e.irq;
+                for(int i = 0; i < 7; i++)
+                    is >> e.base[i];
+                for(int i = 0; i < 7; i++)
+                    is >> e.size[i];
+                return e;
+            }
+
         };
     };
 };
@@ -33,16 +114,38 @@ namespace enzyme
 
 
 ///
-/// @brief Enumerate all PCI devices
+/// @brief Enumerate all PCI functions into records
 ///
 
-enzyme::pci::os::Enumerator::Enumerator()
+enzyme::pci::os::Enumerator::Enumerator(std::pmr::memory_resource* resource)
+    : pci::Enumerator(resource)
 {
-    std::vector<enzyme::Device*> root(8);
+    scan(Filter());
+}
+
+
+enzyme::pci::os::Enumerator::Enumerator(const Filter& filter, std::pmr::memory_resource* resource)
+    : pci::Enumerator(resource)
+{
+    scan(filter);
+}
+
+
+void enzyme::pci::os::Enumerator::scan(const Filter& filter)
+{
+    ENZYME_PERF_OPERATION("pci.enumerate");
+
+    // Collected on the heap first, so that the arena holds the final array only
+    std::vector<Record> records;
+    Record r;
 
     if(kernel::have_sysfs())
     {
-        DIR* devices = opendir("/sys/bus/pci/devices");
+        // No PCI bus directory means no PCI; one that cannot be read is an error
+        std::string path = kernel::sysfs() + "/bus/pci/devices";
+        DIR* devices = opendir(path.c_str());
+        if(!devices && (errno != ENOENT))
+            throw std::runtime_error("PCI: Cannot read " + path + ": " + strerror(errno));
         if(devices)
         {
             struct dirent entry;
@@ -55,26 +158,27 @@ enzyme::pci::os::Enumerator::Enumerator()
                 unsigned int loc_fn;
                 if(sscanf(entry.d_name, "%x:%x:%x.%x", &loc_dom, &loc_bn, &loc_dn, &loc_fn) == 4)
                 {
-                    device().push_back(Device(*this, Location(loc_dom, loc_bn, loc_dn, loc_fn)));
+                    if(sysfsrecord(Location(loc_dom, loc_bn, loc_dn, loc_fn), filter, r))
+                        records.push_back(r);
                 }
             }
+            closedir(devices);
         }
     }
     else {
-        std::ifstream devices("/proc/bus/pci/devices");
+        std::ifstream devices((kernel::procfs() + "/bus/pci/devices").c_str());
         std::string buf;
         while(std::getline(devices, buf))
         {
-            device().push_back(Device(*this, buf));
+            // A class that could not be read is 0, which a class filter rejects like any other
+            r = procrecord(buf);
+            if(filter.accepts(r))
+                records.push_back(r);
         }
     }
 
-
-/*
-        if((loc_bn == 0) && (loc_dn == 0) && (loc_fn == 0))
-            rootnode = rootdev = &device().back();*/
-
-    device().sort();
+    std::sort(records.begin(), records.end(), [](const Record& a, const Record& b) { return pci::location(a) < pci::location(b); });
+    mRecord.assign(records.begin(), records.end());
 }
 
 
@@ -91,27 +195,196 @@ enzyme::pci::os::Enumerator::~Enumerator()
 
 
 ///
-/// @brief Enumerate PCI device resources
+/// @brief Read the configuration, driver, node and resources of a function from Sysfs
+///
+/// Returns false, having read as little as possible, if the function does
+/// not pass the filter.
+///
+
+bool enzyme::pci::os::Enumerator::sysfsrecord(const Location& location, const Filter& filter, Record& r)
+{
+    if(!filter.accepts_location(location))
+        return false;
+
+    std::string path = sysfs(location);
+
+    memset(&r, 0, sizeof(r));
+    r.location = location.to_i();
+    r.vendor = static_cast<uint16_t>(readhex(path + "/vendor", 0xFFFF));
+    if(!filter.accepts_vendor(r.vendor))
+        return false;
+    r.device = static_cast<uint16_t>(readhex(path + "/device", 0xFFFF));
+    if(!filter.accepts_device(r.device))
+        return false;
+    r.classid = readhex(path + "/class", 0);
+    if(!filter.accepts_class(r.classid))
+        return false;
+
+    r.subvendor = static_cast<uint16_t>(readhex(path + "/subsystem_vendor", 0xFFFF));
+    r.subdevice = static_cast<uint16_t>(readhex(path + "/subsystem_device", 0xFFFF));
+
+    char link[256];
+    ssize_t len = readlink((path + "/driver").c_str(), link, sizeof(link) - 1);
+    if(len > 0)
+    {
+        link[len] = '\0';
+        const char* name = strrchr(link, '/');
+        r.service = service(name ? name + 1 : link);
+    }
+
+    int node;
+    std::ifstream is((path + "/numa_node").c_str());
+    r.node = (is >> node) ? static_cast<int16_t>(node) : -1;
+
+    std::ifstream res((path + "/resource").c_str());
+    std::string line;
+    int bar = 0;
+    while((bar < Record::Bars) && std::getline(res, line))
+    {
+        unsigned long long start, end, flags;
+        if((sscanf(line.c_str(), "%llx %llx %llx", &start, &end, &flags) == 3) && end)
+        {
+            if(flags & IORESOURCE_MEM)
+                setbar(r, bar, start, end - start + 1, (flags & IORESOURCE_PREFETCH) ? Record::BarPrefetch : 0);
+            else if(flags & IORESOURCE_IO)
+                setbar(r, bar, start, end - start + 1, Record::BarIO);
+        }
+        bar++;
+    }
+    return filter.accepts_record(r);
+}
+
+
+///
+/// @brief Parse the configuration and resources of a function from Procfs
+///
+
+enzyme::pci::Record enzyme::pci::os::Enumerator::procrecord(const std::string& buf)
+{
+    ProcEntry e = procentry(buf);
+
+    Record r;
+    memset(&r, 0, sizeof(r));
+    r.location = Location(0, (e.devfn >> 8) & 0xFF, (e.devfn >> 3) & 0x1F, e.devfn & 0x7).to_i();
+    r.vendor = static_cast<uint16_t>(e.id >> 16);
+    r.device = static_cast<uint16_t>(e.id & 0xFFFF);
+    r.subvendor = r.subdevice = 0xFFFF;
+    r.node = -1;
+
+    // The class is not listed; the header of configuration space is readable by any user
+    std::ifstream cfg(procfs(pci::location(r)).c_str(), std::ios::in | std::ios::binary);
+    uint8_t rev[4];
+    if(cfg.seekg(0x08) && cfg.read(reinterpret_cast<char*>(rev), sizeof(rev)))
+        r.classid = rev[1] | (rev[2] << 8) | (rev[3] << 16);
+
+    for(int bar = 0; bar < Record::Bars; bar++)
+    {
+        if(!e.size[bar])
+            continue;
+
+        if(e.base[bar] & 0x1)
+            setbar(r, bar, e.base[bar] & ~0x3ULL, e.size[bar], Record::BarIO);
+        else
+            setbar(r, bar, e.base[bar] & ~0xFULL, e.size[bar], (e.base[bar] & 0x08) ? Record::BarPrefetch : 0);
+    }
+    return r;
+}
+
+
+///
+/// @brief Build the devices from the records
+///
+
+void enzyme::pci::os::Enumerator::materialize()
+{
+    std::pmr::vector<Record>::const_iterator i;
+    for(i = mRecord.begin(); i != mRecord.end(); i++)
+        mDevice.push_back(Device(*this, *i));
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+///
+/// @brief Create the resources of a function from its record
+///
+/// Procfs BARs cannot be mapped without Sysfs; they are listed but not mappable.
 ///
 
-enzyme::pci::os::Device::Device(Enumerator& enumerator, const Location& location)
-    : pci::Device(enumerator, location, Config())
+enzyme::pci::os::Device::Device(Enumerator& enumerator, const Record& record)
+    : pci::Device(enumerator, pci::location(record), pci::config(record))
     , mEnumerator(enumerator)
 {
-    // mService = service;
+    mService = enumerator.service(record).string();
+    mNode = record.node;
 
-    // TODO
+    bool mappable = kernel::have_sysfs();
+    std::string path = mappable ? sysfs(location()) : std::string();
 
-    std::vector<mem::os::Resource>::iterator mi;
-    for(mi = mMemResourceOS.begin(); mi != mMemResourceOS.end(); mi++)
-        mMemResource.insert(&*mi);
+    if(mappable)
+    {
+        std::ifstream cpulist((path + "/local_cpulist").c_str());
+        std::string list;
+        if(std::getline(cpulist, list))
+            mLocalCPU = cpu::Set(list);
+    }
 
-    std::vector<port::os::Resource>::iterator pi;
-    for(pi = mPortResourceOS.begin(); pi != mPortResourceOS.end(); pi++)
-        mPortResource.insert(&*pi);
+    for(int bar = 0; bar < Bars; bar++)
+    {
+        uint64_t size = barsize(record, bar);
+        if(!size)
+            continue;
+
+        if(record.flag[bar] & Record::BarIO)
+            add(std::make_shared<const port::os::Resource>(bar, static_cast<uint16_t>(record.base[bar]), static_cast<uint16_t>(size)), bar);
+        else {
+            std::ostringstream file;
+            if(mappable)
+                file << path << "/resource" << bar;
+            add(std::make_shared<const mem::os::Resource>(file.str(), bar, record.base[bar], size, (record.flag[bar] & Record::BarPrefetch) ? 0x08 : 0x00), bar);
+        }
+    }
 }
 
 
 enzyme::pci::os::Device::~Device()
 {
 }
+
+
+// ---------------------------------------------------------------------------
+
+
+///
+/// @brief Open the configuration space of a device
+///
+
+enzyme::pci::os::Client::Client(const pci::Device& device, bool writable, bool exclusive)
+    : mDevice(device)
+{
+    std::string path;
+    if(kernel::have_sysfs())
+        path = sysfs(device.location()) + "/config";
+    else
+        path = procfs(device.location());
+
+    mFD = open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+    if(mFD < 0)
+        throw std::runtime_error("PCI configuration space: Cannot open " + path);
+
+    if(exclusive && (flock(mFD, LOCK_EX | LOCK_NB) < 0))
+    {
+        int err = errno;
+        close(mFD);
+        if(err == EWOULDBLOCK)
+            throw std::runtime_error("PCI configuration space: " + path + " is held by another exclusive client");
+        throw std::runtime_error("PCI configuration space: Cannot lock " + path + ": " + strerror(err));
+    }
+}
+
+
+enzyme::pci::os::Client::~Client()
+{
+    close(mFD);
+}
@@ -14,8 +14,10 @@
 
 
 #include <cstring>
+#include <string>
 #include <vector>
 #include <stdexcept>
+#include <unistd.h>
 
 #include "enzyme_linuxmem.h"
 #include "enzyme_linuxport.h"
@@ -37,9 +39,17 @@ namespace enzyme
             class Enumerator : public pci::Enumerator
             {
             protected:
+                bool sysfsrecord(const Location& location, const Filter& filter, Record& r);
+                Record procrecord(const std::string& buf);
+
+                void scan(const Filter& filter);
+                void materialize();
 
             public:
-                Enumerator();
+                explicit Enumerator(std::pmr::memory_resource* resource = NULL);
+
+                /// @brief Enumerate only the functions that pass a filter
+                explicit Enumerator(const Filter& filter, std::pmr::memory_resource* resource = NULL);
                 ~Enumerator();
             };
 
@@ -53,13 +63,8 @@ namespace enzyme
             protected:
                 Enumerator& mEnumerator;
 
-                // TODO:make const
-                std::vector<mem::os::Resource> mMemResourceOS;
-                std::vector<port::os::Resource> mPortResourceOS;
-
             public:
-                Device(Enumerator& enumerator, const Location& location);
-                Device(Enumerator& enumerator, const std::string& buf);
+                Device(Enumerator& enumerator, const Record& record);
                 ~Device();
 
                 Enumerator& enumerator() const { return mEnumerator; }
@@ -69,42 +74,41 @@ namespace enzyme
             ///
             /// @brief Linux accessor to PCI device
             ///
+            /// Configuration space is accessed through the Sysfs (or Procfs) config
+            /// file of the device. An exclusive client holds an flock() on that file
+            /// for its lifetime, so a second exclusive client of the same device, in
+            /// any process, fails to open; the kernel driver stays bound.
+            ///
 
             class Client
             {
             private:
-                const Device& mDevice;
+                const pci::Device& mDevice;
+                int mFD;
 
             public:
 
                 ///
-                /// @brief If exclusive, disable the existing kernel service for this device
+                /// @brief If exclusive, lock the device against other exclusive clients
                 ///
 
-                Client(const Device& device, bool writable, bool exclusive)
-                    : mDevice(device)
-                {
-                    if(exclusive)
-                    {
-                    }
-                }
+                Client(const pci::Device& device, bool writable, bool exclusive);
 
 
                 ///
-                /// @brief If exclusive, reenable the existing kernel service for this device
+                /// @brief Close the configuration space, releasing any lock
                 ///
 
-                ~Client()
-                {
-                }
+                ~Client();
 
 
                 ///
-                /// @brief Send ioctl to read PCI configuration space for this device
+                /// @brief Read PCI configuration space for this device
                 ///
 
                 void cfgr(size_t offset, size_t len, void* dst)
                 {
+                    if(pread(mFD, dst, len, static_cast<off_t>(offset)) != static_cast<ssize_t>(len))
                     {
                         throw std::runtime_error("PCI configuration space: " + std::string("Failed to read entire range"));
                     }
@@ -112,12 +116,15 @@ namespace enzyme
 
 
                 ///
-                /// @brief Send ioctl to write PCI configuration space for this device
+                /// @brief Write PCI configuration space for this device
                 ///
 
                 void cfgw(size_t offset, size_t len, const void* src)
                 {
-                    throw std::runtime_error("PCI configuration space: Unimplemented");
+                    if(pwrite(mFD, src, len, static_cast<off_t>(offset)) != static_cast<ssize_t>(len))
+                    {
+                        throw std::runtime_error("PCI configuration space: " + std::string("Failed to write entire range"));
+                    }
                 }
             };
         };
@@ -14,6 +14,15 @@
 
 
 #include "../enzyme_port.h"
+#include "enzyme_linuxkernel.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <sys/io.h>
+#endif
 
 
 namespace enzyme
@@ -22,23 +31,173 @@ namespace enzyme
     {
         namespace os
         {
-            class Resource : public port::Resource
+
+            ///
+            /// @brief Linux port accessor
+            ///
+            /// Requests direct access with ioperm() (ports below 0x400) or iopl(),
+            /// which needs CAP_SYS_RAWIO. Both grant permission to the calling
+            /// thread only, so it is requested on the first access from each
+            /// thread and recorded in thread-local state; a client may be created
+            /// on one thread and used on others. Where permission is refused,
+            /// accesses go through pread/pwrite on kernel::devport(), which is
+            /// therefore always opened. Note that /dev/port transfers bytes from
+            /// consecutive ports, so wider values are only exact through direct
+            /// access.
+            ///
+
+            class Client : public impl::Client
             {
             protected:
-                unsigned int mIndex;
+                uint16_t mBase;
+                uint16_t mSize;
+                bool mAllowDirect;
+                int mFD;
+                int mError;
+
+                Client(const Client&);
+                Client& operator=(const Client&);
+
+                typedef struct
+                {
+                    int level;                  // iopl(3): 0 not yet requested, 1 granted, -1 refused
+                    uint64_t port[0x400 / 64];  // Ports granted by ioperm()
+                }
+                Permission;
+
+                static Permission& permission()
+                {
+                    static thread_local Permission gPermission;
+                    return gPermission;
+                }
+
+                static bool granted(const Permission& p, uint16_t port, size_t width)
+                {
+                    if(static_cast<size_t>(port) + width > 0x400)
+                        return false;
+                    for(size_t i = port; i < port + width; i++)
+                    {
+                        if(!(p.port[i / 64] & (1ULL << (i % 64))))
+                            return false;
+                    }
+                    return true;
+                }
+
+                bool permit(Permission& p)
+                {
+#if defined(__i386__) || defined(__x86_64__)
+                    if((static_cast<unsigned int>(mBase) + mSize <= 0x400) && (ioperm(mBase, mSize, 1) == 0))
+                    {
+                        for(unsigned int i = mBase; i < static_cast<unsigned int>(mBase) + mSize; i++)
+                            p.port[i / 64] |= 1ULL << (i % 64);
+                        return true;
+                    }
+                    if(!p.level)
+                        p.level = (iopl(3) == 0) ? 1 : -1;
+                    return p.level > 0;
+#else
+                    return false;
+#endif
+                }
+
+                int fd() const
+                {
+                    if(mFD < 0)
+                        throw std::runtime_error("I/O port resource: " + kernel::devport() + ": " + strerror(mError));
+                    return mFD;
+                }
 
             public:
-                Resource(unsigned int index)
-                    : port::Resource(static_cast<uint16_t>(0),
-                                     static_cast<uint16_t>(0))
-                    , mIndex(index)
+                Client(uint16_t base, uint16_t size)
+                    : mBase(base)
+                    , mSize(size)
+                    , mAllowDirect(false)
+                    , mFD(-1)
+                    , mError(0)
+                {
+#if defined(__i386__) || defined(__x86_64__)
+                    mAllowDirect = (kernel::devport() == "/dev/port");
+#endif
+                    mFD = open(kernel::devport().c_str(), O_RDWR);
+                    if(mFD < 0)
+                    {
+                        mError = errno;
+                        if(!mAllowDirect)
+                            throw std::runtime_error("I/O port resource: " + kernel::devport() + ": " + strerror(mError));
+                    }
+                }
+
+                ~Client()
                 {
+                    if(mFD >= 0)
+                        close(mFD);
+                }
+
+                impl::Client* client()
+                {
+                    return new Client(mBase, mSize);
+                }
+
+                ///
+                /// @brief True if the calling thread may access port directly
+                ///
+                /// Permission is requested for the whole client range the first
+                /// time a thread needs it; a refusal of iopl() is remembered, so
+                /// a thread without permission costs one test per access.
+                ///
+
+                bool direct(uint16_t port, size_t width)
+                {
+                    if(!mAllowDirect)
+                        return false;
+
+                    Permission& p = permission();
+                    if((p.level > 0) || granted(p, port, width))
+                        return true;
+                    if(p.level < 0)
+                        return false;
+                    return permit(p) && ((p.level > 0) || granted(p, port, width));
+                }
+
+                void read(uint16_t port, size_t width, size_t cnt, void* dst)
+                {
+                    uint8_t* data = static_cast<uint8_t*>(dst);
+                    for(size_t i = 0; i < cnt; i++, data += width)
+                    {
+                        if(pread(fd(), data, width, port) != static_cast<ssize_t>(width))
+                            throw std::runtime_error("I/O port resource: Failed to read port");
+                    }
+                }
+
+                void write(uint16_t port, size_t width, size_t cnt, const void* src)
+                {
+                    const uint8_t* data = static_cast<const uint8_t*>(src);
+                    for(size_t i = 0; i < cnt; i++, data += width)
+                    {
+                        if(pwrite(fd(), data, width, port) != static_cast<ssize_t>(width))
+                            throw std::runtime_error("I/O port resource: Failed to write port");
+                    }
                 }
             };
 
-            class Client
+            class Resource : public port::Resource
             {
+            protected:
+                unsigned int mIndex;
+
             public:
+                Resource(unsigned int index, uint16_t base, uint16_t size)
+                    : port::Resource(base, size)
+                    , mIndex(index)
+                {
+                }
+
+                unsigned int index() const { return mIndex; }
+
+                impl::Client* client() const
+                {
+                    return new Client(base(), size());
+                }
             };
         };
     };
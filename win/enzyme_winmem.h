@@ -42,9 +42,21 @@ namespace enzyme
             private:
                 enzyme_MapResource_data mData;
                 uintmax_t mSize;
+                bool mOwner;
+
+                /// @brief View into an existing mapping
+                Client(const enzyme_MapResource_data& data, uintmax_t offset)
+                    : mData(data)
+                    , mSize(0)
+                    , mOwner(false)
+                {
+                    mData.vaddr += offset;
+                }
 
             public:
                 Client(uintmax_t rbase, uintmax_t rsize, Cache cache, uintmax_t offset, uintmax_t size)
+                    : mSize(rsize)
+                    , mOwner(true)
                 {
                     enzyme_MapResource_in in;
                     in.base = rbase;
@@ -69,6 +81,9 @@ namespace enzyme
 
                 ~Client()
                 {
+                    if(!mOwner)
+                        return;
+
                     enzyme_UnmapResource_in in;
                     in.data = mData;
                     in.size = mSize;
@@ -84,7 +99,7 @@ namespace enzyme
 
                 impl::Client* client(Cache cache, uintmax_t offset, uintmax_t size) const
                 {
-                    return const_cast<Client*>(this); // FIXME!!
+                    return new Client(mData, offset);
                 }
             };
 
@@ -9,6 +9,7 @@
 
 
 #include "enzyme_winpci.h"
+#include "../enzyme_perf.h"
 
 #include <iostream>
 #include <tchar.h>
@@ -42,6 +43,72 @@ namespace enzyme
                 }
                 return r;
             }
+
+
+            ///
+            /// @brief Base addresses programmed in the BARs; false if configuration space is unreadable
+            ///
+            /// io[i] is 1 for an I/O BAR; the upper half of a 64-bit BAR reads as base 0.
+            ///
+
+            static bool readbars(const Device& device, uint64_t* base, uint8_t* io)
+            {
+                uint32_t raw[pci::Device::Bars];
+                unsigned int bars;
+                try {
+                    Client client(device, false, false);
+                    client.cfgr(0x10, sizeof(raw), raw);
+
+                    // Bridges (header type 1) have two BARs
+                    uint8_t header;
+                    client.cfgr(0x0E, 1, &header);
+                    bars = ((header & 0x7F) == 1) ? 2 : pci::Device::Bars;
+                }
+                catch(std::exception&) {
+                    return false;
+                }
+
+                for(unsigned int i = 0; i < pci::Device::Bars; i++)
+                {
+                    base[i] = 0;
+                    io[i] = 0;
+                }
+                for(unsigned int i = 0; i < bars; i++)
+                {
+                    if(raw[i] & 1)
+                    {
+                        base[i] = raw[i] & ~3U;
+                        io[i] = 1;
+                    }
+                    else {
+                        base[i] = raw[i] & ~0xFU;
+                        if((((raw[i] >> 1) & 3) == 2) && (i + 1 < bars))
+                        {
+                            base[i] |= static_cast<uint64_t>(raw[i + 1]) << 32;
+                            i++;
+                        }
+                    }
+                }
+                return true;
+            }
+
+
+            ///
+            /// @brief BAR programmed with base; next in report order if unknown
+            ///
+
+            static int barindex(bool known, const uint64_t* base, const uint8_t* io, uint64_t start, bool isio, int& next)
+            {
+                if(known)
+                {
+                    for(int i = 0; i < pci::Device::Bars; i++)
+                    {
+                        if(base[i] && (base[i] == start) && (io[i] == (isio ? 1 : 0)))
+                            return i;
+                    }
+                }
+                return next++;
+            }
         };
     };
 };
@@ -54,8 +121,31 @@ namespace enzyme
 /// @brief Enumerate all PCI devices
 ///
 
-enzyme::pci::os::Enumerator::Enumerator()
+enzyme::pci::os::Enumerator::Enumerator(std::pmr::memory_resource* resource)
+    : pci::Enumerator(resource)
+{
+    scan(Filter());
+}
+
+
+enzyme::pci::os::Enumerator::Enumerator(const Filter& filter, std::pmr::memory_resource* resource)
+    : pci::Enumerator(resource)
+{
+    scan(filter);
+}
+
+
+///
+/// @brief Enumerate the functions that pass a filter
+///
+/// IDs and location come from the registry; only functions that pass the
+/// filter have their resources read.
+///
+
+void enzyme::pci::os::Enumerator::scan(const Filter& filter)
 {
+    ENZYME_PERF_OPERATION("pci.enumerate");
+
     mDI = SetupDiGetClassDevs(NULL, REGSTR_KEY_PCIENUM, 0, DIGCF_PRESENT | DIGCF_ALLCLASSES);
     if(mDI == INVALID_HANDLE_VALUE)
         throw std::runtime_error("Cannot access setupapi. Please run as administrator.");
@@ -99,10 +189,13 @@ enzyme::pci::os::Enumerator::Enumerator()
         if((_stscanf_s(buf, TEXT("PCI bus %u, device %u, function %u"), &loc_bn, &loc_dn, &loc_fn) != 3))
             continue;
 
+        if(!filter.accepts_location(Location(0, loc_bn, loc_dn, loc_fn)) || !filter.accepts_vendor(cfg_vendor) || !filter.accepts_device(cfg_device) || !filter.accepts_class(cfg_class))
+            continue;
+
         if(!getregprop(mDI, didata, SPDRP_SERVICE, buf, len))
             *buf = '\0';
 
-        device().push_back(
+        mDevice.push_back(
             Device(*this,
                     Location(0, loc_bn, loc_dn, loc_fn),
                     Config(cfg_vendor, cfg_device, cfg_subvendor, cfg_subdevice, cfg_class),
@@ -111,12 +204,24 @@ enzyme::pci::os::Enumerator::Enumerator()
                     didata));
 
         if((loc_bn == 0) && (loc_dn == 0) && (loc_fn == 0))
-            rootnode = rootdev = &device().back();
+            rootnode = rootdev = &mDevice.back();
     }
 
     delete [] buf;
 
-    device().sort();
+    // Devices are built directly from SetupAPI; keep their records alongside
+    mDevice.sort();
+    std::pmr::list<pci::Device>::iterator i;
+    for(i = mDevice.begin(); i != mDevice.end(); )
+    {
+        record(*i);
+        if(filter.accepts_record(mRecord.back()))
+            i++;
+        else {
+            mRecord.pop_back();
+            i = mDevice.erase(i);
+        }
+    }
 }
 
 
@@ -154,32 +259,34 @@ enzyme::pci::os::Device::Device(Enumerator& enumerator, const Location& loc, con
 
     SetupDiGetDeviceInstallParams(di, &didata, &mDIP);
 
+    // The configuration manager does not report BAR numbers, so each resource
+    // is matched against the base addresses programmed in configuration space.
+    // Without the kernel service, resources of each type are numbered in the
+    // order reported (see pci::Device::bar())
+    uint64_t base[Bars];
+    uint8_t io[Bars];
+    bool known = readbars(*this, base, io);
+
     LOG_CONF logconf;
     if(CM_Get_First_Log_Conf(&logconf, didata.DevInst, BOOT_LOG_CONF) == CR_SUCCESS)
     {
+        int next = 0;
         RES_DES rd = logconf;
         while(CM_Get_Next_Res_Des(&rd, rd, ResType_Mem, NULL, 0) == CR_SUCCESS)
         {
             MEM_RESOURCE mr;
             if(CM_Get_Res_Des_Data(rd, &mr, sizeof(mr), 0) == CR_SUCCESS)
-                mMemResourceOS.push_back(mr);
+                add(std::make_shared<const mem::os::Resource>(mr), barindex(known, base, io, mr.MEM_Header.MD_Alloc_Base, false, next));
         }
+        next = 0;
         rd = logconf;
         while(CM_Get_Next_Res_Des(&rd, rd, ResType_IO, NULL, 0) == CR_SUCCESS)
         {
             IO_RESOURCE ior;
             if(CM_Get_Res_Des_Data(rd, &ior, sizeof(ior), 0) == CR_SUCCESS)
-                mPortResourceOS.push_back(ior);
+                add(std::make_shared<const port::os::Resource>(ior), barindex(known, base, io, ior.IO_Header.IOD_Alloc_Base, true, next));
         }
     }
-
-    std::vector<mem::os::Resource>::iterator mi;
-    for(mi = mMemResourceOS.begin(); mi != mMemResourceOS.end(); mi++)
-        mMemResource.insert(&*mi);
-
-    std::vector<port::os::Resource>::iterator pi;
-    for(pi = mPortResourceOS.begin(); pi != mPortResourceOS.end(); pi++)
-        mPortResource.insert(&*pi);
 }
 
 
@@ -43,8 +43,13 @@ namespace enzyme
             protected:
                 HDEVINFO mDI;
 
+                void scan(const Filter& filter);
+
             public:
-                Enumerator();
+                explicit Enumerator(std::pmr::memory_resource* resource = NULL);
+
+                /// @brief Enumerate only the functions that pass a filter
+                explicit Enumerator(const Filter& filter, std::pmr::memory_resource* resource = NULL);
                 ~Enumerator();
 
                 HDEVINFO devinfo() const { return mDI; }
@@ -63,10 +68,6 @@ namespace enzyme
                 SP_DEVINFO_DATA mDI;
                 SP_DEVINSTALL_PARAMS mDIP;
 
-                // TODO:make const
-                std::vector<mem::os::Resource> mMemResourceOS;
-                std::vector<port::os::Resource> mPortResourceOS;
-
             public:
                 Device(Enumerator& enumerator, const Location& loc, const Config& cfg, const PTSTR service, HDEVINFO di, SP_DEVINFO_DATA& didata);
                 ~Device();
@@ -94,6 +95,7 @@ namespace enzyme
 
                 Client(const Device& device, bool writable, bool exclusive)
                     : mDevice(device)
+                    , mServiceDisabled(false)
                 {
                     if(exclusive)
                     {
@@ -32,6 +32,60 @@ namespace enzyme
     {
         namespace os
         {
+            class Client : public impl::Client, public kernel::Client
+            {
+            public:
+                impl::Client* client()
+                {
+                    return new Client;
+                }
+
+
+                ///
+                /// @brief Send one ioctl per value to read a port
+                ///
+
+                void read(uint16_t port, size_t width, size_t cnt, void* dst)
+                {
+                    enzyme_ReadPort_in in;
+                    in.ulAddr   = port;
+                    in.ulSize   = static_cast<DWORD>(width);
+
+                    uint8_t* data = static_cast<uint8_t*>(dst);
+                    for(size_t i = 0; i < cnt; i++, data += width)
+                    {
+                        DWORD value;
+                        DWORD rlen;
+                        if(!DeviceIoControl(handle(), IOCTL_ENZYME_READPORT, &in, sizeof(in), &value, sizeof(value), &rlen, NULL))
+                            throw std::runtime_error("I/O port resource: " + kernel::lasterror());
+                        memcpy(data, &value, width);
+                    }
+                }
+
+
+                ///
+                /// @brief Send one ioctl per value to write a port
+                ///
+
+                void write(uint16_t port, size_t width, size_t cnt, const void* src)
+                {
+                    enzyme_WritePort_in in;
+                    in.ulAddr   = port;
+                    in.ulSize   = static_cast<DWORD>(width);
+
+                    const uint8_t* data = static_cast<const uint8_t*>(src);
+                    for(size_t i = 0; i < cnt; i++, data += width)
+                    {
+                        in.ulVal = 0;
+                        memcpy(&in.ulVal, data, width);
+
+                        DWORD rlen;
+                        if(!DeviceIoControl(handle(), IOCTL_ENZYME_WRITEPORT, &in, sizeof(in), NULL, 0, &rlen, NULL))
+                            throw std::runtime_error("I/O port resource: " + kernel::lasterror());
+                    }
+                }
+            };
+
             class Resource : public port::Resource
             {
             protected:
@@ -44,11 +98,11 @@ namespace enzyme
                     , mIOR(ior)
                 {
                 }
-            };
 
-            class Client : public kernel::Client
-            {
-            public:
+                impl::Client* client() const
+                {
+                    return new Client;
+                }
             };
         };
     };